@@ -6,6 +6,10 @@
 #include <cstdio>
 #include <chrono>
 #include <errno.h>
+#include <fcntl.h>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
 #include <csignal>
 #include <iostream>
 #include <sstream>
@@ -20,6 +24,9 @@
 
 #include "src/dfs-utils.h"
 #include "src/dfslibx-clientnode-p2.h"
+#include "src/dfslibx-trace.h"
+#include "src/dfslibx-crc32.h"
+#include "src/dfslibx-compact-listing.h"
 #include "dfslib-shared-p2.h"
 #include "dfslib-clientnode-p2.h"
 #include "proto-src/dfs-service.grpc.pb.h"
@@ -50,6 +57,7 @@ grpc::StatusCode DFSClientNodeP2::RequestWriteAccess(const std::string &filename
     //Adding deadline exceeded timer
     ClientContext clientContext;
     clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));  
+    DFSTracer::Inject(&clientContext);
 
     //Message structs
     dfs_service::GetLockRequest glRequestMsg;
@@ -90,9 +98,14 @@ grpc::StatusCode DFSClientNodeP2::Store(const std::string &filename) {
     //Logging for potential debugging
     dfs_log(LL_SYSINFO) << "ClientSide | Requesting to store file: " << filename;
 
+    //Trace id shared by the lock and upload RPCs of this store
+    DFSTraceScope traceScope;
+    DFSTraceSpan storeSpan("Store", "client", filename);
+
     //Adding deadline exceeded timer
     ClientContext clientContext;
     clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));  
+    DFSTracer::Inject(&clientContext);
 
     //Creating filePath string
     const std::string& filePath = WrapPath(filename);
@@ -115,7 +128,9 @@ grpc::StatusCode DFSClientNodeP2::Store(const std::string &filename) {
     //////////////////////////////////////////////////////////////
     //Request Server for writer lock if check sums are different//
     //////////////////////////////////////////////////////////////
+    DFSTraceSpan lockSpan("Store.lock", "client", filename);
     StatusCode msgGotLockStatus = RequestWriteAccess(filename);
+    lockSpan.End();
     if(msgGotLockStatus != StatusCode::OK){
         dfs_log(LL_ERROR) << "ClientSide | Could not get Writer Lock for file [" << filename << "] Upload Request StatusCode: " << msgGotLockStatus;
         return msgGotLockStatus;
@@ -134,12 +149,17 @@ grpc::StatusCode DFSClientNodeP2::Store(const std::string &filename) {
 
     //Creating variables for fileUploadRequest function and populating them 
     dfs_service::UploadResponse FileUploadResponse;
-    std::unique_ptr<ClientWriter<dfs_service::UploadRequest>> cwriter (service_stub->fileUploadRequest(&clientContext, &FileUploadResponse));
+    //Only the data extents of a sparse file are sent, so route it by what is allocated
+    bool sparse = dfs_file_is_sparse(fileStat);
+    DFSLaneLease lane = TransferLane(sparse ? static_cast<uint64_t>(fileStat.st_blocks) * 512 : fileSize);
+    std::unique_ptr<ClientWriter<dfs_service::UploadRequest>> cwriter (lane->fileUploadRequest(&clientContext, &FileUploadResponse));
     dfs_service::UploadRequest FileUploadRequest;
     FileUploadRequest.set_filename(filename);
     FileUploadRequest.set_filesize(fileSize);
     FileUploadRequest.set_clientid(ClientId());
+    DFSTraceSpan checksumSpan("Store.checksum", "client", filename);
     FileUploadRequest.set_cfilechecksum(dfs_file_checksum(filePath, &crc_table));
+    checksumSpan.End();
     FileUploadRequest.mutable_cfilemtime()->set_seconds(mtime);
 
     //Logging
@@ -147,13 +167,57 @@ grpc::StatusCode DFSClientNodeP2::Store(const std::string &filename) {
 
 
     //Reading bytes of the file and sending it through a stream msg
-    std::size_t bytesRead = 0;
-    while(!file.eof()){
+    DFSTraceSpan sendSpan("Store.send", "client", filename);
+    off_t bytesRead = 0;
+    if(sparse){
+        FileUploadRequest.set_extents(true);
+        int fd = open(filePath.c_str(), O_RDONLY);
+        if(fd < 0){
+            dfs_log(LL_ERROR) << "ClientSide | Unable to open file: " << filePath << " " << strerror(errno);
+            clientContext.TryCancel();
+            cwriter->Finish();
+            return StatusCode::CANCELLED;
+        }
+        //Each chunk carries its offset and the holes between extents are never read
+        bool sentAny = false;
+        off_t position = 0;
+        off_t dataStart;
+        off_t dataEnd;
+        while(position < fileSize && dfs_next_data_extent(fd, position, fileSize, &dataStart, &dataEnd)){
+            for(off_t chunkStart = dataStart; chunkStart < dataEnd; chunkStart += FILECHUNKBUFSIZE){
+                size_t chunkSize = static_cast<size_t>(std::min(static_cast<off_t>(FILECHUNKBUFSIZE), dataEnd - chunkStart));
+                if(!dfs_pread_fully(fd, fileChunk.data(), chunkSize, chunkStart)){
+                    dfs_log(LL_ERROR) << "ClientSide | Bytes could not be read. Canceling Request";
+                    close(fd);
+                    clientContext.TryCancel();
+                    cwriter->Finish();
+                    return StatusCode::CANCELLED;
+                }
+                FileUploadRequest.set_chunkoffset(chunkStart);
+                FileUploadRequest.set_filechunksize(chunkSize);
+                FileUploadRequest.set_filechunk(fileChunk.data(), chunkSize);
+                bytesRead += chunkSize;
+                dfs_log(LL_SYSINFO) << "ClientSide | Bytes uploaded to Server: " << chunkStart + static_cast<off_t>(chunkSize) << "/" << fileSize;
+                cwriter->Write(FileUploadRequest);
+                sentAny = true;
+            }
+            position = dataEnd;
+        }
+        close(fd);
+        //A file that is all hole is sent as one empty chunk, the server sets the size
+        if(!sentAny){
+            FileUploadRequest.set_chunkoffset(0);
+            FileUploadRequest.set_filechunksize(0);
+            FileUploadRequest.clear_filechunk();
+            cwriter->Write(FileUploadRequest);
+        }
+    }
+    while(!sparse && !file.eof()){
         if(bytesRead >= fileSize){
             dfs_log(LL_SYSINFO) << "ClientSide | Bytes should be full sent to Server: " << bytesRead << "/" << fileSize;
             break;
         }
-        if(bytesRead + fileChunk.size() > fileSize){
+        if(bytesRead + static_cast<off_t>(fileChunk.size()) > fileSize){
             file.read(fileChunk.data(), fileSize-bytesRead);
             FileUploadRequest.set_filechunksize(file.gcount());
             FileUploadRequest.set_filechunk(fileChunk.data(), file.gcount());
@@ -176,6 +240,9 @@ grpc::StatusCode DFSClientNodeP2::Store(const std::string &filename) {
     }
     cwriter->WritesDone();
     Status fileUploadStatus = cwriter->Finish();
+    lane.Report(fileUploadStatus);
+    sendSpan.SetArg("bytes", bytesRead);
+    sendSpan.End();
     dfs_log(LL_SYSINFO) << "ClientSide | File upload stream completed for " << filename;
     
     //Close file no longer needed
@@ -225,9 +292,14 @@ grpc::StatusCode DFSClientNodeP2::Fetch(const std::string &filename) {
     //Adding info of request
     dfs_log(LL_SYSINFO) << "ClientSide Fetch | Requesting to fetch file: " << filename;
 
+    //Trace id shared with the server side of this fetch
+    DFSTraceScope traceScope;
+    DFSTraceSpan fetchSpan("Fetch", "client", filename);
+
     //Adding deadline exceeded timer
     ClientContext clientContext;
     clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));  
+    DFSTracer::Inject(&clientContext);
     
     //Creating filePath string
     const std::string& filePath = WrapPath(filename);
@@ -255,22 +327,36 @@ grpc::StatusCode DFSClientNodeP2::Fetch(const std::string &filename) {
     fRequestMsg.set_filename(filename);
     if(FileInClient){
         fRequestMsg.set_clienthasfile(true);
+        DFSTraceSpan checksumSpan("Fetch.checksum", "client", filename);
         fRequestMsg.set_cfilechecksum(dfs_file_checksum(filePath, &crc_table));
+        checksumSpan.End();
         fRequestMsg.mutable_cfilemtime()->set_seconds(fileStat.st_mtim.tv_sec);
     }
     else{
         fRequestMsg.set_clienthasfile(false);
     }
+    fRequestMsg.set_acceptsextents(true);
+
+    //With striping on, the first request is for the first stripe and the
+    //reply's file size tells if more stripes are needed
+    bool ranged = this->stripe_size > 0;
+    if(ranged){
+        fRequestMsg.set_offset(0);
+        fRequestMsg.set_length(this->stripe_size);
+    }
 
     dfs_service::FetchResponse fResponseMsg;
-    std::unique_ptr<ClientReader<dfs_service::FetchResponse>> creader (service_stub->fileFetcher(&clientContext, fRequestMsg));
+    DFSTraceSpan receiveSpan("Fetch.receive", "client", filename);
+    //The size is not known until the reply, so the fetch goes to a bulk lane
+    DFSLaneLease lane = TransferLane(UINT64_MAX);
+    std::unique_ptr<ClientReader<dfs_service::FetchResponse>> creader (lane->fileFetcher(&clientContext, fRequestMsg));
 
     //Create file to be written into with the creader info
 
     //First read incase the file is zero don't erase local copy
     creader->Read(&fResponseMsg);
-    size_t bytesRead = 0;
-    size_t fileSize = fResponseMsg.filesize();
+    off_t bytesRead = 0;
+    off_t fileSize = static_cast<off_t>(fResponseMsg.filesize());
     
     /*
     if(fileSize <= 0){
@@ -278,31 +364,92 @@ grpc::StatusCode DFSClientNodeP2::Fetch(const std::string &filename) {
         return StatusCode::CANCELLED;
     }
     */
+    //A server from before ranged fetches ignores the range and sends the
+    //whole file with no version or extents, so it is received as one stream
+    if(ranged && fResponseMsg.copyfile() && fResponseMsg.versionns() == 0 && !fResponseMsg.extents()){
+        dfs_log(LL_SYSINFO) << "ClientSide Fetch | Server does not send ranges, receiving the whole file: " << filename;
+        ranged = false;
+    }
+
+    //Received whole into here, and moved over the local copy once the call succeeded
+    std::string receivedPath;
+
     //Checks if we should copy the file over or not
     if(fResponseMsg.copyfile()){        
         dfs_log(LL_SYSINFO) << "ClientSide Fetch | Beginning to grab the data of file: " << filename;
-        //Opening the file to write to
-        std::ofstream file;
-        file.open(filePath, std::ios::out | std::ios::trunc);
-
-        const std::string chunkContents = fResponseMsg.content();
-        file << chunkContents;
-        bytesRead += fResponseMsg.content().length();
-        dfs_log(LL_SYSINFO) << "ClientSide | Bytes Download from Server: " << bytesRead << "/" << fileSize;
-
-        while(creader->Read(&fResponseMsg)){
-            if(fileSize  <= 0){
-                fileSize = fResponseMsg.filesize();
+        //Larger files are fetched stripe by stripe into a temporary file
+        if(ranged && fileSize > static_cast<off_t>(this->stripe_size)){
+            bool striped = FetchStriped(filename, creader.get(), &fResponseMsg, fileSize);
+            bytesRead = striped ? fileSize : 0;
+            if(!striped){
+                clientContext.TryCancel();
+                creader->Finish();
+                return StatusCode::CANCELLED;
             }
-            const std::string chunkContents = fResponseMsg.content();
-            file << chunkContents;
-            bytesRead += fResponseMsg.content().length();
-            dfs_log(LL_SYSINFO) << "ClientSide | Bytes Download from Server: " << bytesRead << "/" << fileSize;
         }
-        file.close();
+        else{
+            //The file is received next to the local copy, which it only replaces once complete
+            const std::string partPath = WrapPath(DFS_RESERVED_PREFIX + filename + DFS_PART_SUFFIX);
+            int fd = open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if(fd < 0){
+                dfs_log(LL_ERROR) << "ClientSide Fetch | Unable to open file: " << partPath << " " << strerror(errno);
+                clientContext.TryCancel();
+                creader->Finish();
+                return StatusCode::CANCELLED;
+            }
+
+            //fResponseMsg is reused, so each Read parses into the content buffer
+            //left by the previous chunk and the bytes go straight to the file
+            bool writeFailed = false;
+            bool extents = fResponseMsg.extents();
+            if(ranged){
+                //The whole file fit in the first stripe
+                writeFailed = !ReceiveStripe(creader.get(), &fResponseMsg, fd, 0, fileSize, fResponseMsg.versionns());
+                bytesRead = writeFailed ? 0 : fileSize;
+            }
+            else{
+                //With extents each chunk says where it goes and the gaps are left as holes
+                do{
+                    if(fileSize  <= 0){
+                        fileSize = static_cast<off_t>(fResponseMsg.filesize());
+                    }
+                    if(extents){
+                        bytesRead = static_cast<off_t>(fResponseMsg.contentoffset());
+                    }
+                    writeFailed = !dfs_pwrite_fully(fd, fResponseMsg.content().data(), fResponseMsg.content().length(), bytesRead);
+                    bytesRead += fResponseMsg.content().length();
+                    dfs_log(LL_SYSINFO) << "ClientSide | Bytes Download from Server: " << bytesRead << "/" << fileSize;
+                } while(!writeFailed && creader->Read(&fResponseMsg));
+            }
+            //A trailing hole only shows in the file size
+            if(!writeFailed && extents && ftruncate(fd, fileSize) != 0){
+                writeFailed = true;
+            }
+            writeFailed = close(fd) != 0 || writeFailed;
+            if(writeFailed){
+                dfs_log(LL_ERROR) << "ClientSide Fetch | Writing failed for file: " << filePath << " " << strerror(errno);
+                unlink(partPath.c_str());
+                clientContext.TryCancel();
+                creader->Finish();
+                return StatusCode::CANCELLED;
+            }
+            receivedPath = partPath;
+        }
     }
     Status StatusMsg = creader->Finish();
-    //Comment
+    lane.Report(StatusMsg);
+    if(!receivedPath.empty()){
+        if(!StatusMsg.ok()){
+            unlink(receivedPath.c_str());
+        }
+        else if(rename(receivedPath.c_str(), filePath.c_str()) != 0){
+            dfs_log(LL_ERROR) << "ClientSide Fetch | Unable to move " << receivedPath << " into place: " << strerror(errno);
+            unlink(receivedPath.c_str());
+            return StatusCode::CANCELLED;
+        }
+    }
+    receiveSpan.SetArg("bytes", bytesRead);
+    receiveSpan.End();
 
     //Log the StatusCode is it's an error
     if(!StatusMsg.ok()){
@@ -333,6 +480,349 @@ grpc::StatusCode DFSClientNodeP2::Fetch(const std::string &filename) {
     return StatusCode::OK;
 }
 
+void DFSClientNodeP2::SetStriping(size_t stripe_size, int stripe_streams) {
+    this->stripe_size = stripe_size;
+    this->stripe_streams = stripe_streams > 0 ? stripe_streams : 1;
+}
+
+void DFSClientNodeP2::SetBundling(size_t bundle_threshold) {
+    this->bundle_threshold = bundle_threshold;
+}
+
+grpc::StatusCode DFSClientNodeP2::StoreBundle(const std::vector<std::string>& filenames, std::map<std::string, StatusCode>* statuses) {
+    StatusCode result = StatusCode::OK;
+    for(size_t first = 0; first < filenames.size(); first += DFS_BUNDLE_MAX_FILES){
+        size_t last = std::min(filenames.size(), first + DFS_BUNDLE_MAX_FILES);
+
+        //Trace id shared with the server side of this bundle
+        DFSTraceScope traceScope;
+        DFSTraceSpan storeSpan("BundleStore", "client", "");
+
+        //Stat the files first so the bundle can pick a lane by its size
+        std::vector<std::pair<std::string, struct stat>> files;
+        uint64_t bundleBytes = 0;
+        for(size_t index = first; index < last; index++){
+            struct stat fileStat;
+            //Empty files are skipped like Store does
+            if(stat(WrapPath(filenames[index]).c_str(), &fileStat) != 0 || fileStat.st_size < 1){
+                (*statuses)[filenames[index]] = StatusCode::NOT_FOUND;
+                continue;
+            }
+            files.emplace_back(filenames[index], fileStat);
+            bundleBytes += static_cast<uint64_t>(fileStat.st_size);
+        }
+        if(files.empty()){
+            continue;
+        }
+
+        ClientContext clientContext;
+        clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));
+        DFSTracer::Inject(&clientContext);
+
+        dfs_service::BundleStatusResponse response;
+        DFSLaneLease lane = TransferLane(bundleBytes);
+        std::unique_ptr<ClientWriter<dfs_service::BundleStoreRequest>> cwriter (lane->fileBundleStore(&clientContext, &response));
+
+        //Records are packed into messages of about DFS_BUNDLE_MESSAGE_BYTES
+        dfs_service::BundleStoreRequest request;
+        request.set_clientid(ClientId());
+        size_t messageBytes = 0;
+        bool writeFailed = false;
+        for(const std::pair<std::string, struct stat>& file : files){
+            const std::string& filePath = WrapPath(file.first);
+            size_t fileSize = static_cast<size_t>(file.second.st_size);
+            int fd = open(filePath.c_str(), O_RDONLY);
+            if(fd < 0){
+                (*statuses)[file.first] = StatusCode::NOT_FOUND;
+                continue;
+            }
+            dfs_service::BundleRecord* record = request.add_record();
+            std::string* content = record->mutable_content();
+            content->resize(fileSize);
+            bool readFailed = !dfs_pread_fully(fd, &(*content)[0], fileSize, 0);
+            close(fd);
+            if(readFailed){
+                dfs_log(LL_ERROR) << "ClientSide | Bytes could not be read for bundled file: " << file.first;
+                request.mutable_record()->RemoveLast();
+                (*statuses)[file.first] = StatusCode::CANCELLED;
+                continue;
+            }
+            record->set_filename(file.first);
+            record->set_filesize(fileSize);
+            record->mutable_mtime()->set_seconds(file.second.st_mtim.tv_sec);
+            record->set_filechecksum(dfs_file_checksum(filePath, &crc_table));
+            messageBytes += fileSize;
+            if(messageBytes >= DFS_BUNDLE_MESSAGE_BYTES){
+                if(!cwriter->Write(request)){
+                    writeFailed = true;
+                    break;
+                }
+                request.clear_record();
+                messageBytes = 0;
+            }
+        }
+        //The last message is sent even when empty, it may be the one carrying the client id
+        if(!writeFailed){
+            cwriter->Write(request);
+        }
+        cwriter->WritesDone();
+        Status StatusMsg = cwriter->Finish();
+        lane.Report(StatusMsg);
+        storeSpan.SetArg("files", static_cast<int64_t>(files.size()));
+        storeSpan.SetArg("bytes", static_cast<int64_t>(bundleBytes));
+
+        for(const dfs_service::BundleFileStatus& status : response.status()){
+            (*statuses)[status.filename()] = static_cast<StatusCode>(status.code());
+        }
+        //Files the server never answered for share the RPC's error
+        if(!StatusMsg.ok()){
+            dfs_log(LL_ERROR) << "ClientSide | Bundle store of " << files.size() << " files failed. Error Message: " << StatusMsg.error_message();
+            result = StatusMsg.error_code();
+            for(const std::pair<std::string, struct stat>& file : files){
+                statuses->emplace(file.first, result);
+            }
+        }
+        dfs_log(LL_SYSINFO) << "ClientSide | Stored a bundle of " << files.size() << " files";
+    }
+    return result;
+}
+
+grpc::StatusCode DFSClientNodeP2::FetchBundle(const std::vector<std::string>& filenames, std::map<std::string, StatusCode>* statuses) {
+    StatusCode result = StatusCode::OK;
+    for(size_t first = 0; first < filenames.size(); first += DFS_BUNDLE_MAX_FILES){
+        size_t last = std::min(filenames.size(), first + DFS_BUNDLE_MAX_FILES);
+
+        //Trace id shared with the server side of this bundle
+        DFSTraceScope traceScope;
+        DFSTraceSpan fetchSpan("BundleFetch", "client", "");
+
+        //Each file is described the same way a single fetch describes it
+        dfs_service::BundleFetchRequest request;
+        for(size_t index = first; index < last; index++){
+            const std::string& filePath = WrapPath(filenames[index]);
+            dfs_service::FetchRequest* file = request.add_file();
+            file->set_filename(filenames[index]);
+            struct stat fileStat;
+            if(stat(filePath.c_str(), &fileStat) == 0){
+                file->set_clienthasfile(true);
+                file->set_cfilechecksum(dfs_file_checksum(filePath, &crc_table));
+                file->mutable_cfilemtime()->set_seconds(fileStat.st_mtim.tv_sec);
+            }
+        }
+
+        ClientContext clientContext;
+        clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));
+        DFSTracer::Inject(&clientContext);
+
+        //The sizes are not known until the reply, so the bundle goes to a bulk lane
+        DFSLaneLease lane = TransferLane(UINT64_MAX);
+        std::unique_ptr<ClientReader<dfs_service::BundleFetchResponse>> creader (lane->fileBundleFetch(&clientContext, request));
+
+        dfs_service::BundleFetchResponse response;
+        std::mutex status_mutex;
+        uint64_t files = 0;
+        uint64_t bytesRead = 0;
+        {
+            //Records are written by the workers while the next message is received
+            DFSBundleWorkers workers;
+            while(creader->Read(&response)){
+                for(dfs_service::BundleRecord& record : *response.mutable_record()){
+                    std::shared_ptr<dfs_service::BundleRecord> owned = std::make_shared<dfs_service::BundleRecord>(std::move(record));
+                    files++;
+                    bytesRead += owned->content().length();
+                    workers.Submit([this, owned, statuses, &status_mutex]{
+                        const std::string& content = owned->content();
+                        bool writeFailed = content.length() != owned->filesize() ||
+                                           !dfs_write_file(WrapPath(owned->filename()), content.data(), content.length());
+                        if(writeFailed){
+                            dfs_log(LL_ERROR) << "ClientSide Fetch | Writing failed for bundled file: " << owned->filename() << " " << strerror(errno);
+                        }
+                        std::lock_guard<std::mutex> lock(status_mutex);
+                        (*statuses)[owned->filename()] = writeFailed ? StatusCode::CANCELLED : StatusCode::OK;
+                    });
+                }
+                std::lock_guard<std::mutex> lock(status_mutex);
+                for(const dfs_service::BundleFileStatus& status : response.status()){
+                    (*statuses)[status.filename()] = static_cast<StatusCode>(status.code());
+                }
+            }
+        }
+        Status StatusMsg = creader->Finish();
+        lane.Report(StatusMsg);
+        fetchSpan.SetArg("files", files);
+        fetchSpan.SetArg("bytes", bytesRead);
+
+        //Files the server never answered for share the RPC's error
+        if(!StatusMsg.ok()){
+            dfs_log(LL_ERROR) << "ClientSide | Bundle fetch of " << last - first << " files failed. Error Message: " << StatusMsg.error_message();
+            result = StatusMsg.error_code();
+            for(size_t index = first; index < last; index++){
+                statuses->emplace(filenames[index], result);
+            }
+        }
+        dfs_log(LL_SYSINFO) << "ClientSide | Fetched a bundle of " << files << " files";
+    }
+    return result;
+}
+
+void DFSClientNodeP2::SyncBundles(const std::vector<std::string>& stores, const std::vector<std::string>& fetches) {
+    std::map<std::string, StatusCode> statuses;
+    if(!stores.empty() && StoreBundle(stores, &statuses) == StatusCode::UNIMPLEMENTED){
+        //A server without bundle RPCs gets every file on its own from now on
+        dfs_log(LL_ERROR) << "ClientSide | Server does not take bundles, bundling turned off";
+        this->bundle_threshold = 0;
+    }
+    for(const std::string& fileName : stores){
+        if(statuses[fileName] == StatusCode::UNIMPLEMENTED){
+            Store(fileName);
+        }
+    }
+
+    statuses.clear();
+    if(!fetches.empty() && FetchBundle(fetches, &statuses) == StatusCode::UNIMPLEMENTED){
+        dfs_log(LL_ERROR) << "ClientSide | Server does not take bundles, bundling turned off";
+        this->bundle_threshold = 0;
+    }
+    for(const std::string& fileName : fetches){
+        StatusCode code = statuses[fileName];
+        //Files that grew past what the server bundles are fetched on their own
+        if(code == StatusCode::OUT_OF_RANGE || code == StatusCode::UNIMPLEMENTED){
+            Fetch(fileName);
+        }
+    }
+}
+
+bool DFSClientNodeP2::ReceiveStripe(ClientReader<dfs_service::FetchResponse>* creader, dfs_service::FetchResponse* fResponseMsg,
+                                    int fd, off_t offset, off_t length, int64_t version) {
+    off_t received = 0;
+    uint32_t checksum = 0;
+    //Holes the server skipped are checksummed as zeros and freed from the preallocated file
+    auto skipHole = [&](off_t position) {
+        if(position > received){
+            checksum = dfs_crc32_zeros(checksum, static_cast<uint64_t>(position - received));
+            dfs_punch_hole(fd, offset + received, position - received);
+            received = position;
+        }
+    };
+    do {
+        //Every stripe has to come from the same version of the file
+        if(fResponseMsg->versionns() != version){
+            dfs_log(LL_ERROR) << "ClientSide Fetch | File changed on the server during a striped fetch";
+            return false;
+        }
+        const std::string& content = fResponseMsg->content();
+        if(fResponseMsg->extents() && !content.empty()){
+            off_t position = static_cast<off_t>(fResponseMsg->contentoffset()) - offset;
+            if(position < received){
+                dfs_log(LL_ERROR) << "ClientSide Fetch | Stripe at " << offset << " went back to " << fResponseMsg->contentoffset();
+                return false;
+            }
+            skipHole(position);
+        }
+        if(!content.empty()){
+            if(received + static_cast<off_t>(content.length()) > length ||
+               !dfs_pwrite_fully(fd, content.data(), content.length(), offset + received)){
+                return false;
+            }
+            checksum = dfs_crc32_slice8(content.data(), content.length(), checksum);
+            received += content.length();
+            dfs_log(LL_SYSINFO) << "ClientSide | Bytes Download from Server: " << offset + received << " (stripe at " << offset << ")";
+        }
+        if(fResponseMsg->stripeend()){
+            if(fResponseMsg->extents()){
+                skipHole(length);
+            }
+            if(received != length || fResponseMsg->stripechecksum() != checksum){
+                dfs_log(LL_ERROR) << "ClientSide Fetch | Stripe at " << offset << " failed verification: " << received << "/" << length << " bytes";
+                return false;
+            }
+            return true;
+        }
+    } while(creader->Read(fResponseMsg));
+    return false;
+}
+
+bool DFSClientNodeP2::FetchStriped(const std::string& filename, ClientReader<dfs_service::FetchResponse>* firstReader,
+                                   dfs_service::FetchResponse* firstResponse, off_t fileSize) {
+    const std::string filePath = WrapPath(filename);
+    const std::string partPath = WrapPath(DFS_RESERVED_PREFIX + filename + DFS_PART_SUFFIX);
+    int64_t version = firstResponse->versionns();
+    int stripes = static_cast<int>((fileSize + this->stripe_size - 1) / this->stripe_size);
+    dfs_log(LL_SYSINFO) << "ClientSide Fetch | Fetching " << filename << " as " << stripes << " stripes";
+
+    //Stripes land out of order, so the whole file is allocated up front
+    int fd = open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0){
+        dfs_log(LL_ERROR) << "ClientSide Fetch | Unable to open file: " << partPath << " " << strerror(errno);
+        return false;
+    }
+    if(posix_fallocate(fd, 0, fileSize) != 0 && ftruncate(fd, fileSize) != 0){
+        dfs_log(LL_ERROR) << "ClientSide Fetch | Unable to allocate file: " << partPath << " " << strerror(errno);
+        close(fd);
+        unlink(partPath.c_str());
+        return false;
+    }
+
+    //Stripes after the first are shared out to the other streams
+    std::atomic<int> nextStripe{1};
+    std::atomic<bool> failed{false};
+    auto fetchStripes = [&]() {
+        int stripe;
+        while(!failed && (stripe = nextStripe.fetch_add(1)) < stripes){
+            off_t offset = static_cast<off_t>(stripe) * this->stripe_size;
+            off_t length = std::min(static_cast<off_t>(this->stripe_size), fileSize - offset);
+            DFSLaneLease lane = TransferLane(static_cast<uint64_t>(length));
+
+            ClientContext stripeContext;
+            stripeContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));
+            DFSTracer::Inject(&stripeContext);
+            dfs_service::FetchRequest stripeRequest;
+            stripeRequest.set_filename(filename);
+            stripeRequest.set_clienthasfile(false);
+            stripeRequest.set_offset(offset);
+            stripeRequest.set_length(length);
+            stripeRequest.set_acceptsextents(true);
+            dfs_service::FetchResponse stripeResponse;
+            std::unique_ptr<ClientReader<dfs_service::FetchResponse>> stripeReader(lane->fileFetcher(&stripeContext, stripeRequest));
+            bool received = stripeReader->Read(&stripeResponse) &&
+                            ReceiveStripe(stripeReader.get(), &stripeResponse, fd, offset, length, version);
+            if(!received){
+                stripeContext.TryCancel();
+            }
+            Status stripeStatus = stripeReader->Finish();
+            lane.Report(stripeStatus);
+            if(!stripeStatus.ok() || !received){
+                failed = true;
+            }
+        }
+    };
+    std::vector<std::thread> streams;
+    for(int stream = 0; stream < std::min(this->stripe_streams, stripes - 1); stream++){
+        streams.emplace_back(fetchStripes);
+    }
+
+    //The first stripe is already streaming on the original request
+    if(!ReceiveStripe(firstReader, firstResponse, fd, 0, static_cast<off_t>(this->stripe_size), version)){
+        failed = true;
+    }
+    for(std::thread& stream : streams){
+        stream.join();
+    }
+
+    //Only a complete, verified file replaces the local copy
+    if(close(fd) != 0 || failed){
+        dfs_log(LL_ERROR) << "ClientSide Fetch | Striped fetch failed for file: " << filename;
+        unlink(partPath.c_str());
+        return false;
+    }
+    if(rename(partPath.c_str(), filePath.c_str()) != 0){
+        dfs_log(LL_ERROR) << "ClientSide Fetch | Unable to move " << partPath << " into place: " << strerror(errno);
+        unlink(partPath.c_str());
+        return false;
+    }
+    return true;
+}
+
 grpc::StatusCode DFSClientNodeP2::Delete(const std::string &filename) {
 
     //////////////////////////////////////////////////////////////
@@ -342,9 +832,14 @@ grpc::StatusCode DFSClientNodeP2::Delete(const std::string &filename) {
     //Adding info of request
     dfs_log(LL_SYSINFO) << "ClientSide | Requesting to delete file: " << filename;
 
+    //Trace id shared by the lock and delete RPCs
+    DFSTraceScope traceScope;
+    DFSTraceSpan deleteSpan("Delete", "client", filename);
+
     //Adding deadline exceeded timer
     ClientContext clientContext;
     clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));  
+    DFSTracer::Inject(&clientContext);
     
     //////////////////////////////////////////////////////////////
     //Request Server for writer lock if check sums are different//
@@ -395,6 +890,75 @@ grpc::StatusCode DFSClientNodeP2::Delete(const std::string &filename) {
 
 grpc::StatusCode DFSClientNodeP2::List(std::map<std::string,int>* file_map, bool display) {
 
+    //Logging begining to request
+    dfs_log(LL_SYSINFO) << "ClientSide | Requesting to a stream of the list of files on server";
+
+    //Each page is applied as it arrives, so only one is held. A stream that
+    //breaks after some pages is opened again from the last cursor.
+    uint64_t cursor = 0;
+    uint64_t pages = 0;
+    int retries = 0;
+    while(true){
+        ClientContext clientContext;
+        clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));
+        dfs_service::ListStreamRequest request;
+        request.set_cursor(cursor);
+        request.set_pagesize(DFS_LIST_PAGE);
+
+        std::unique_ptr<ClientReader<dfs_service::ListPage>> creader(service_stub->fileListStream(&clientContext, request));
+        dfs_service::ListPage page;
+        bool last = false;
+        bool progressed = false;
+        while(!last && creader->Read(&page)){
+            bool decoded = dfs_compact_listing_each(page.compact(), [&](int row, const std::string& fileName, int64_t fileSize,
+                                                                         int64_t mtimeNs, uint32_t checksum) {
+                int mTime = static_cast<int>(mtimeNs / 1000000000LL);
+                dfs_log(LL_SYSINFO) << "ClientSide | Client has recieved file: " << fileName << " and timestamp:" << mTime;
+                if(file_map != NULL){
+                    file_map->insert({fileName,mTime});
+                }
+            });
+            if(!decoded){
+                dfs_log(LL_ERROR) << "ClientSide | List page from the server is malformed";
+                clientContext.TryCancel();
+                creader->Finish();
+                return StatusCode::INTERNAL;
+            }
+            cursor = page.cursor();
+            last = page.last();
+            progressed = true;
+            pages++;
+        }
+        Status msgStatus = creader->Finish();
+        if(last){
+            dfs_log(LL_SYSINFO) << "ClientSide | Received the list of files in " << pages << " pages";
+            return StatusCode::OK;
+        }
+
+        //A server without the stream sends the whole list in one message
+        if(msgStatus.error_code() == StatusCode::UNIMPLEMENTED && pages == 0){
+            return ListWhole(file_map);
+        }
+        retries = progressed ? 0 : retries + 1;
+        if((msgStatus.error_code() == StatusCode::DEADLINE_EXCEEDED || msgStatus.error_code() == StatusCode::UNAVAILABLE) &&
+           pages > 0 && retries < 3){
+            dfs_log(LL_ERROR) << "ClientSide | List stream broke after " << pages << " pages, resuming. Error Message: " << msgStatus.error_message();
+            continue;
+        }
+        if(msgStatus.ok()){
+            dfs_log(LL_ERROR) << "ClientSide | List stream ended without its last page";
+            return StatusCode::CANCELLED;
+        }
+        dfs_log(LL_ERROR) << "ClientSide | Could not stream the list of files. Error Message: " << msgStatus.error_message();
+        if(msgStatus.error_code() == StatusCode::DEADLINE_EXCEEDED || msgStatus.error_code() == StatusCode::NOT_FOUND){
+            return msgStatus.error_code();
+        }
+        return StatusCode::CANCELLED;
+    }
+}
+
+grpc::StatusCode DFSClientNodeP2::ListWhole(std::map<std::string,int>* file_map) {
+
     //Logging begining to request
     dfs_log(LL_SYSINFO) << "ClientSide | Requesting to a list of files on server";
 
@@ -404,7 +968,8 @@ grpc::StatusCode DFSClientNodeP2::List(std::map<std::string,int>* file_map, bool
     
     //Create Msg Variables (Structures)
     dfs_service::ListResponse filesList;
-    const ::google::protobuf::Empty request;
+    dfs_service::ListRequest request;
+    request.set_compact(this->compact_listings);
 
     //Create Request
     Status msgStatus = service_stub->fileLister(&clientContext, request, &filesList);
@@ -431,11 +996,25 @@ grpc::StatusCode DFSClientNodeP2::List(std::map<std::string,int>* file_map, bool
     
     //Reading the repeated messages
     dfs_log(LL_SYSINFO) << "ClientSide | Client is reading message of list of files and time stamps now";
-    for(dfs_service::ListElementResponse& Element : *filesList.mutable_file()){
-        std::string fileName = Element.filename();
-        int mTime = Element.mtime().seconds();
+    auto addFile = [&](const std::string& fileName, int mTime) {
         dfs_log(LL_SYSINFO) << "ClientSide | Client has recieved file: " << fileName << " and timestamp:" << mTime;
-        file_map->insert({fileName,mTime});
+        if(file_map != NULL){
+            file_map->insert({fileName,mTime});
+        }
+    };
+    //A server that predates compact listings answers in file
+    if(filesList.has_compact()){
+        bool decoded = dfs_compact_listing_each(filesList.compact(), [&](int row, const std::string& fileName, int64_t fileSize,
+                                                                         int64_t mtimeNs, uint32_t checksum) {
+            addFile(fileName, static_cast<int>(mtimeNs / 1000000000LL));
+        });
+        if(!decoded){
+            dfs_log(LL_ERROR) << "ClientSide | Compact listing from the server is malformed";
+            return StatusCode::INTERNAL;
+        }
+    }
+    for(dfs_service::ListElementResponse& Element : *filesList.mutable_file()){
+        addFile(Element.filename(), Element.mtime().seconds());
     }
 
     return StatusCode::OK;
@@ -486,6 +1065,204 @@ grpc::StatusCode DFSClientNodeP2::Stat(const std::string &filename, void* file_s
     return StatusCode::OK;
 }
 
+grpc::StatusCode DFSClientNodeP2::Metrics(const std::string &prefix, dfs_service::MetricsResponse* metrics, bool display) {
+
+    //Logging begining to request
+    dfs_log(LL_SYSINFO) << "ClientSide | Requesting server metrics with prefix: " << prefix;
+
+    //Adding deadline exceeded timer
+    ClientContext clientContext;
+    clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));
+
+    //Create Msg Variables (Structures)
+    dfs_service::MetricsRequest mRequestMsg;
+    dfs_service::MetricsResponse mResponseMsg;
+    mRequestMsg.set_prefix(prefix);
+
+    //Create Request
+    Status msgStatus = service_stub->GetMetrics(&clientContext, mRequestMsg, &mResponseMsg);
+    if(!msgStatus.ok()){
+        dfs_log(LL_ERROR) << "ClientSide | Could not get server metrics. Error Message: " << msgStatus.error_message();
+        if(msgStatus.error_code() == StatusCode::DEADLINE_EXCEEDED){
+            return StatusCode::DEADLINE_EXCEEDED;
+        }
+        return StatusCode::CANCELLED;
+    }
+
+    //Print one line per metric
+    if(display){
+        for(const dfs_service::MetricValue& metric : mResponseMsg.metric()){
+            std::cout << metric.name() << "{" << metric.labels() << "}";
+            if(metric.type() == "histogram"){
+                std::cout << " count=" << metric.count() << " p50=" << metric.p50() << " p90=" << metric.p90()
+                          << " p99=" << metric.p99() << " p999=" << metric.p999() << " max=" << metric.max() << std::endl;
+            }
+            else{
+                std::cout << " " << metric.value() << std::endl;
+            }
+        }
+    }
+
+    if(metrics != NULL){
+        metrics->Swap(&mResponseMsg);
+    }
+
+    return StatusCode::OK;
+}
+
+void DFSClientNodeP2::BuildTree(DFSMerkleTree* tree) {
+    dfs_scan_files(mount_path, [&](const std::string& fileName, const struct stat& fileStat) {
+        std::string filePath = WrapPath(fileName);
+        uint32_t checksum = checksums.Checksum(fileName, filePath, fileStat,
+                                               [&] { return dfs_file_checksum(filePath, &crc_table); });
+        tree->Add({fileName, static_cast<int64_t>(fileStat.st_size), checksum, static_cast<int64_t>(fileStat.st_mtim.tv_sec)});
+    });
+    tree->Seal();
+}
+
+grpc::StatusCode DFSClientNodeP2::Reconcile(std::vector<DFSSyncDifference>* differences) {
+
+    DFSMerkleTree tree;
+    BuildTree(&tree);
+    dfs_log(LL_SYSINFO) << "ClientSide | Reconciling " << tree.Size() << " files with the server";
+
+    for(int attempt = 0; ; attempt++){
+        differences->clear();
+        std::vector<std::string> frontier{""};
+        uint64_t generation = 0;
+        bool moved = false;
+        int calls = 0;
+        size_t bytes = 0;
+
+        while(!frontier.empty()){
+            std::vector<std::string> next;
+            for(size_t first = 0; first < frontier.size(); first += DFS_MERKLE_MAX_NODES){
+                ClientContext clientContext;
+                clientContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(this->deadline_timeout));
+                dfs_service::TreeNodesRequest tRequestMsg;
+                dfs_service::TreeNodesResponse tResponseMsg;
+                size_t last = std::min(frontier.size(), first + DFS_MERKLE_MAX_NODES);
+                for(size_t i = first; i < last; i++){
+                    tRequestMsg.add_path(frontier[i]);
+                }
+
+                Status msgStatus = service_stub->GetTreeNodes(&clientContext, tRequestMsg, &tResponseMsg);
+                if(!msgStatus.ok()){
+                    dfs_log(LL_ERROR) << "ClientSide | Could not get tree nodes. Error Message: " << msgStatus.error_message();
+                    return msgStatus.error_code();
+                }
+                calls++;
+                bytes += tRequestMsg.ByteSizeLong() + tResponseMsg.ByteSizeLong();
+                if(calls == 1){
+                    generation = tResponseMsg.generation();
+                }
+                moved = moved || tResponseMsg.generation() != generation;
+
+                for(const dfs_service::TreeNode& node : tResponseMsg.node()){
+                    uint64_t hash, fileCount;
+                    if(!tree.Node(node.path(), &hash, &fileCount) || hash == node.hash()){
+                        continue;
+                    }
+                    //Descend into the children that differ
+                    uint64_t children[DFS_MERKLE_FANOUT];
+                    if(node.child_size() == DFS_MERKLE_FANOUT && tree.Children(node.path(), children)){
+                        for(int digit = 0; digit < DFS_MERKLE_FANOUT; digit++){
+                            if(children[digit] != node.child(digit)){
+                                next.push_back(DFSMerkleTree::ChildPath(node.path(), digit));
+                            }
+                        }
+                        continue;
+                    }
+                    //Or compare the files the server sent for the node
+                    std::map<std::string, DFSSyncDifference> files;
+                    const DFSMerkleEntry* begin;
+                    const DFSMerkleEntry* end;
+                    tree.Files(node.path(), &begin, &end);
+                    for(const DFSMerkleEntry* entry = begin; entry != end; entry++){
+                        DFSSyncDifference& difference = files[entry->name];
+                        difference.onClient = true;
+                        difference.client = *entry;
+                    }
+                    for(const dfs_service::TreeFile& file : node.file()){
+                        DFSSyncDifference& difference = files[file.filename()];
+                        difference.onServer = true;
+                        difference.server = {file.filename(), file.filesize(), file.filechecksum(), file.mtime().seconds()};
+                    }
+                    for(auto& file : files){
+                        DFSSyncDifference& difference = file.second;
+                        if(difference.onClient && difference.onServer && difference.client.size == difference.server.size &&
+                           difference.client.checksum == difference.server.checksum){
+                            continue;
+                        }
+                        difference.name = file.first;
+                        differences->push_back(std::move(difference));
+                    }
+                }
+            }
+            frontier.swap(next);
+        }
+
+        //Nodes from two listings may not add up, so start over while the server keeps changing
+        if(moved && attempt < DFS_MERKLE_RETRIES){
+            dfs_log(LL_SYSINFO) << "ClientSide | Server files changed during reconcile, starting over";
+            continue;
+        }
+        std::sort(differences->begin(), differences->end(),
+                  [](const DFSSyncDifference& a, const DFSSyncDifference& b) { return a.name < b.name; });
+        dfs_log(LL_SYSINFO) << "ClientSide | Reconciled in " << calls << " calls and " << bytes << " bytes, "
+                            << differences->size() << " files differ";
+        return StatusCode::OK;
+    }
+}
+
+grpc::StatusCode DFSClientNodeP2::Sync(bool display) {
+
+    std::vector<DFSSyncDifference> differences;
+    StatusCode reconciled = Reconcile(&differences);
+    if(reconciled != StatusCode::OK){
+        return reconciled;
+    }
+
+    //Small files go in bundles like in the callback list
+    std::vector<std::string> bundleStores;
+    std::vector<std::string> bundleFetches;
+    auto bundled = [this](int64_t fileSize) {
+        return this->bundle_threshold > 0 && fileSize <= static_cast<int64_t>(this->bundle_threshold);
+    };
+    for(const DFSSyncDifference& difference : differences){
+        bool store = !difference.onServer || (difference.onClient && difference.client.mtime > difference.server.mtime);
+        bool fetch = !difference.onClient || (difference.onServer && difference.client.mtime < difference.server.mtime);
+        if(store){
+            if(bundled(difference.client.size)){
+                bundleStores.push_back(difference.name);
+            }
+            else{
+                Store(difference.name);
+            }
+        }
+        else if(fetch){
+            if(bundled(difference.server.size)){
+                bundleFetches.push_back(difference.name);
+            }
+            else{
+                Fetch(difference.name);
+            }
+        }
+        else{
+            dfs_log(LL_ERROR) << "ClientSide | Checksums are different but client and server times are the same: " << difference.name;
+        }
+        if(display){
+            std::cout << (store ? "store " : (fetch ? "fetch " : "differs ")) << difference.name << std::endl;
+        }
+    }
+    SyncBundles(bundleStores, bundleFetches);
+
+    if(display){
+        std::cout << differences.size() << " files differed from the server" << std::endl;
+    }
+    return StatusCode::OK;
+}
+
 void DFSClientNodeP2::InotifyWatcherCallback(std::function<void()> callback) {
 
     //Created critical sections which only broadcast once one has completed
@@ -540,6 +1317,7 @@ void DFSClientNodeP2::HandleCallbackList() {
             dfs_log(LL_DEBUG2) << "Completion queue callback triggered";
 
             // Verify that the request was completed successfully
+            if (!ok) {
                 dfs_log(LL_ERROR) << "Completion queue callback not ok.";
             }
 
@@ -550,33 +1328,67 @@ void DFSClientNodeP2::HandleCallbackList() {
 
 
                 dfs_log(LL_SYSINFO) << "ClientSide | Going the call data from callbacklist";
-                for(const dfs_service::CBLElementResponse& Element : call_data->reply.fileinfo()){
-                    std::string fileName = Element.filename();
+                //Small files are collected and moved in bundles once the listing is compared
+                std::vector<std::string> bundleStores;
+                std::vector<std::string> bundleFetches;
+                auto bundled = [this](int64_t fileSize) {
+                    return this->bundle_threshold > 0 && fileSize <= static_cast<int64_t>(this->bundle_threshold);
+                };
+                //A file whose content came inlined in the listing is written without a fetch,
+                //as long as the content is the version the listing names
+                auto fetchFile = [&](const std::string& fileName, int64_t fileSize, uint32_t ServerFileCheckSum,
+                                     const std::string* content) {
+                    if(content != nullptr && (static_cast<int64_t>(content->length()) != fileSize ||
+                                              dfs_content_checksum(content->data(), content->length()) != ServerFileCheckSum)){
+                        dfs_log(LL_ERROR) << "ClientSide | Inlined content does not match the listing, fetching instead: " << fileName;
+                        content = nullptr;
+                    }
+                    if(content != nullptr){
+                        if(dfs_write_file(WrapPath(fileName), content->data(), content->length())){
+                            dfs_log(LL_SYSINFO) << "ClientSide | Wrote inlined file: " << fileName;
+                            return;
+                        }
+                        dfs_log(LL_ERROR) << "ClientSide | Writing inlined file failed, fetching it instead: " << fileName;
+                    }
+                    if(bundled(fileSize)){
+                        bundleFetches.push_back(fileName);
+                    }
+                    else{
+                        Fetch(fileName);
+                    }
+                };
+                auto compareFile = [&](const std::string& fileName, int64_t fileSize, time_t ServerFile_mtime,
+                                       uint32_t ServerFileCheckSum, const std::string* content) {
                     std::string filePath = WrapPath(fileName);
                     dfs_log(LL_SYSINFO) << "ClientSide | Comparing file [" << fileName << "] with server's";
                     //Check if we have the file
                     struct stat fileStat;
                     if(stat(filePath.c_str(), &fileStat) != 0){
                         dfs_log(LL_SYSINFO) << "ClientSide | Given file not found in system will be calling fetch method for file: " << fileName;
-                        Fetch(fileName);
+                        fetchFile(fileName, fileSize, ServerFileCheckSum, content);
+                        return;
                     }
 
                     //Check if the checksums are the same
-                    uint32_t ClientFileCheckSum = dfs_file_checksum(filePath, &crc_table);
-                    uint32_t ServerFileCheckSum = Element.filechecksum();
+                    uint32_t ClientFileCheckSum = checksums.Checksum(fileName, filePath, fileStat,
+                                                                     [&] { return dfs_file_checksum(filePath, &crc_table); });
                     if(ClientFileCheckSum != ServerFileCheckSum){
                         //If different checksum then compare the modified times
                         time_t ClientFile_mtime = fileStat.st_mtim.tv_sec;
-                        time_t ServerFile_mtime = Element.mtime().seconds();
                         //If Client file is newer store it
                         if(ClientFile_mtime > ServerFile_mtime){
                             dfs_log(LL_SYSINFO) << "ClientSide | File was last modified at main server calling Fetch method";
-                            Store(fileName);
+                            if(bundled(fileStat.st_size)){
+                                bundleStores.push_back(fileName);
+                            }
+                            else{
+                                Store(fileName);
+                            }
                         }
                         //If Server file is newer fetch it
                         else if(ClientFile_mtime < ServerFile_mtime){
                             dfs_log(LL_SYSINFO) << "ClientSide | File was last modified at client server calling Store method";
-                            Fetch(fileName);
+                            fetchFile(fileName, fileSize, ServerFileCheckSum, content);
                         }
                         //We should not be here
                         else{
@@ -587,7 +1399,31 @@ void DFSClientNodeP2::HandleCallbackList() {
                     else{
                         dfs_log(LL_SYSINFO) << "ClientSide | File checksum is the same on client and server. No action taken";
                     }
+                };
+                if(call_data->reply->has_compact()){
+                    //Inlined rows are listed in row order, so they are matched while walking the rows
+                    const dfs_service::CompactListing& compact = call_data->reply->compact();
+                    int inlined = 0;
+                    bool decoded = dfs_compact_listing_each(compact, [&](int row, const std::string& fileName, int64_t fileSize,
+                                                                         int64_t mtimeNs, uint32_t checksum) {
+                        const std::string* content = nullptr;
+                        if(inlined < compact.inlined_size() && inlined < compact.content_size() &&
+                           compact.inlined(inlined) == static_cast<uint32_t>(row)){
+                            content = &compact.content(inlined++);
+                        }
+                        compareFile(fileName, fileSize, static_cast<time_t>(mtimeNs / 1000000000LL), checksum, content);
+                    });
+                    if(!decoded){
+                        dfs_log(LL_ERROR) << "ClientSide | Compact listing from the server is malformed";
+                    }
+                }
+                for(const dfs_service::CBLElementResponse& Element : call_data->reply->fileinfo()){
+                    compareFile(Element.filename(), Element.filesize(), Element.mtime().seconds(), Element.filechecksum(),
+                                Element.inlined() ? &Element.content() : nullptr);
                 }
+                SyncBundles(bundleStores, bundleFetches);
+                this->inline_since_ns = call_data->reply->listingns();
+                this->cbl_generation = call_data->reply->generation();
 
                 //Unlock the asynchronous lock and let other threads now it's available
                 AT_Lock.lock();
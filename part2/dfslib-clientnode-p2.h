@@ -7,12 +7,28 @@
 #include <limits.h>
 #include <chrono>
 #include <mutex>
+#include <condition_variable>
 
 #include <grpcpp/grpcpp.h>
 
 #include "src/dfslibx-clientnode-p2.h"
+#include "src/dfslibx-bundle.h"
+#include "src/dfslibx-merkle.h"
+#include "src/dfslibx-checksum-cache.h"
 #include "proto-src/dfs-service.grpc.pb.h"
 
+/**
+ * A file that is not the same on the client and the server. A side that
+ * does not have the file at all has its flag cleared.
+ */
+struct DFSSyncDifference {
+    std::string name;
+    bool onClient = false;
+    bool onServer = false;
+    DFSMerkleEntry client;
+    DFSMerkleEntry server;
+};
+
 class DFSClientNodeP2 : public DFSClientNode {
 
 private:
@@ -20,6 +36,50 @@ private:
     std::condition_variable AT_CV;
     bool AT_Lock_Available = true;
 
+    /** Files larger than this are fetched as stripes of this size (0 disables) **/
+    size_t stripe_size = 16 << 20;
+
+    /** Streams fetching stripes at the same time, besides the first request **/
+    int stripe_streams = 4;
+
+    /** The sync engine moves files up to this size in bundles (0 disables) **/
+    size_t bundle_threshold = DFS_BUNDLE_THRESHOLD;
+
+    /** Checksums of unchanged files in the mount **/
+    DFSChecksumCache checksums;
+
+    /**
+     * Build the Merkle tree of the files in the mount
+     */
+    void BuildTree(DFSMerkleTree* tree);
+
+    /**
+     * Write one stripe starting with the message already in fResponseMsg.
+     * Returns false on a write error, a version change, or a stripe whose
+     * length or checksum does not match.
+     */
+    bool ReceiveStripe(grpc::ClientReader<dfs_service::FetchResponse>* creader, dfs_service::FetchResponse* fResponseMsg,
+                       int fd, off_t offset, off_t length, int64_t version);
+
+    /**
+     * Fetch the remaining stripes concurrently while the first stripe is read
+     * from firstReader, then move the assembled file into place
+     */
+    bool FetchStriped(const std::string& filename, grpc::ClientReader<dfs_service::FetchResponse>* firstReader,
+                      dfs_service::FetchResponse* firstResponse, off_t fileSize);
+
+    /**
+     * Store and fetch the files the sync engine collected for bundles. Files
+     * the server would not bundle, or every file when the server has no
+     * bundle RPCs, go through Store and Fetch one by one instead.
+     */
+    void SyncBundles(const std::vector<std::string>& stores, const std::vector<std::string>& fetches);
+
+    /**
+     * List with one fileLister call, for servers without fileListStream
+     */
+    grpc::StatusCode ListWhole(std::map<std::string,int>* file_map);
+
 public:
 
     //
@@ -41,6 +101,18 @@ public:
      */
     ~DFSClientNodeP2();
 
+    /**
+     * Set the stripe size in bytes (0 disables striping) and how many
+     * streams fetch stripes at the same time
+     */
+    void SetStriping(size_t stripe_size, int stripe_streams);
+
+    /**
+     * Set the size in bytes up to which the sync engine stores and fetches
+     * files in bundles (0 disables bundling)
+     */
+    void SetBundling(size_t bundle_threshold);
+
     /**
      * Request write access to the server
      *
@@ -65,6 +137,29 @@ public:
      */
     grpc::StatusCode Fetch(const std::string& filename) override ;
 
+    /**
+     * Store many small files in one stream. The server takes each file's
+     * write lock itself and applies the files in parallel. The outcome of
+     * every file is put in statuses, ALREADY_EXISTS and CANCELLED mean the
+     * same as for Store.
+     *
+     * @param filenames
+     * @param statuses
+     * @return grpc::StatusCode of the last bundle RPC that failed, or OK
+     */
+    grpc::StatusCode StoreBundle(const std::vector<std::string>& filenames, std::map<std::string, grpc::StatusCode>* statuses);
+
+    /**
+     * Fetch many small files in one stream, writing them in parallel as
+     * they arrive. The outcome of every file is put in statuses; a file the
+     * server would not bundle gets OUT_OF_RANGE and needs a Fetch.
+     *
+     * @param filenames
+     * @param statuses
+     * @return grpc::StatusCode of the last bundle RPC that failed, or OK
+     */
+    grpc::StatusCode FetchBundle(const std::vector<std::string>& filenames, std::map<std::string, grpc::StatusCode>* statuses);
+
     /**
      * Delete a file from the RPC server
      *
@@ -86,6 +181,9 @@ public:
      * be tested. You may skip this or implement it however you see fit.
      * For example, you may want to print a listing of the files returned.
      *
+     * The list is streamed a page at a time with fileListStream, falling
+     * back to one fileLister call on servers without it.
+     *
      * @param file_map
      * @param display
      * @return grpc::StatusCode
@@ -109,6 +207,40 @@ public:
      */
     grpc::StatusCode Stat(const std::string& filename, void* file_status = NULL) override;
 
+    /**
+     * Get or print the server metrics
+     *
+     * The `metrics` parameter, when not NULL, is filled with the
+     * MetricsResponse returned by the server. Only metrics whose
+     * name starts with `prefix` are requested.
+     *
+     * @param prefix
+     * @param metrics
+     * @param display
+     * @return grpc::StatusCode
+     */
+    grpc::StatusCode Metrics(const std::string& prefix = "", dfs_service::MetricsResponse* metrics = NULL, bool display = false);
+
+    /**
+     * Find the files that differ between the mount and the server by
+     * comparing Merkle trees, descending only into subtrees whose hashes
+     * differ. Two mounts that are in sync cost one small call.
+     *
+     * @param differences - filled with the differing files in name order
+     * @return grpc::StatusCode
+     */
+    grpc::StatusCode Reconcile(std::vector<DFSSyncDifference>* differences);
+
+    /**
+     * Reconcile with the server, then store the files that are newer or
+     * only on the client and fetch the ones that are newer or only on the
+     * server
+     *
+     * @param display - print each file moved and a summary
+     * @return grpc::StatusCode of Reconcile
+     */
+    grpc::StatusCode Sync(bool display = false);
+
     /**
      * Handle the asynchronous callback list completion queue
      *
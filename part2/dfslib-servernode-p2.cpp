@@ -1,11 +1,18 @@
 #include <map>
 #include <mutex>
+#include <condition_variable>
 #include <shared_mutex>
 #include <chrono>
+#include <memory>
+#include <algorithm>
 #include <cstdio>
 #include <string>
 #include <thread>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <fstream>
 #include <getopt.h>
@@ -16,6 +23,22 @@
 #include "proto-src/dfs-service.grpc.pb.h"
 #include "src/dfslibx-call-data.h"
 #include "src/dfslibx-service-runner.h"
+#include "src/dfslibx-metrics.h"
+#include "src/dfslibx-file-mutex-table.h"
+#include "src/dfslibx-content-cache.h"
+#include "src/dfslibx-io-engine.h"
+#include "src/dfslibx-upload-pipeline.h"
+#include "src/dfslibx-bundle.h"
+#include "src/dfslibx-listing-hub.h"
+#include "src/dfslibx-arena.h"
+#include "src/dfslibx-checksum-cache.h"
+#include "src/dfslibx-namespace-index.h"
+#include "src/dfslibx-index-log.h"
+#include "src/dfslibx-merkle.h"
+#include "src/dfslibx-compact-listing.h"
+#include "src/dfslibx-dir-reader.h"
+#include "src/dfslibx-crc32.h"
+#include "src/dfslibx-trace.h"
 #include "dfslib-shared-p2.h"
 #include "dfslib-servernode-p2.h"
 
@@ -31,21 +54,66 @@ using dfs_service::DFSService;
 
 #define FILECHUNKBUFSIZE 4096
 
-//Writer lock for each file and which client has it
-typedef struct fileMutexInfo{
-    std::mutex FileMutex;
-    std::string ClientID;
-}fileMutexInfo;
+//Metric handles registered once so the handlers only touch atomics
+struct DFSServerMetrics {
+    DFSHistogram* rpcLatency[14];
+    DFSCounter* bytesIn;
+    DFSCounter* bytesOut;
+    DFSHistogram* checksumTime;
+    DFSHistogram* diskReadTime;
+    DFSHistogram* diskWriteTime;
+    DFSHistogram* lockWait;
+    DFSHistogram* lockHold;
+    DFSCounter* lockConflicts;
+    DFSGauge* activeUploads;
+    DFSGauge* activeFetches;
+    DFSCounter* bundleFilesIn;
+    DFSCounter* bundleFilesOut;
+
+    DFSServerMetrics() {
+        DFSMetricsRegistry& registry = DFSMetricsRegistry::Instance();
+        const char* methods[] = {"fileUploadRequest", "fileFetcher", "fileLister", "fileStatuser", "fileGetLocker",
+                                 "CallbackList", "fileDeleter", "fileCheckSum", "fileSameTimestamp", "GetMetrics",
+                                 "fileBundleStore", "fileBundleFetch", "GetTreeNodes", "fileListStream"};
+        for (int i = 0; i < 14; i++) {
+            rpcLatency[i] = registry.Histogram("dfs_rpc_latency_us", "RPC handler latency in microseconds",
+                                               std::string("method=\"") + methods[i] + "\"");
+        }
+        bytesIn = registry.Counter("dfs_bytes_in_total", "File bytes received from clients");
+        bytesOut = registry.Counter("dfs_bytes_out_total", "File bytes sent to clients");
+        checksumTime = registry.Histogram("dfs_checksum_us", "Time spent computing a file checksum in microseconds");
+        diskReadTime = registry.Histogram("dfs_disk_read_us", "Disk read time per fetch in microseconds");
+        diskWriteTime = registry.Histogram("dfs_disk_write_us", "Disk write time per upload in microseconds");
+        lockWait = registry.Histogram("dfs_lock_wait_us", "Time waiting for the file mutex table in microseconds");
+        lockHold = registry.Histogram("dfs_lock_hold_us", "Time a client held a file write lock in microseconds");
+        lockConflicts = registry.Counter("dfs_lock_conflicts_total", "Write lock requests refused because another client held the lock");
+        activeUploads = registry.Gauge("dfs_active_streams", "Streams currently in progress", "stream=\"upload\"");
+        activeFetches = registry.Gauge("dfs_active_streams", "Streams currently in progress", "stream=\"fetch\"");
+        bundleFilesIn = registry.Counter("dfs_bundle_files_total", "Files carried in bundles", "direction=\"store\"");
+        bundleFilesOut = registry.Counter("dfs_bundle_files_total", "Files carried in bundles", "direction=\"fetch\"");
+    }
+};
+
+//Indexes into DFSServerMetrics::rpcLatency
+enum DFSRpcMethod {RPC_UPLOAD, RPC_FETCH, RPC_LIST, RPC_STATUS, RPC_LOCK, RPC_CALLBACKLIST,
+                   RPC_DELETE, RPC_CHECKSUM, RPC_TIMESTAMP, RPC_METRICS, RPC_BUNDLE_STORE, RPC_BUNDLE_FETCH,
+                   RPC_TREE_NODES, RPC_LIST_STREAM};
+
+static uint64_t ElapsedUs(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - since).count());
+}
 
 
-using FileRequestType = dfs_service::CBLRequest;
-using FileListResponseType = dfs_service::CBLResponse;
+//CallbackList is served raw so one serialized listing can answer many calls
+using FileRequestType = grpc::ByteBuffer;
+using FileListResponseType = grpc::ByteBuffer;
 
 extern dfs_log_level_e DFS_LOG_LEVEL;
 
 
 class DFSServiceImpl final :
-    public DFSService::WithAsyncMethod_CallbackList<DFSService::Service>,
+    public DFSService::WithRawMethod_CallbackList<DFSService::Service>,
         public DFSCallDataManager<FileRequestType , FileListResponseType> {
 
 private:
@@ -75,200 +143,221 @@ private:
 
     /** CRC Table kept in memory for faster calculations **/
     CRC::Table<std::uint32_t, 32> crc_table;
+
+    /** Server metrics handles **/
+    DFSServerMetrics metrics;
+
+    /** Contents of small and recently fetched files, keyed by file version **/
+    DFSContentCache contentCache;
+
+    /** Checksums of unchanged files, so rescans only read what changed **/
+    DFSChecksumCache checksums;
+
+    /** Metadata of every file in the mount, so listings and status calls make no syscalls **/
+    DFSNamespaceIndex index{mount_path, [this](const std::string& name, const std::string& path, const struct stat& st) {
+        return checksums.Checksum(name, path, st, [&] { return TimedChecksum(path); });
+    }};
+
+    /** Disk I/O engine used by each handler thread for fetches **/
+    DFSIoKind io_kind = DFS_IO_AUTO;
+
+    /** Where the namespace index is kept across restarts (empty keeps it in the mount) **/
+    std::string index_file;
+
+    /** Prometheus text file rewritten every metrics_interval milliseconds (empty disables) **/
+    std::string metrics_file;
+    int metrics_interval = 5000;
+
+    /** Parked CallbackList calls and the listing they are answered from **/
+    DFSListingHub listings{
+        [this](DFSListingSnapshot* snapshot) { ScanListing(snapshot); },
+        [this](const DFSListingSnapshot& snapshot, const dfs_service::CBLRequest& request, dfs_service::CBLResponse* response) {
+            RenderListing(snapshot, request, response);
+        }};
+
+    //Checksum a file and record how long it took
+    uint32_t TimedChecksum(const std::string& filePath){
+        DFSScopedTimer timer(metrics.checksumTime);
+        return dfs_file_checksum(filePath, &crc_table);
+    }
+
+    //Brings the index, content cache and listings up to date after a handler wrote or removed a file
+    void FileChanged(const std::string& FileName){
+        contentCache.Invalidate(FileName);
+        index.Refresh(FileName);
+        listings.Changed();
+    }
+
+    //Copies the completion queue stats from the runner into gauges
+    void RefreshQueueMetrics(){
+        DFSMetricsRegistry& registry = DFSMetricsRegistry::Instance();
+        for (const std::unique_ptr<DFSQueueStats>& stats : runner.QueueStats()) {
+            std::string labels = "queue=\"" + std::to_string(stats->queue_index) + "\"";
+            registry.Gauge("dfs_queue_depth", "Calls accepted but not finished on a completion queue", labels)->Set(stats->depth.load());
+            registry.Gauge("dfs_queue_max_depth", "Highest depth seen on a completion queue", labels)->Set(stats->max_depth.load());
+            registry.Gauge("dfs_queue_events", "Events drained from a completion queue", labels)->Set(static_cast<int64_t>(stats->events.load()));
+            registry.Gauge("dfs_queue_mean_latency_us", "Mean accept-to-finish latency on a completion queue", labels)->Set(static_cast<int64_t>(stats->MeanLatencyUs()));
+            registry.Gauge("dfs_queue_max_latency_us", "Max accept-to-finish latency on a completion queue", labels)->Set(static_cast<int64_t>(stats->max_latency_us.load()));
+        }
+    }
     
     
     //////////////////////////////////////////////////////
     //This section writer lock information for each file//
-    //I pray these don't have deadlocks                 //
     //////////////////////////////////////////////////////
-    //MasterLock and conditional allows for the update of writer locks
-    std::condition_variable MasterLock_CV;
-    bool MasterLock_Avail = true;
-    std::mutex MasterMutex;
-    std::map<std::string, fileMutexInfo> fileMutexes;
-    
+    DFSFileMutexTable fileMutexes{metrics.lockWait, metrics.lockHold, metrics.lockConflicts};
+
     //Requests to get file mutex
     bool fileMutex_Request(std::string FileName, std::string clientID){
-        dfs_log(LL_SYSINFO) << "ServerSide | Client [" << clientID << "] is requesting mutex for File " << FileName;
-        
-        //Acquire the lock & critical section
-        std::unique_lock<std::mutex> MasterLock (MasterMutex);
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] attempting to get master lock";
-        while(!MasterLock_Avail){MasterLock_CV.wait(MasterLock);}
-        MasterLock_Avail = false;
-        MasterLock.unlock();
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] has master lock";
-
-        bool SuccessfulRequest;
-        //If then to check if mutex has been created and is in the fileMutexes
-        dfs_log(LL_SYSINFO) << "ServerSide | Checking for file mutex for " << FileName;
-        if(fileMutexes.find(FileName) != fileMutexes.end()){
-            dfs_log(LL_SYSINFO) << "ServerSide | File Mutex exists in system";
-
-            //Client already has the mutex
-            if (fileMutexes[FileName].ClientID == clientID){
-                dfs_log(LL_SYSINFO) << "ServerSide | File Mutex is already assigned to the Client performing this request ClientID: " << fileMutexes[FileName].ClientID;
-                SuccessfulRequest = true;
-            }
-            //Check if a client has it or if it's available
-            else if(fileMutexes[FileName].ClientID != "NOT_IN_USE"){
-                dfs_log(LL_SYSINFO) << "ServerSide | File Mutex is currently being used by a different Client: " << fileMutexes[FileName].ClientID;
-                SuccessfulRequest = false;
-            }
-            //it's available and already created
-            else{
-                fileMutexes[FileName].FileMutex.lock();
-                fileMutexes[FileName].ClientID =  clientID;
-                dfs_log(LL_SYSINFO) << "Serverside | File Mutex available and is assigned now to Client: " << fileMutexes[FileName].ClientID;
-                fileMutexes[FileName].FileMutex.unlock();
-                SuccessfulRequest = true;
-            }
-        }
-        //Mutex has not been created yet
-        else{
-            fileMutexes[FileName].FileMutex.lock();
-            fileMutexes[FileName].ClientID = clientID;
-            dfs_log(LL_SYSINFO) << "ServerSide | File Mutex has been created for file: " << FileName << " and is assigned now to Client: " << fileMutexes[FileName].ClientID;
-            fileMutexes[FileName].FileMutex.unlock();
-            SuccessfulRequest = true;
-        }
+        return fileMutexes.Request(FileName, clientID);
+    }
 
+    //Releaes lock but is still available if file exists
+    bool fileMutex_Release(std::string FileName, std::string clientID){
+        return fileMutexes.Release(FileName, clientID);
+    }
 
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] attempting to release master lock";
-        MasterLock.lock();
-        MasterLock_Avail = true;
-        MasterLock.unlock();
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] no longer has master lock";
-        MasterLock_CV.notify_all();
+    //Deletes the mutex if the file is deleted
+    bool fileMutex_Delete(std::string FileName, std::string clientID){
+        return fileMutexes.Delete(FileName, clientID);
+    }
 
-        return SuccessfulRequest;
+    //Calls the correct function depending if the file exists in the system or not
+    bool fileMutex_Release_Or_Delete(std::string FileName, std::string clientID, bool FileInSystem){
+        return fileMutexes.ReleaseOrDelete(FileName, clientID, FileInSystem);
+    }
 
+    //Checks if current client is the owner
+    bool fileMutex_IsClientOwnerCheck(std::string FileName, std::string clientID){
+        return fileMutexes.IsClientOwner(FileName, clientID);
     }
 
-    //Releaes lock but is still available if file exists
-    bool fileMutex_Release(std::string FileName, std::string clientID){
+    //Returns the owner of the mutex
+    std::string fileMutex_getOwner(std::string FileName){
+        return fileMutexes.Owner(FileName);
+    }
 
-        //Acquire the lock & critical section
-        std::unique_lock<std::mutex> MasterLock (MasterMutex);
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] attempting to get master lock";
-        while(!MasterLock_Avail){MasterLock_CV.wait(MasterLock);}
-        MasterLock_Avail = false;
-        MasterLock.unlock();
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] has master lock";
-
-
-        dfs_log(LL_SYSINFO) << "ServerSide | Attempting to release File Mutex for file: " << FileName;
-        bool SuccessfulRelease;
-
-        //If then to check if mutex exist in the map of filenames and mutexes
-        if(fileMutexes.find(FileName) != fileMutexes.end()){
-            //Check the correct client is trying to perform the action
-            if(fileMutexes[FileName].ClientID == clientID){
-                fileMutexes[FileName].FileMutex.lock();
-                fileMutexes[FileName].ClientID = "NOT_IN_USE";
-                fileMutexes[FileName].FileMutex.unlock();
-                dfs_log(LL_SYSINFO) << "ServerSide | File Mutex for file, " << FileName << ", has been released";
-                SuccessfulRelease = true;
-            } 
-            //Incorrect client is releasing the lock
-            else{       
-                dfs_log(LL_ERROR) << "ServerSide | Mutex for file, " << FileName << ", has not been released. ClientID does not have ownership";
-                SuccessfulRelease = false;
-            }
+    //Stores one bundled file under the same lock, checksum and mtime rules as fileUploadRequest.
+    //The lock a single store asks for with fileGetLocker is taken here instead.
+    StatusCode StoreBundleRecord(const std::string& ClientID, const dfs_service::BundleRecord& record){
+        const std::string& FileName = record.filename();
+        std::string FilePath = WrapPath(FileName);
+        const std::string& content = record.content();
+        if(content.length() != record.filesize()){
+            dfs_log(LL_ERROR) << "ServerSide | Bundled file has " << content.length() << " of " << record.filesize() << " bytes: " << FileName;
+            return StatusCode::INVALID_ARGUMENT;
         }
-        //Mutex at this time does not exist
-        else{
-            dfs_log(LL_ERROR) << "ServerSide | Mutex for file, " << FileName << ", has not been released. It does not currently exist";
-            SuccessfulRelease = false;
+        if(dfs_reserved_name(FileName)){
+            return StatusCode::INVALID_ARGUMENT;
         }
 
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] attempting to release master lock";
-        MasterLock.lock();
-        MasterLock_Avail = true;
-        MasterLock.unlock();
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] no longer has master lock";
-        MasterLock_CV.notify_all();
+        if(!fileMutex_Request(FileName, ClientID)){
+            dfs_log(LL_SYSINFO) << "ServerSide | Bundled file is locked by Client ID [" << fileMutex_getOwner(FileName) << "]: " << FileName;
+            return StatusCode::RESOURCE_EXHAUSTED;
+        }
 
-        return SuccessfulRelease;
-    }
+        struct stat fileStat;
+        bool FileInSystem = stat(FilePath.c_str(), &fileStat) == 0;
+        if(FileInSystem){
+            if(TimedChecksum(FilePath) == record.filechecksum()){
+                fileMutex_Release_Or_Delete(FileName, ClientID, FileInSystem);
+                return StatusCode::ALREADY_EXISTS;
+            }
+            if(fileStat.st_mtim.tv_sec >= record.mtime().seconds()){
+                fileMutex_Release_Or_Delete(FileName, ClientID, FileInSystem);
+                return StatusCode::CANCELLED;
+            }
+        }
 
-    //Deletes the mutex if the file is deleted
-    bool fileMutex_Delete(std::string FileName, std::string clientID){
-        //Acquire the lock & critical section
-        std::unique_lock<std::mutex> MasterLock (MasterMutex);
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] attempting to get master lock";
-        while(!MasterLock_Avail){MasterLock_CV.wait(MasterLock);}
-        MasterLock_Avail = false;
-        MasterLock.unlock();
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] has master lock";
-
-        dfs_log(LL_SYSINFO) << "ServerSide | Attempting to delete Mutex for file: " << FileName;
-        bool SuccessfulDelete;
-        //Check if mutex exist in current fileMutexes
-        if(fileMutexes.find(FileName) != fileMutexes.end()){
-            //Check the correct client is requesting this action
-            if(fileMutexes[FileName].ClientID == clientID){
-                dfs_log(LL_SYSINFO) << "ServerSide | File Mutex for file, " << FileName << ", has been deleted";
-                fileMutexes.erase(FileName);
-                SuccessfulDelete = true;
-            }
-            //Output incorrect client is requesting to delete the lock
-            else{
-                dfs_log(LL_ERROR) << "ServerSide | File Mutex for file, " << FileName << ", has not been deleted. ClientID does not have ownership";
-                SuccessfulDelete = false;
-            }     
+        contentCache.Invalidate(FileName);
+        int fd = open(FilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0){
+            dfs_log(LL_ERROR) << "ServerSide | Unable to open file: " << FileName << " " << strerror(errno);
+            fileMutex_Release_Or_Delete(FileName, ClientID, FileInSystem);
+            return StatusCode::INTERNAL;
         }
-        //File Mutex delete when file mutex does not exist
-        else{
-            dfs_log(LL_ERROR) << "ServerSide | File Mutex for file, " << FileName << ", does not currently exist";
-            SuccessfulDelete = false;
+        std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+        bool writeFailed = !dfs_write_fully(fd, content.data(), content.length());
+        close(fd);
+        FileChanged(FileName);
+        if(writeFailed){
+            dfs_log(LL_ERROR) << "ServerSide | Writing to disk failed for bundled file: " << FileName;
+            fileMutex_Release_Or_Delete(FileName, ClientID, true);
+            return StatusCode::INTERNAL;
         }
+        metrics.diskWriteTime->Record(ElapsedUs(writeStart));
+        metrics.bytesIn->Add(content.length());
 
-        //Release the lock & critical section
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] attempting to release master lock";
-        MasterLock.lock();
-        MasterLock_Avail = true;
-        MasterLock.unlock();
-        dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] no longer has master lock";
-        MasterLock_CV.notify_all();
-
-        return SuccessfulDelete;
+        if(!fileMutex_Release(FileName, ClientID)){
+            return StatusCode::INTERNAL;
+        }
+        return StatusCode::OK;
     }
-    
-    //Calls the correct function depending if the file exists in the system or not
-    bool fileMutex_Release_Or_Delete(std::string FileName, std::string clientID, bool FileInSystem){
-        if(fileMutex_IsClientOwnerCheck(FileName, clientID)){
-            if(FileInSystem){
-                dfs_log(LL_SYSINFO) << "ServerSide | Calling fileMutex_Release for file: " << FileName;
-                return fileMutex_Release(FileName, clientID);
+
+    //Reads one file for a bundle under the same checksum and mtime rules as fileFetcher.
+    //Files over DFS_BUNDLE_MAX_RECORD are refused with OUT_OF_RANGE and fetched on their own.
+    StatusCode ReadBundleRecord(const dfs_service::FetchRequest& file, dfs_service::BundleRecord* record){
+        const std::string& fileName = file.filename();
+        std::string filePath = WrapPath(fileName);
+        struct stat fileStat;
+        if(dfs_reserved_name(fileName) || stat(filePath.c_str(), &fileStat) != 0){
+            return StatusCode::NOT_FOUND;
+        }
+        if(fileStat.st_size > DFS_BUNDLE_MAX_RECORD){
+            return StatusCode::OUT_OF_RANGE;
+        }
+        if(file.clienthasfile()){
+            if(TimedChecksum(filePath) == file.cfilechecksum()){
+                return StatusCode::ALREADY_EXISTS;
             }
-            else{
-                dfs_log(LL_SYSINFO) << "ServerSide | Calling fileMutex_Delete for file: " << FileName;
-                return fileMutex_Delete(FileName, clientID);
+            if(fileStat.st_mtim.tv_sec <= file.cfilemtime().seconds()){
+                return StatusCode::CANCELLED;
             }
         }
-        return false;
-    }
-
 
-    //Checks if current client is the owner
-    bool fileMutex_IsClientOwnerCheck(std::string FileName, std::string clientID){
-        //Check if filename mutex exists
-        if(fileMutexes.find(FileName) != fileMutexes.end()){
-            if(fileMutexes[FileName].ClientID == clientID){
-                return true;
-            }
+        record->set_filename(fileName);
+        record->mutable_mtime()->set_seconds(fileStat.st_mtim.tv_sec);
+        if(!ReadSmallFile(fileName, filePath, fileStat, record->mutable_content())){
+            return StatusCode::INTERNAL;
         }
-        dfs_log(LL_SYSINFO) << "Client [" << clientID << "] is not the owner of file mutex: " << FileName; 
-        return false;
+        record->set_filesize(fileStat.st_size);
+        return StatusCode::OK;
     }
 
-    //Returns the owner of the mutex
-    std::string fileMutex_getOwner(std::string FileName){
-        if(fileMutexes.find(FileName) != fileMutexes.end()){
-            return fileMutexes[FileName].ClientID;
+    //Reads the whole of a small file into content, from the content cache when it holds this version
+    bool ReadSmallFile(const std::string& fileName, const std::string& filePath, const struct stat& fileStat, std::string* content){
+        size_t fileSize = static_cast<size_t>(fileStat.st_size);
+        std::shared_ptr<const DFSCachedFile> cached = contentCache.Lookup(fileName, fileStat);
+        if(cached && cached->Length() == fileSize){
+            content->assign(cached->Data(), cached->Length());
+            return true;
+        }
+        int fd = open(filePath.c_str(), O_RDONLY);
+        if(fd < 0){
+            return false;
+        }
+        content->resize(fileSize);
+        std::chrono::steady_clock::time_point readStart = std::chrono::steady_clock::now();
+        bool readFailed = fileSize > 0 && !dfs_pread_fully(fd, &(*content)[0], fileSize, 0);
+        //The file may have been rewritten since fileStat was taken, and its
+        //bytes must not go out as the content of that version
+        struct stat readStat;
+        bool changed = !readFailed && (fstat(fd, &readStat) != 0 ||
+                                       !(DFSFileVersion::FromStat(readStat) == DFSFileVersion::FromStat(fileStat)));
+        close(fd);
+        if(readFailed){
+            dfs_log(LL_ERROR) << "ServerSide | Reading failed for small file: " << fileName;
+            return false;
+        }
+        if(changed){
+            dfs_log(LL_SYSINFO) << "ServerSide | Small file changed since it was listed, not sending it: " << fileName;
+            return false;
+        }
+        metrics.diskReadTime->Record(ElapsedUs(readStart));
+        if(fileSize > 0 && contentCache.FillLength(fileStat.st_size) == fileSize){
+            contentCache.Insert(fileName, filePath, fileStat, std::string(*content));
         }
-        return "Not Created";
+        return true;
     }
 
 
@@ -288,7 +377,54 @@ public:
         this->runner.Shutdown();
     }
 
+    void SetCpuAffinity(bool cpu_affinity) {
+        this->runner.SetCpuAffinity(cpu_affinity);
+    }
+
+    void SetStatsInterval(int stats_interval) {
+        this->runner.SetStatsInterval(stats_interval);
+    }
+
+    void SetMetricsFile(const std::string& metrics_file, int metrics_interval) {
+        this->metrics_file = metrics_file;
+        this->metrics_interval = metrics_interval;
+    }
+
+    void SetCacheSize(size_t cache_size) {
+        this->contentCache.SetBudget(cache_size);
+    }
+
+    void SetIoEngine(DFSIoKind io_kind) {
+        this->io_kind = io_kind;
+        dfs_log(LL_SYSINFO) << "Disk I/O engine: " << DFSIoEngine::Create(io_kind, 1, 4096)->Name();
+    }
+
+    void SetIndexFile(const std::string& index_file) {
+        this->index_file = index_file;
+    }
+
     void Run() {
+        //Periodically rewrite the Prometheus text file
+        if(!metrics_file.empty() && metrics_interval > 0){
+            std::thread metrics_thread([this]{
+                while(true){
+                    std::this_thread::sleep_for(std::chrono::milliseconds(metrics_interval));
+                    RefreshQueueMetrics();
+                    if(!DFSMetricsRegistry::Instance().WritePrometheusFile(metrics_file)){
+                        dfs_log(LL_ERROR) << "ServerSide | Could not write metrics file: " << metrics_file;
+                    }
+                }
+            });
+            metrics_thread.detach();
+        }
+        //Files changed behind the server's back reach parked CallbackList calls through the index
+        this->index.SetLogPath(index_file.empty() ? WrapPath(DFS_INDEX_LOG_NAME) : index_file);
+        long indexed = this->index.Start([this](const std::string& name){
+            contentCache.Invalidate(name);
+            listings.Changed();
+        });
+        dfs_log(LL_SYSINFO) << "ServerSide | Indexed " << indexed << " files in " << mount_path;
+        this->listings.Start();
         this->runner.Run();
     }
 
@@ -304,19 +440,26 @@ public:
     }
 
 
-    void ProcessCallback(ServerContext* context, FileRequestType* request, FileListResponseType* response) {
+    bool ProcessCallback(ServerContext* context, FileRequestType* request, FileListResponseType* response,
+                         DFSPendingCall<FileListResponseType>* call) override {
 
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_CALLBACKLIST]);
         dfs_log(LL_SYSINFO) << "ServerSide | Processing Callback";
-        Status cblStatusMsg = CallbackList(context, request, response);
-        dfs_log(LL_SYSINFO) << "ServerSide | Completed Callback";
-        if(cblStatusMsg.error_code() != StatusCode::OK){
-            dfs_log(LL_ERROR) << "ServerSide | Processing Callback failed. Error Message: " << cblStatusMsg.error_message();
-        }
-        else{
-            dfs_log(LL_SYSINFO) << "ServerSide | Completed Callback";
+        //The request is parsed into a block on the stack, the hub copies what it keeps
+        alignas(8) char arenaBlock[DFS_ARENA_REQUEST_BLOCK];
+        google::protobuf::Arena arena(dfs_arena_options(arenaBlock, sizeof(arenaBlock)));
+        dfs_service::CBLRequest& cblRequest = *google::protobuf::Arena::CreateMessage<dfs_service::CBLRequest>(&arena);
+        grpc::Status parsed = grpc::SerializationTraits<dfs_service::CBLRequest>::Deserialize(request, &cblRequest);
+        if(!parsed.ok()){
+            //An empty listing would read as a server with no files
+            dfs_log(LL_ERROR) << "ServerSide | Processing Callback failed. Error Message: " << parsed.error_message();
+            call->Fail(Status(StatusCode::INVALID_ARGUMENT, "ServerSide | CallbackList request could not be parsed"));
+            return false;
         }
-
-
+        //The hub answers now or once the listing moves past the client's generation
+        listings.Submit(cblRequest, call);
+        dfs_log(LL_SYSINFO) << "ServerSide | Submitted Callback for generation " << cblRequest.generation();
+        return false;
 
     }
 
@@ -351,6 +494,11 @@ public:
 
 
     Status fileUploadRequest(ServerContext* context, ServerReader<dfs_service::UploadRequest>* sreader, dfs_service::UploadResponse* fileUploadRespond) override{      
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_UPLOAD]);
+        DFSScopedGauge activeStream(metrics.activeUploads);
+        DFSTraceScope traceScope(DFSTracer::Extract(context));
+        DFSTraceSpan uploadSpan("Upload", "server", "");
+
         //Msg to populate each stream read
         dfs_service::UploadRequest FileUploadRequest;
         
@@ -366,8 +514,9 @@ public:
         std::string ClientID = FileUploadRequest.clientid();
         uint32_t Client_CheckSum = FileUploadRequest.cfilechecksum();
         time_t client_mtime = FileUploadRequest.cfilemtime().seconds();
-        off_t fileSize = FileUploadRequest.filesize();
+        off_t fileSize = static_cast<off_t>(FileUploadRequest.filesize());
         bytesRead += FileUploadRequest.filechunk().length();
+        uploadSpan.SetDetail(FileName);
         
         //Double checking the lock is correct
         if(!fileMutex_IsClientOwnerCheck(FileName, ClientID)){
@@ -378,8 +527,9 @@ public:
         
         dfs_log(LL_SYSINFO) << "ServerSide | Accepting Client Request to store file: " << FileName; 
 
-        //Copy File bytes into a string
-        const std::string chunkContents = FileUploadRequest.filechunk();
+        //Take the first chunk's bytes out of the message
+        std::string chunkContents;
+        chunkContents.swap(*FileUploadRequest.mutable_filechunk());
 
         //Setting Response message variables
         fileUploadRespond->set_filename(FileName);
@@ -387,7 +537,10 @@ public:
         //Mostly to keep track of whats going on
         bool FileInSystem; //Delete == false | Release == true
         struct stat fileStat;
-        if(stat(FilePath.c_str(), &fileStat) != 0){
+        DFSTraceSpan statSpan("Upload.stat", "server", FileName);
+        int statResult = stat(FilePath.c_str(), &fileStat);
+        statSpan.End();
+        if(statResult != 0){
             FileInSystem = false;
             dfs_log(LL_SYSINFO) << "ServerSide | Given file not found in system will be creating file: " << FileName;
         } 
@@ -398,7 +551,9 @@ public:
 
         //If file is in system compare the checksums and last modified times
         if(FileInSystem){
-            uint32_t Server_Checksum = dfs_file_checksum(FilePath, &crc_table);
+            DFSTraceSpan checksumSpan("Upload.checksum", "server", FileName);
+            uint32_t Server_Checksum = TimedChecksum(FilePath);
+            checksumSpan.End();
             if(Server_Checksum == Client_CheckSum){
                 dfs_log(LL_ERROR) << "ServerSide | File is the same on server for file: " << FileName;
                 fileMutex_Release_Or_Delete(FileName, ClientID, FileInSystem);
@@ -420,28 +575,68 @@ public:
             return Status(StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded or Client cancelled, prematurely ending request");
         }
 
+        //Receiving the remaining chunks and writing them to disk
+        DFSTraceSpan receiveSpan("Upload.receive", "server", FileName);
+
         //Opening the file to write to
-        std::ofstream file;
-        file.open(FilePath, std::ios::out | std::ios::trunc);
+        contentCache.Invalidate(FileName);
+        int fd = open(FilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0){
+            dfs_log(LL_ERROR) << "ServerSide | Unable to open file: " << FileName << " " << strerror(errno);
+            fileMutex_Release_Or_Delete(FileName, ClientID, FileInSystem);
+            return Status(StatusCode::INTERNAL, "Unable to open file on server");
+        }
 
-        //Copying the first section
-        file << chunkContents;
+        //The writer stage coalesces queued chunks into pwritev calls while
+        //this thread keeps receiving
+        DFSUploadPipeline pipeline(fd);
+        bool extents = FileUploadRequest.extents();
+        bool writeFailed = extents ? !pipeline.Push(std::move(chunkContents), static_cast<off_t>(FileUploadRequest.chunkoffset()))
+                                   : !pipeline.Push(std::move(chunkContents));
         dfs_log(LL_SYSINFO) << "ServerSide | Bytes Download from Client: " << bytesRead << "/" << fileSize;
-        if(fileSize > FILECHUNKBUFSIZE){
-            while(sreader->Read(&FileUploadRequest)){
+        //With extents a small sparse file can still come as one chunk per data
+        //extent, so the stream is read to its end whatever the file size
+        if(extents || fileSize > FILECHUNKBUFSIZE){
+            //Parse each chunk into a buffer the writer is done with, then hand
+            //that buffer to the writer without copying it
+            std::string chunk = pipeline.TakeSpare();
+            FileUploadRequest.mutable_filechunk()->swap(chunk);
+            while(!writeFailed && sreader->Read(&FileUploadRequest)){
                 //Break loop if all bytes are read
-                if(bytesRead >= fileSize){
+                if(!extents && bytesRead >= fileSize){
                     dfs_log(LL_SYSINFO) << "ServerSide | Transfer has been completed for file: " << FileName;
                     break;
                 }
-                const std::string chunkContents = FileUploadRequest.filechunk();
                 //bytesRead += FileUploadRequest.mutable_filechunk()->length();
                 bytesRead += FileUploadRequest.filechunk().length();
-                file << chunkContents;
+                chunk = pipeline.TakeSpare();
+                FileUploadRequest.mutable_filechunk()->swap(chunk);
+                writeFailed = extents ? !pipeline.Push(std::move(chunk), static_cast<off_t>(FileUploadRequest.chunkoffset()))
+                                      : !pipeline.Push(std::move(chunk));
                 dfs_log(LL_SYSINFO) << "ServerSide | Bytes Download from Client: " << bytesRead << "/" << fileSize;
             }
         }
-        file.close();
+        if(!pipeline.Finish()){
+            writeFailed = true;
+        }
+        //Holes the client skipped, including any at the end, only need the file size
+        if(extents && !writeFailed && ftruncate(fd, fileSize) != 0){
+            writeFailed = true;
+        }
+        close(fd);
+        uint64_t DiskTimeUs = pipeline.DiskTimeUs();
+        if(writeFailed){
+            dfs_log(LL_ERROR) << "ServerSide | Writing to disk failed for file: " << FileName;
+            FileChanged(FileName);
+            fileMutex_Release_Or_Delete(FileName, ClientID, true);
+            return Status(StatusCode::INTERNAL, "Error writing file on server");
+        }
+        FileChanged(FileName);
+        metrics.diskWriteTime->Record(DiskTimeUs);
+        metrics.bytesIn->Add(bytesRead);
+        receiveSpan.SetArg("disk_us", DiskTimeUs);
+        receiveSpan.SetArg("writes", pipeline.Writes());
+        receiveSpan.End();
 
         dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to store file: " << FileName;
 
@@ -454,6 +649,11 @@ public:
     }
 
     Status fileFetcher(ServerContext* context, const dfs_service::FetchRequest* fRequestMsg, ServerWriter<dfs_service::FetchResponse> *swriter) override{
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_FETCH]);
+        DFSScopedGauge activeStream(metrics.activeFetches);
+        DFSTraceScope traceScope(DFSTracer::Extract(context));
+        DFSTraceSpan fetchSpan("Fetch", "server", fRequestMsg->filename());
+
         //Creating filePath string and setting copyfile to false. Which is false until all prechecks are done
         //then it's set to true and the client will write a new file
         std::string fileName = fRequestMsg->filename();
@@ -467,7 +667,11 @@ public:
         //Mostly to keep track of whats going on
         
         struct stat fileStat;
-        if(stat(filePath.c_str(), &fileStat) != 0){
+        DFSTraceSpan statSpan("Fetch.stat", "server", fileName);
+        //The server's own files in the mount are never served
+        int statResult = dfs_reserved_name(fileName) ? -1 : stat(filePath.c_str(), &fileStat);
+        statSpan.End();
+        if(statResult != 0){
             dfs_log(LL_ERROR) << "ServerSide | The requested file does not exist in the system: " << fileName;
             return Status(StatusCode::NOT_FOUND, "Requested Fetch not found on server"); //TO DO needs to be not found
         }
@@ -484,7 +688,9 @@ public:
         //Only perform the checksum and mtime compare is the file exists on the client
         if(fRequestMsg->clienthasfile()){
             uint32_t Client_Checksum = fRequestMsg->cfilechecksum();
-            uint32_t Server_Checksum = dfs_file_checksum(filePath, &crc_table);
+            DFSTraceSpan checksumSpan("Fetch.checksum", "server", fileName);
+            uint32_t Server_Checksum = TimedChecksum(filePath);
+            checksumSpan.End();
             if(Server_Checksum == Client_Checksum){
                 dfs_log(LL_ERROR) << "ServerSide | File is the same on server for file: " << fileName;
                 return Status(StatusCode::ALREADY_EXISTS, "Already exists");
@@ -502,50 +708,199 @@ public:
     
 
 
-        //Create file size, vector or array to hold chunks of data
+        //Create file size
         off_t fileSize = fileStat.st_size;
-        std::vector<char> fileChunk(FILECHUNKBUFSIZE, 0);
 
         //Setting filsize
         fResponseMsg.set_filesize(fileSize);
+        fResponseMsg.set_versionns(DFSFileVersion::FromStat(fileStat).mtime_ns);
+
+        //A ranged fetch sends one stripe of the file, ending with its checksum
+        bool ranged = fRequestMsg->length() > 0;
+        off_t rangeStart = ranged ? static_cast<off_t>(std::min<uint64_t>(fRequestMsg->offset(), fileSize)) : 0;
+        off_t rangeEnd = ranged ? static_cast<off_t>(std::min<uint64_t>(rangeStart + fRequestMsg->length(), fileSize)) : fileSize;
+        uint32_t stripeChecksum = 0;
+
+        //Holes are skipped rather than sent when the client can place content by offset
+        bool extents = fRequestMsg->acceptsextents();
+        fResponseMsg.set_extents(extents);
+        bool skipHoles = extents && dfs_file_is_sparse(fileStat);
+
+        //Reading the file and streaming it to the client
+        DFSTraceSpan sendSpan("Fetch.send", "server", fileName);
+
+        //Keep track of how far into the file has been sent, and how many bytes that took
+        off_t bytesRead = rangeStart;
+        uint64_t bytesSent = 0;
+        bool wroteAny = false;
+        uint64_t DiskTimeUs = 0;
+
+        //Stream the leading bytes from the content cache when this version is cached
+        std::shared_ptr<const DFSCachedFile> cached = rangeStart == 0 ? contentCache.Lookup(fileName, fileStat) : nullptr;
+        if(cached){
+            off_t cachedEnd = std::min(static_cast<off_t>(cached->Length()), rangeEnd);
+            while(bytesRead < cachedEnd){
+                size_t chunkSize = std::min(static_cast<size_t>(FILECHUNKBUFSIZE), static_cast<size_t>(cachedEnd - bytesRead));
+                fResponseMsg.set_content(cached->Data() + bytesRead, chunkSize);
+                fResponseMsg.set_contentoffset(bytesRead);
+                if(ranged){
+                    stripeChecksum = dfs_crc32_slice8(cached->Data() + bytesRead, chunkSize, stripeChecksum);
+                }
+                bytesRead += chunkSize;
+                bytesSent += chunkSize;
+                dfs_log(LL_SYSINFO) << "ServerSide | Bytes uploaded Server to Client (cached): " << bytesRead << "/" << fileSize;
+                swriter->Write(fResponseMsg);
+                wroteAny = true;
+            }
+        }
+
+        //On a miss keep the leading bytes that are read for the cache
+        std::string fillData;
+        size_t fillLength = cached || rangeStart > 0 ? 0 : contentCache.FillLength(fileSize);
+        if(static_cast<off_t>(fillLength) > rangeEnd){
+            fillLength = 0;
+        }
+        if(fillLength > 0){
+            fillData.reserve(fillLength);
+        }
 
-        //Opening file in read mode
-        std::ifstream file;
-        file.open(filePath, std::ios::in);
+        //Opening file in read mode, past any bytes already sent from the cache
+        int fd = open(filePath.c_str(), O_RDONLY);
+        if(fd < 0){
+            dfs_log(LL_ERROR) << "ServerSide | Unable to open file: " << fileName << " " << strerror(errno);
+            return Status(StatusCode::CANCELLED, "Data transfer issue");
+        }
 
-        //Keep track of how many bytes are read
-        off_t bytesRead = 0;
-        while(!file.eof())
-        {
-            //Break loop if transfer is complete
-            if(bytesRead >= fileSize){
-                dfs_log(LL_SYSINFO) << "ServerSide | Completed uploading to client file: " << fileName;
+        //Keep up to a queue depth of block reads ahead of the network
+        DFSIoEngine& engine = DFSIoEngine::ForThread(io_kind);
+        struct BlockRead { unsigned slot; off_t offset; size_t length; };
+        std::deque<BlockRead> readsAhead;
+        std::map<unsigned, ssize_t> readResults;
+        off_t nextOffset = bytesRead;
+        //Reads stay inside the current data extent, which is the whole range unless holes are skipped
+        off_t dataStart = nextOffset;
+        off_t dataEnd = skipHoles ? nextOffset : rangeEnd;
+        bool readFailed = false;
+
+        //Account for a hole up to position: it is checksummed and cached as zeros but not sent
+        auto skipHole = [&](off_t position) {
+            if(position <= bytesRead){
+                return;
+            }
+            if(ranged){
+                stripeChecksum = dfs_crc32_zeros(stripeChecksum, static_cast<uint64_t>(position - bytesRead));
+            }
+            if(fillData.length() < fillLength){
+                fillData.append(std::min(static_cast<size_t>(position - bytesRead), fillLength - fillData.length()), '\0');
+            }
+            bytesRead = position;
+        };
+
+        while(!readFailed){
+            int slot;
+            while(nextOffset < rangeEnd){
+                if(nextOffset >= dataEnd){
+                    if(!dfs_next_data_extent(fd, nextOffset, rangeEnd, &dataStart, &dataEnd)){
+                        nextOffset = rangeEnd;
+                        break;
+                    }
+                    nextOffset = dataStart;
+                }
+                if((slot = engine.AcquireSlot()) < 0){
+                    break;
+                }
+                size_t length = std::min(engine.BlockSize(), static_cast<size_t>(dataEnd - nextOffset));
+                engine.QueueRead(static_cast<unsigned>(slot), fd, length, nextOffset);
+                readsAhead.push_back({static_cast<unsigned>(slot), nextOffset, length});
+                nextOffset += length;
+            }
+            if(readsAhead.empty()){
                 break;
             }
-
-            //Add the check amount of data depending on bytes remaining and chunk size
-            if(bytesRead + fileChunk.size() > fileSize){
-                file.read(fileChunk.data(), fileSize-bytesRead);
-                fResponseMsg.set_content(fileChunk.data(), file.gcount());
-                bytesRead += file.gcount();
+            engine.Submit();
+
+            //Wait for the oldest read, other completions are kept until their turn
+            auto DiskStart = std::chrono::steady_clock::now();
+            unsigned block = readsAhead.front().slot;
+            off_t blockOffset = readsAhead.front().offset;
+            size_t blockLength = readsAhead.front().length;
+            readsAhead.pop_front();
+            while(readResults.find(block) == readResults.end()){
+                unsigned completedSlot;
+                ssize_t result;
+                if(!engine.Wait(&completedSlot, &result)){
+                    readResults[block] = -EIO;
+                    break;
+                }
+                readResults[completedSlot] = result;
+            }
+            DiskTimeUs += ElapsedUs(DiskStart);
+            ssize_t result = readResults[block];
+            readResults.erase(block);
+            if(result != static_cast<ssize_t>(blockLength)){
+                dfs_log(LL_ERROR) << "ServerSide | Read failed for file: " << fileName << " at " << blockOffset << " result " << result;
+                readFailed = true;
+                break;
             }
-            else{
-                file.read(fileChunk.data(), fileChunk.size());
-                fResponseMsg.set_content(fileChunk.data(), file.gcount());
-                bytesRead += file.gcount();
 
+            skipHole(blockOffset);
+            const char* blockData = engine.Buffer(block);
+            if(fillData.length() < fillLength){
+                fillData.append(blockData, std::min(blockLength, fillLength - fillData.length()));
             }
 
-            //Stream the updated values
-            dfs_log(LL_SYSINFO) << "ServerSide | Bytes uploaded Server to Client: " << bytesRead << "/" << fileSize;
-            swriter->Write(fResponseMsg);
+            //Stream the block in chunk sized messages
+            for(size_t sent = 0; sent < blockLength; sent += FILECHUNKBUFSIZE){
+                size_t chunkSize = std::min(static_cast<size_t>(FILECHUNKBUFSIZE), blockLength - sent);
+                fResponseMsg.set_content(blockData + sent, chunkSize);
+                fResponseMsg.set_contentoffset(bytesRead);
+                if(ranged){
+                    stripeChecksum = dfs_crc32_slice8(blockData + sent, chunkSize, stripeChecksum);
+                }
+                bytesRead += chunkSize;
+                bytesSent += chunkSize;
+                dfs_log(LL_SYSINFO) << "ServerSide | Bytes uploaded Server to Client: " << bytesRead << "/" << fileSize;
+                swriter->Write(fResponseMsg);
+                wroteAny = true;
+            }
+            engine.ReleaseSlot(block);
+        }
+        if(!readFailed){
+            skipHole(rangeEnd);
+            //A file that is all hole still needs a reply carrying its size
+            if(!wroteAny && !ranged && rangeEnd > 0){
+                fResponseMsg.clear_content();
+                fResponseMsg.set_contentoffset(rangeEnd);
+                swriter->Write(fResponseMsg);
+            }
         }
+        dfs_log(LL_SYSINFO) << "ServerSide | Completed uploading to client file: " << fileName;
 
         //Closing file for good practice
-        file.close();
+        engine.Drain();
+        close(fd);
+        if(fillLength > 0 && fillData.length() == fillLength){
+            contentCache.Insert(fileName, filePath, fileStat, std::move(fillData));
+        }
+        metrics.diskReadTime->Record(DiskTimeUs);
+        metrics.bytesOut->Add(bytesSent);
+        sendSpan.SetArg("disk_us", DiskTimeUs);
+        sendSpan.End();
+
+        if(readFailed){
+            return Status(StatusCode::CANCELLED, "Data transfer issue");
+        }
+
+        //Close the stripe with the checksum of everything sent in it
+        if(ranged){
+            fResponseMsg.clear_content();
+            fResponseMsg.set_stripechecksum(stripeChecksum);
+            fResponseMsg.set_stripeend(true);
+            swriter->Write(fResponseMsg);
+        }
 
         //If there was an issue with writing (streaming) msgs then  end the request
-        if(bytesRead > fileSize){
+        if(bytesRead > rangeEnd){
             dfs_log(LL_ERROR) << "ERROR: ServerSide | Bytes read is not equal to fileSize [Bytes/fileSize]=[" << bytesRead << "/" << fileSize << "] for file: " << fileName;
             return Status(StatusCode::CANCELLED, "Data transfer issue");
         }
@@ -555,7 +910,8 @@ public:
     }
 
 
-    Status fileLister(ServerContext* context, const ::google::protobuf::Empty* request, dfs_service::ListResponse* filesList) override{
+    Status fileLister(ServerContext* context, const dfs_service::ListRequest* request, dfs_service::ListResponse* filesList) override{
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_LIST]);
         //If Query is no longer needed
         if(context->IsCancelled()){
             return Status(StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded ir Client cancelled, prematurely ending request");
@@ -564,59 +920,123 @@ public:
         dfs_log(LL_SYSINFO) << "-----------------------------------------------------------------";
         dfs_log(LL_SYSINFO) << "ServerSide | Accepting Client Request to send a list of files in directory"; 
 
-        //Create directory path to look in. Recreated variable incase I needed to edit the string
-        std::string directoryPath = mount_path;
+        //The listing comes from a snapshot of the index, the names stay valid while it is held
+        DFSNamespaceIndex::Snapshot snapshot = index.Take();
+
+        //A compact listing carries the names and mtimes in columns
+        if(request->compact()){
+            DFSCompactListingBuilder builder(false, false);
+            builder.Reserve(snapshot.Size());
+            snapshot.ForEach([&](const std::string& FileName, const DFSIndexEntry& entry) {
+                builder.Add(FileName, 0, DFSFileVersion::FromStat(entry.st).mtime_ns, 0);
+            });
+            builder.Finish(filesList->mutable_compact());
+            dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to send a compact list of " << filesList->compact().shared_size() << " files";
+            return Status::OK;
+        }
+
+        //Send each file that's a file and not a path
+        snapshot.ForEach([&](const std::string& FileName, const DFSIndexEntry& entry) {
+            const struct stat& FileOrDirectory = entry.st;
+            dfs_service::ListElementResponse* FileInfo = filesList->add_file();
+            FileInfo->set_filename(FileName);
 
-        //Creating Directory to look ing
-        DIR *dr;
-        struct dirent *en;
-        dr = opendir(directoryPath.c_str());
+            //Getting time file was last modified
+            auto mtime = FileOrDirectory.st_mtim;
+            FileInfo->mutable_mtime()->set_seconds(mtime.tv_sec);
+            dfs_log(LL_SYSINFO) << "ServerSide | Found File: " << FileName << " and timestamp: " << FileInfo->mutable_mtime()->seconds(); 
+        });
 
-        //Stat is needed to decide if it's a file or path
-        struct stat FileOrDirectory;
 
-        //Loop through files and paths in current directory
-        while((en = readdir(dr)) != NULL){
-            std::string FileName = en->d_name;
-            std::string CurrentPathNFile = directoryPath+FileName;
+        dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to send a list of files in directory"; 
+        
+        return Status::OK;
+    }
 
-            //Send file if it's a file and not a path
-            if(stat(CurrentPathNFile.c_str(), &FileOrDirectory) == 0 && FileOrDirectory.st_mode & S_IFREG){
-                dfs_service::ListElementResponse* FileInfo = filesList->add_file();
-                FileInfo->set_filename(FileName);
+    Status fileListStream(ServerContext* context, const dfs_service::ListStreamRequest* request, ServerWriter<dfs_service::ListPage>* swriter) override{
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_LIST_STREAM]);
+        size_t pageSize = request->pagesize() > 0 ? std::min<size_t>(request->pagesize(), DFS_LIST_MAX_PAGE) : DFS_LIST_PAGE;
 
-                //Getting time file was last modified
-                auto mtime = FileOrDirectory.st_mtim;
-                FileInfo->mutable_mtime()->set_seconds(mtime.tv_sec);
-                dfs_log(LL_SYSINFO) << "ServerSide | Found File: " << FileName << " and timestamp: " << FileInfo->mutable_mtime()->seconds(); 
-            }
+        dfs_log(LL_SYSINFO) << "-----------------------------------------------------------------";
+        dfs_log(LL_SYSINFO) << "ServerSide | Accepting Client Request to stream a list of files from cursor " << request->cursor();
+
+        //Entries are read a buffer at a time and sent a page at a time, so only one page is held
+        DFSDirectoryReader reader;
+        if(!reader.Open(mount_path, request->cursor())){
+            dfs_log(LL_ERROR) << "ServerSide | Unable to read directory from cursor " << request->cursor() << ": " << strerror(errno);
+            return Status(StatusCode::INVALID_ARGUMENT, "ServerSide | Unable to read directory from this cursor");
         }
-        //Freeing memory 
-        closedir(dr);
 
+        std::vector<std::string> names;
+        std::vector<struct stat> stats;
+        names.reserve(pageSize);
+        stats.reserve(pageSize);
+        bool last = false;
+        uint64_t pages = 0;
+        while(!last){
+            if(context->IsCancelled()){
+                return Status(StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded or Client cancelled, prematurely ending request");
+            }
+            names.clear();
+            stats.clear();
+            const char* name;
+            unsigned char type;
+            struct stat FileOrDirectory;
+            while(names.size() < pageSize){
+                if(!reader.Next(&name, &type)){
+                    last = true;
+                    break;
+                }
+                //Directories are known from the entry type without a stat
+                if(type == DT_DIR || dfs_reserved_name(name) || fstatat(reader.Fd(), name, &FileOrDirectory, 0) != 0 || !S_ISREG(FileOrDirectory.st_mode)){
+                    continue;
+                }
+                names.emplace_back(name);
+                stats.push_back(FileOrDirectory);
+            }
+            if(reader.Failed()){
+                dfs_log(LL_ERROR) << "ServerSide | Reading directory failed: " << strerror(errno);
+                return Status(StatusCode::INTERNAL, "ServerSide | Reading directory failed");
+            }
 
-        dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to send a list of files in directory"; 
-        
+            dfs_service::ListPage page;
+            DFSCompactListingBuilder builder(true, false);
+            builder.Reserve(names.size());
+            for(size_t i = 0; i < names.size(); i++){
+                builder.Add(names[i], stats[i].st_size, DFSFileVersion::FromStat(stats[i]).mtime_ns, 0);
+            }
+            builder.Finish(page.mutable_compact());
+            page.set_cursor(reader.Position());
+            page.set_last(last);
+            if(!swriter->Write(page)){
+                dfs_log(LL_ERROR) << "ServerSide | Client went away while streaming a list of files";
+                return Status(StatusCode::CANCELLED, "ServerSide | Client went away");
+            }
+            pages++;
+        }
+
+        dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to stream a list of files in " << pages << " pages";
         return Status::OK;
     }
 
     Status fileStatuser(ServerContext* context, const dfs_service::StatusRequest* sRequestMsg, dfs_service::StatusResponse* sResponseMsg) override{
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_STATUS]);
+        DFSTraceScope traceScope(DFSTracer::Extract(context));
+        DFSTraceSpan statusSpan("Stat", "server", sRequestMsg->filename());
         //If Query is no longer needed
         if(context->IsCancelled()){
             return Status(StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded ir Client cancelled, prematurely ending request");
         }
 
-        //Creating filePath string
         std::string FileName = sRequestMsg->filename();
-        const std::string& filePath = WrapPath(FileName);
         sResponseMsg->set_filename(FileName);
 
         dfs_log(LL_SYSINFO) << "-----------------------------------------------------------------";
         dfs_log(LL_SYSINFO) << "ServerSide | Accepting Client Request to send status of file: " << FileName;
 
-        //Mostly to keep track of whats going on
-        struct stat fileStat;
-        if(stat(filePath.c_str(), &fileStat) != 0){
+        //Answered from the index without touching the file
+        DFSIndexEntry entry;
+        if(!index.Lookup(FileName, &entry)){
             dfs_log(LL_ERROR) << "ServerSide | The requested file does not exist in the system: " << FileName;
             sResponseMsg->set_fileexists(false);
             sResponseMsg->set_filesize(0);
@@ -628,14 +1048,14 @@ public:
         //Sets if the file was found in directory
         sResponseMsg->set_fileexists(true);
         //Sets the size of the file
-        sResponseMsg->set_filesize(fileStat.st_size);
+        sResponseMsg->set_filesize(entry.st.st_size);
         //Sets the checksum of the file
-        sResponseMsg->set_filechecksum(dfs_file_checksum(filePath, &crc_table));
+        sResponseMsg->set_filechecksum(entry.checksum);
         //Sets when file was last modified
-        auto mtime = fileStat.st_mtim;
+        auto mtime = entry.st.st_mtim;
         sResponseMsg->mutable_mtime()->set_seconds(mtime.tv_sec);
         //Sets when file was created
-        auto ctime = fileStat.st_ctim;
+        auto ctime = entry.st.st_ctim;
         sResponseMsg->mutable_ctime()->set_seconds(ctime.tv_sec);
 
         dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to send status of file: " << FileName;
@@ -644,11 +1064,20 @@ public:
     }
     
     Status fileGetLocker(::grpc::ServerContext* context, const ::dfs_service::GetLockRequest* request, ::google::protobuf::Empty* response){
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_LOCK]);
         std::string ClientID = request->clientid();
         std::string fileName = request->filename();
+        DFSTraceScope traceScope(DFSTracer::Extract(context));
+        DFSTraceSpan lockSpan("GetLock", "server", fileName);
 
         dfs_log(LL_SYSINFO) << "-----------------------------------------------------------------";
 
+        //Every store and delete takes the lock first, so this keeps clients off the server's own files
+        if(dfs_reserved_name(fileName)){
+            dfs_log(LL_ERROR) << "ServerSide | Refusing a lock on a reserved file name: " << fileName;
+            return Status(StatusCode::INVALID_ARGUMENT, "ServerSide | File names starting with " DFS_RESERVED_PREFIX " are reserved");
+        }
+
         bool GotLocker = fileMutex_Request(fileName, ClientID);
         if(!GotLocker){
             return Status(StatusCode::RESOURCE_EXHAUSTED, "ServerSide | File Mutex is unavailable at this time");
@@ -659,59 +1088,112 @@ public:
         return Status(StatusCode::OK, "ServerSide | Lock Operation accepted");
     }
 
-    Status CallbackList(ServerContext* context, const ::dfs_service::CBLRequest* request, ::dfs_service::CBLResponse* response) override {
-        //If Query is no longer needed
+    //Lists every file in the mount with its checksum. Content is not read here,
+    //each reply inlines what its client asked for in RenderListing.
+    void ScanListing(DFSListingSnapshot* snapshot) {
 
         dfs_log(LL_SYSINFO) << "-----------------------------------------------------------------";
-        dfs_log(LL_SYSINFO) << "ServerSide | Accepting Client Request to send call back list of files in directory";
-        dfs_log(LL_SYSINFO) << "Client has not cancelled request";
-
-        //Create directory path to look in. Recreated variable incase I needed to edit the string
-        std::string directoryPath = mount_path;
-
-        //Creating Directory to look ing
-        DIR *dr;
-        struct dirent *en;
-        dr = opendir(directoryPath.c_str());
-
-        //Stat is needed to decide if it's a file or path
-        struct stat FileOrDirectory;
-
-        //Loop through files and paths in current directory
-        while((en = readdir(dr)) != NULL){
-            std::string FileName = en->d_name;
-            std::string CurrentPathNFile = directoryPath+FileName;
+        dfs_log(LL_SYSINFO) << "ServerSide | Listing the index for the call back list of files";
+
+        dfs_service::CBLResponse* response = snapshot->listing;
+        int64_t listingNs = 0;
+
+        //The index already holds the stat and checksum of every file
+        DFSNamespaceIndex::Snapshot files = index.Take();
+        response->mutable_fileinfo()->Reserve(static_cast<int>(files.Size()));
+        snapshot->stats.reserve(files.Size());
+        files.ForEach([&](const std::string& FileName, const DFSIndexEntry& entry) {
+            const struct stat& FileOrDirectory = entry.st;
+            dfs_service::CBLElementResponse* FileInfo = response->add_fileinfo();
+            snapshot->stats.push_back(FileOrDirectory);
+
+            listingNs = std::max(listingNs, DFSFileVersion::FromStat(FileOrDirectory).mtime_ns);
+            
+            //Set file name
+            FileInfo->set_filename(FileName);
+            //Sets the size of the file
+            FileInfo->set_filesize(FileOrDirectory.st_size);
+            //Sets the checksum of the file
+            FileInfo->set_filechecksum(entry.checksum);
+            //Sets when file was last modified
+            auto mtime = FileOrDirectory.st_mtim;
+            FileInfo->mutable_mtime()->set_seconds(mtime.tv_sec);
+            //Sets when file was created
+            auto ctime = FileOrDirectory.st_ctim;
+            FileInfo->mutable_ctime()->set_seconds(ctime.tv_sec);
+
+            dfs_log(LL_SYSINFO) << "ServerSide | Found File: " << FileName << " and timestamp: " << FileInfo->mutable_mtime()->seconds(); 
+        });
+        response->set_listingns(listingNs);
+
+        for(const dfs_service::CBLElementResponse& FileInfo : response->fileinfo()){
+            snapshot->tree.Add({FileInfo.filename(), FileInfo.filesize(), FileInfo.filechecksum(), FileInfo.mtime().seconds()});
+        }
+        snapshot->tree.Seal();
 
-            //Send file if it's a file and not a path
-            if(stat(CurrentPathNFile.c_str(), &FileOrDirectory) == 0 && FileOrDirectory.st_mode & S_IFREG){
-                dfs_service::CBLElementResponse* FileInfo = response->add_fileinfo();
-                
-                //Set file name
-                FileInfo->set_filename(FileName);
-                //Sets the size of the file
-                FileInfo->set_filesize(FileOrDirectory.st_size);
-                //Sets the checksum of the file
-                FileInfo->set_filechecksum(dfs_file_checksum(CurrentPathNFile, &crc_table));
-                //Sets when file was last modified
-                auto mtime = FileOrDirectory.st_mtim;
-                FileInfo->mutable_mtime()->set_seconds(mtime.tv_sec);
-                //Sets when file was created
-                auto ctime = FileOrDirectory.st_ctim;
-                FileInfo->mutable_ctime()->set_seconds(ctime.tv_sec);
+        dfs_log(LL_SYSINFO) << "ServerSide | Completed listing of " << response->fileinfo_size() << " files in the index"; 
+    }
 
-                dfs_log(LL_SYSINFO) << "ServerSide | Found File: " << FileName << " and timestamp: " << FileInfo->mutable_mtime()->seconds(); 
+    //Copies the listing for one client, in the encoding it asked for and
+    //inlining the small files it asked for
+    void RenderListing(const DFSListingSnapshot& snapshot, const dfs_service::CBLRequest& request, dfs_service::CBLResponse* response) {
+
+        //Small files changed since the client's last listing carry their content,
+        //within the threshold and budget the client asked for and the server allows
+        int64_t inlineThreshold = static_cast<int64_t>(std::min<uint64_t>(request.inlinethreshold(), DFS_INLINE_MAX_THRESHOLD));
+        uint64_t inlineBudget = std::min<uint64_t>(request.inlinebudget(), DFS_INLINE_MAX_BUDGET);
+        int64_t inlineSinceNs = request.inlinesincens();
+        uint64_t inlineBytes = 0;
+        auto inlineFile = [&](int i, std::string* content) {
+            const struct stat& FileOrDirectory = snapshot.stats[i];
+            const std::string& FileName = snapshot.listing->fileinfo(i).filename();
+            if(inlineThreshold <= 0 || FileOrDirectory.st_size > inlineThreshold ||
+               DFSFileVersion::FromStat(FileOrDirectory).mtime_ns <= inlineSinceNs || inlineBytes + FileOrDirectory.st_size > inlineBudget){
+                return false;
+            }
+            if(!ReadSmallFile(FileName, WrapPath(FileName), FileOrDirectory, content)){
+                content->clear();
+                return false;
             }
+            inlineBytes += FileOrDirectory.st_size;
+            return true;
+        };
+
+        if(request.compact()){
+            response->set_listingns(snapshot.listing->listingns());
+            response->set_generation(snapshot.listing->generation());
+            DFSCompactListingBuilder builder(true, true);
+            builder.Reserve(snapshot.listing->fileinfo_size());
+            for(int i = 0; i < snapshot.listing->fileinfo_size(); i++){
+                const dfs_service::CBLElementResponse& FileInfo = snapshot.listing->fileinfo(i);
+                builder.Add(FileInfo.filename(), FileInfo.filesize(), DFSFileVersion::FromStat(snapshot.stats[i]).mtime_ns, FileInfo.filechecksum());
+            }
+            std::vector<uint32_t> order;
+            dfs_service::CompactListing* compact = response->mutable_compact();
+            builder.Finish(compact, &order);
+            std::string content;
+            for(uint32_t row = 0; row < order.size(); row++){
+                if(inlineFile(static_cast<int>(order[row]), &content)){
+                    compact->add_inlined(row);
+                    compact->add_content()->swap(content);
+                }
+            }
+            return;
         }
-        //Freeing memory 
-        closedir(dr);//Hmm
-
 
-        dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to send a list of files in directory"; 
-        
-        return Status::OK;
+        *response = *snapshot.listing;
+        for(int i = 0; i < response->fileinfo_size(); i++){
+            dfs_service::CBLElementResponse* FileInfo = response->mutable_fileinfo(i);
+            if(inlineFile(i, FileInfo->mutable_content())){
+                FileInfo->set_inlined(true);
+            }
+        }
     }
 
     Status fileDeleter(ServerContext* context, const dfs_service::DeleteRequest* dRequestMsg, ::google::protobuf::Empty* dResponseMsg) override{        
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_DELETE]);
+        DFSTraceScope traceScope(DFSTracer::Extract(context));
+        DFSTraceSpan deleteSpan("Delete", "server", dRequestMsg->filename());
         //Creating filePath string
         std::string FileName = dRequestMsg->filename();
         const std::string& filePath = WrapPath(FileName);
@@ -746,6 +1228,8 @@ public:
 
         //Trying to delete the file
         int TryDelFile = remove(filePath.c_str());
+        checksums.Invalidate(FileName);
+        FileChanged(FileName);
         if(TryDelFile != 0){
             dfs_log(LL_ERROR) << "Server unable to delete file: " << FileName;
             return Status(StatusCode::CANCELLED, "Server was unable to delete file on system");
@@ -765,19 +1249,19 @@ public:
     //Additional Proto functions:
 
     Status fileCheckSum(ServerContext* context, const dfs_service::CheckSumRequest* request, dfs_service::CheckSumResponse* response) override {
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_CHECKSUM]);
         std::string FileName = request->filename();
         dfs_log(LL_SYSINFO) << "ServerSide | Comparing client and server checksum for " << FileName;
-        std::string filePath = WrapPath(FileName);
         uint32_t ClientCheckSum = request->checkvalue();
         std::string clientID = request->clientid();
 
-        //Mostly to keep track of whats going on
-        struct stat fileStat;
-        if(stat(filePath.c_str(), &fileStat) != 0){
+        //The index keeps the checksum of the current version of the file
+        DFSIndexEntry entry;
+        if(!index.Lookup(FileName, &entry)){
             dfs_log(LL_ERROR) << "ServerSide | Checksum for file, " << FileName <<"does not exist";
             return Status(StatusCode::NOT_FOUND, "Requested Status not found on server"); //TO DO needs to be not found
         }
-        uint32_t ServerCheckSum = dfs_file_checksum(filePath, &crc_table);
+        uint32_t ServerCheckSum = entry.checksum;
         dfs_log(LL_SYSINFO) << "ServerSide | Setting Variables to compare checksum";
         response->set_filename(FileName);
         response->set_checkvalue(ServerCheckSum);
@@ -802,10 +1286,10 @@ public:
     }
 
     Status fileSameTimestamp(::grpc::ServerContext* context, const ::dfs_service::TimeStampRequest* request, ::dfs_service::TimeStampResponse* response){
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_TIMESTAMP]);
         std::string FileName = request->filename();
         dfs_log(LL_SYSINFO) << "ServerSide | Comparing client and server timestamp for " << FileName;
 
-        std::string filePath = WrapPath(FileName);
         time_t fileClient_mTime = request->mtime().seconds();
 
         dfs_log(LL_SYSINFO) << "ServerSide | Last modified on clients system: " << fileClient_mTime;
@@ -813,14 +1297,14 @@ public:
 
 
         //Mostly to keep track of whats going on
-        struct stat fileStat;
-        if(stat(filePath.c_str(), &fileStat) != 0){
+        DFSIndexEntry entry;
+        if(!index.Lookup(FileName, &entry)){
             dfs_log(LL_ERROR) << "ServerSide | Timestamp for file, " << FileName <<"does not exist";
             return Status(StatusCode::NOT_FOUND, "Requested Status not found on server"); //TO DO needs to be not found
         }
 
         //Grabbing when file was last modified
-        time_t fileServer_mTime = (time_t) fileStat.st_mtim.tv_sec;
+        time_t fileServer_mTime = (time_t) entry.st.st_mtim.tv_sec;
         dfs_log(LL_SYSINFO) << "ServerSide | Last modified on server system: " << fileServer_mTime;
 
         if(fileServer_mTime == fileClient_mTime){
@@ -840,7 +1324,188 @@ public:
         return Status(StatusCode::CANCELLED, "ServerSide | Unsure why retrieving timestamp failed");
     }
 
+    Status GetTreeNodes(ServerContext* context, const dfs_service::TreeNodesRequest* request, dfs_service::TreeNodesResponse* response) override {
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_TREE_NODES]);
+        if(request->path_size() > DFS_MERKLE_MAX_NODES){
+            return Status(StatusCode::OUT_OF_RANGE, "ServerSide | Too many tree nodes asked for in one call");
+        }
+
+        //Every node of one call comes from the same listing
+        std::shared_ptr<const DFSListingSnapshot> snapshot = listings.Current();
+        const DFSMerkleTree& tree = snapshot->tree;
+        response->set_generation(snapshot->generation);
+
+        for(const std::string& path : request->path()){
+            uint64_t hash, fileCount;
+            if(!tree.Node(path, &hash, &fileCount)){
+                dfs_log(LL_ERROR) << "ServerSide | Not a tree node: " << path;
+                return Status(StatusCode::INVALID_ARGUMENT, "ServerSide | Not a tree node");
+            }
+            dfs_service::TreeNode* node = response->add_node();
+            node->set_path(path);
+            node->set_hash(hash);
+            node->set_filecount(fileCount);
+
+            //Small subtrees are sent whole, which saves the round trips below them
+            uint64_t children[DFS_MERKLE_FANOUT];
+            if(fileCount > DFS_MERKLE_LEAF_FILES && tree.Children(path, children)){
+                for(uint64_t child : children){
+                    node->add_child(child);
+                }
+                continue;
+            }
+            const DFSMerkleEntry* begin;
+            const DFSMerkleEntry* end;
+            tree.Files(path, &begin, &end);
+            for(const DFSMerkleEntry* entry = begin; entry != end; entry++){
+                dfs_service::TreeFile* file = node->add_file();
+                file->set_filename(entry->name);
+                file->set_filesize(entry->size);
+                file->set_filechecksum(entry->checksum);
+                file->mutable_mtime()->set_seconds(entry->mtime);
+            }
+        }
+
+        dfs_log(LL_SYSINFO) << "ServerSide | Sent " << response->node_size() << " tree nodes of generation " << snapshot->generation;
+        return Status::OK;
+    }
+
+    Status GetMetrics(ServerContext* context, const dfs_service::MetricsRequest* request, dfs_service::MetricsResponse* response) override {
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_METRICS]);
+        RefreshQueueMetrics();
+
+        for(const DFSMetricSnapshot& snapshot : DFSMetricsRegistry::Instance().Snapshot(request->prefix())){
+            dfs_service::MetricValue* metric = response->add_metric();
+            metric->set_name(snapshot.name);
+            metric->set_labels(snapshot.labels);
+            metric->set_type(snapshot.type == DFS_METRIC_COUNTER ? "counter" : (snapshot.type == DFS_METRIC_GAUGE ? "gauge" : "histogram"));
+            metric->set_value(snapshot.value);
+            metric->set_count(snapshot.count);
+            metric->set_sum(snapshot.sum);
+            metric->set_max(snapshot.max);
+            metric->set_p50(snapshot.p50);
+            metric->set_p90(snapshot.p90);
+            metric->set_p99(snapshot.p99);
+            metric->set_p999(snapshot.p999);
+        }
+
+        return Status::OK;
+    }
+
+    Status fileBundleStore(ServerContext* context, ServerReader<dfs_service::BundleStoreRequest>* sreader, dfs_service::BundleStatusResponse* response) override {
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_BUNDLE_STORE]);
+        DFSScopedGauge activeStream(metrics.activeUploads);
+        DFSTraceScope traceScope(DFSTracer::Extract(context));
+        DFSTraceSpan storeSpan("BundleStore", "server", "");
 
+        dfs_service::BundleStoreRequest request;
+        std::string ClientID;
+        std::mutex status_mutex;
+        uint64_t files = 0;
+        {
+            //Records are applied by the workers while the next message is received
+            DFSBundleWorkers workers;
+            while(sreader->Read(&request)){
+                if(ClientID.empty()){
+                    ClientID = request.clientid();
+                    if(ClientID.empty()){
+                        return Status(StatusCode::INVALID_ARGUMENT, "Bundle has no client id");
+                    }
+                }
+                for(dfs_service::BundleRecord& record : *request.mutable_record()){
+                    //Moving the record out of the message hands its content to the worker without a copy
+                    std::shared_ptr<dfs_service::BundleRecord> owned = std::make_shared<dfs_service::BundleRecord>(std::move(record));
+                    workers.Submit([this, owned, &ClientID, &status_mutex, response]{
+                        StatusCode code = StoreBundleRecord(ClientID, *owned);
+                        std::lock_guard<std::mutex> lock(status_mutex);
+                        dfs_service::BundleFileStatus* status = response->add_status();
+                        status->set_filename(owned->filename());
+                        status->set_code(code);
+                    });
+                    files++;
+                }
+            }
+        }
+        metrics.bundleFilesIn->Add(files);
+        storeSpan.SetArg("files", files);
+        dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to store a bundle of " << files << " files";
+
+        return Status::OK;
+    }
+
+    Status fileBundleFetch(ServerContext* context, const dfs_service::BundleFetchRequest* request, ServerWriter<dfs_service::BundleFetchResponse>* swriter) override {
+        DFSScopedTimer rpcTimer(metrics.rpcLatency[RPC_BUNDLE_FETCH]);
+        DFSScopedGauge activeStream(metrics.activeFetches);
+        DFSTraceScope traceScope(DFSTracer::Extract(context));
+        DFSTraceSpan fetchSpan("BundleFetch", "server", "");
+
+        //Workers read up to a window of files ahead, and the files are sent in request order
+        struct BundleSlot {
+            dfs_service::BundleRecord record;
+            StatusCode code = StatusCode::OK;
+            bool done = false;
+        };
+        int count = request->file_size();
+        std::vector<BundleSlot> slots(count);
+        std::mutex slot_mutex;
+        std::condition_variable slot_ready;
+        DFSBundleWorkers workers;
+
+        dfs_service::BundleFetchResponse response;
+        size_t messageBytes = 0;
+        uint64_t bytesSent = 0;
+        uint64_t files = 0;
+        bool writeFailed = false;
+        int submitted = 0;
+        for(int index = 0; index < count && !writeFailed; index++){
+            while(submitted < count && submitted < index + DFS_BUNDLE_WINDOW){
+                int next = submitted++;
+                workers.Submit([this, request, next, &slots, &slot_mutex, &slot_ready]{
+                    StatusCode code = ReadBundleRecord(request->file(next), &slots[next].record);
+                    {
+                        std::lock_guard<std::mutex> lock(slot_mutex);
+                        slots[next].code = code;
+                        slots[next].done = true;
+                    }
+                    slot_ready.notify_all();
+                });
+            }
+            {
+                std::unique_lock<std::mutex> lock(slot_mutex);
+                slot_ready.wait(lock, [&]{ return slots[index].done; });
+            }
+
+            BundleSlot& slot = slots[index];
+            if(slot.code == StatusCode::OK){
+                messageBytes += slot.record.content().length();
+                bytesSent += slot.record.content().length();
+                files++;
+                *response.add_record() = std::move(slot.record);
+            }
+            else{
+                dfs_service::BundleFileStatus* status = response.add_status();
+                status->set_filename(request->file(index).filename());
+                status->set_code(slot.code);
+            }
+            if(messageBytes >= DFS_BUNDLE_MESSAGE_BYTES){
+                writeFailed = context->IsCancelled() || !swriter->Write(response);
+                response.Clear();
+                messageBytes = 0;
+            }
+        }
+        if(!writeFailed && (response.record_size() > 0 || response.status_size() > 0)){
+            writeFailed = !swriter->Write(response);
+        }
+        metrics.bytesOut->Add(bytesSent);
+        metrics.bundleFilesOut->Add(files);
+        fetchSpan.SetArg("files", files);
+
+        if(writeFailed){
+            return Status(StatusCode::CANCELLED, "Data transfer issue");
+        }
+        dfs_log(LL_SYSINFO) << "ServerSide | Completed Client Request to fetch a bundle of " << files << " files";
+        return Status::OK;
+    }
 
 };
 
@@ -853,6 +1518,31 @@ DFSServerNode::DFSServerNode(const std::string &server_address,
         mount_path(mount_path),
         num_async_threads(num_async_threads),
         grader_callback(callback) {}
+
+void DFSServerNode::SetCpuAffinity(bool cpu_affinity) {
+    this->cpu_affinity = cpu_affinity;
+}
+
+void DFSServerNode::SetStatsInterval(int stats_interval) {
+    this->stats_interval = stats_interval;
+}
+
+void DFSServerNode::SetMetricsFile(const std::string& metrics_file, int metrics_interval) {
+    this->metrics_file = metrics_file;
+    this->metrics_interval = metrics_interval;
+}
+
+void DFSServerNode::SetCacheSize(size_t cache_size) {
+    this->cache_size = cache_size;
+}
+
+void DFSServerNode::SetIoEngine(DFSIoKind io_kind) {
+    this->io_kind = io_kind;
+}
+
+void DFSServerNode::SetIndexFile(const std::string& index_file) {
+    this->index_file = index_file;
+}
 /**
  * Server shutdown
  */
@@ -865,6 +1555,12 @@ DFSServerNode::~DFSServerNode() noexcept {
  */
 void DFSServerNode::Start() {
     DFSServiceImpl service(this->mount_path, this->server_address, this->num_async_threads);
+    service.SetCpuAffinity(this->cpu_affinity);
+    service.SetStatsInterval(this->stats_interval);
+    service.SetMetricsFile(this->metrics_file, this->metrics_interval);
+    service.SetCacheSize(this->cache_size);
+    service.SetIoEngine(this->io_kind);
+    service.SetIndexFile(this->index_file);
 
 
     dfs_log(LL_SYSINFO) << "DFSServerNode server listening on " << this->server_address;
@@ -6,6 +6,8 @@
 #include <thread>
 #include <grpcpp/grpcpp.h>
 
+#include "src/dfslibx-io-engine.h"
+
 /**
  * DFSService is used to start up and run your DFSServiceImpl
  * based on the protobuf service you created in 'proto-service.proto'.
@@ -25,6 +27,25 @@ private:
     /** Number of asynchronous threads to use **/
     int num_async_threads;
 
+    /** Pin each async thread to its own CPU **/
+    bool cpu_affinity = false;
+
+    /** How often the completion queue stats are logged in milliseconds (0 disables) **/
+    int stats_interval = 0;
+
+    /** Prometheus text file rewritten every metrics_interval milliseconds (empty disables) **/
+    std::string metrics_file;
+    int metrics_interval = 5000;
+
+    /** Bytes of file contents the fetch cache may hold (0 disables) **/
+    size_t cache_size = 64 << 20;
+
+    /** Disk I/O engine for fetches **/
+    DFSIoKind io_kind = DFS_IO_AUTO;
+
+    /** Where the namespace index is kept across restarts (empty keeps it in the mount) **/
+    std::string index_file;
+
     /** Server callback **/
     std::function<void()> grader_callback;
 
@@ -35,6 +56,12 @@ public:
         std::function<void()> callback);
     ~DFSServerNode();
     void Shutdown();
+    void SetCpuAffinity(bool cpu_affinity);
+    void SetStatsInterval(int stats_interval);
+    void SetMetricsFile(const std::string& metrics_file, int metrics_interval);
+    void SetCacheSize(size_t cache_size);
+    void SetIoEngine(DFSIoKind io_kind);
+    void SetIndexFile(const std::string& index_file);
     void Start();
 };
 
@@ -20,6 +20,10 @@
 #define DFS_I_EVENT_SIZE (sizeof(struct inotify_event))
 #define DFS_I_BUFFER_SIZE (1024 * (DFS_I_EVENT_SIZE + 16))
 
+/** Files in one page of fileListStream by default, and the most a page may hold **/
+#define DFS_LIST_PAGE 1000
+#define DFS_LIST_MAX_PAGE 10000
+
 /** An inotify callback method **/
 typedef void (*InotifyCallback)(uint, const std::string&, void*);;
 
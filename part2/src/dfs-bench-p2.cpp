@@ -0,0 +1,348 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <getopt.h>
+#include <unistd.h>
+#include <grpcpp/grpcpp.h>
+
+#include "dfs-utils.h"
+#include "dfs-bench-utils.h"
+#include "dfslibx-metrics.h"
+#include "../dfslib-shared-p2.h"
+#include "../dfslib-clientnode-p2.h"
+
+/**
+ * End-to-end Store/Stat/Fetch/List/Delete benchmark.
+ *
+ * A DFSServerNode runs inside this process on a loopback port and every
+ * worker drives its own DFSClientNodeP2 (own client id, mount directory
+ * and channel) against it. For each (file size, concurrency) cell the
+ * workers run the operations in lock step, so each operation's wall time
+ * covers all workers, and per call latencies go into a histogram.
+ *
+ * With --probe_ms, a probe thread also calls Stat through the first
+ * client's connections while Store and Fetch are running, and reports
+ * those latencies as the stat_during_transfer operation. Together with
+ * --bulk_lanes this shows how much large transfers delay control calls.
+ *
+ * With --sparse the files are mostly holes, so sizes past 4G can be run
+ * without writing gigabytes of source data, and every stored and fetched
+ * copy is checked byte for byte. A copy that does not match counts as an
+ * error of the operation that made it.
+ */
+
+enum dfs_bench_op_e {BENCH_STORE, BENCH_STAT, BENCH_FETCH, BENCH_LIST, BENCH_DELETE, BENCH_OP_COUNT};
+
+static const char* const bench_op_names[BENCH_OP_COUNT] = {"store", "stat", "fetch", "list", "delete"};
+
+void Usage() {
+    std::cout <<
+        "\nUSAGE: dfs-bench-p2 [OPTIONS]\n"
+        "-a, --address <address>:        Loopback address for the in-process server (default: 127.0.0.1:36901)\n"
+        "-w, --work_dir <path>:          Directory for the server and client mounts (default: /tmp/dfs-bench-<pid>)\n"
+        "-s, --sizes <list>:             File sizes to test (default: 1K,64K,1M,16M,256M,4G)\n"
+        "-c, --concurrency <list>:       Numbers of concurrent clients to test (default: 1,4,16,64,256)\n"
+        "-r, --repeat <num>:             Store/Stat/Fetch/List/Delete rounds per client in each cell (default: 3)\n"
+        "-B, --max_cell_bytes <size>:    Skip cells where size * concurrency exceeds this (default: 4G)\n"
+        "-n, --num_async_threads <num>:  Server asynchronous threads (default: 4)\n"
+        "-t, --timeout <ms>:             Per call deadline (default: 600000)\n"
+        "-f, --format <csv|json>:        Output format (default: csv)\n"
+        "-o, --output <path>:            Write results to <path> instead of stdout\n"
+        "-L, --bulk_lanes <num>:         Give each client a channel pool with this many bulk lanes (default: -1 = one channel)\n"
+        "-p, --probe_ms <ms>:            Time a Stat every <ms> while transfers run (default: 0 = off)\n"
+        "-x, --sparse:                   Use sparse files and check every stored and fetched copy\n"
+        "-d, --debug_level <level>:      Show server and client logs at this level (default: logs are discarded)\n"
+        "-h, --help:                     Show help\n\n";
+    exit(1);
+}
+
+/**
+ * Run one (file size, concurrency) cell and append a result per operation
+ */
+static void RunCell(const std::string& server_address, const std::string& work_dir, uint64_t file_size,
+                    int concurrency, int repeat, int deadline_timeout, int bulk_lanes, int probe_ms,
+                    bool sparse, std::vector<DFSBenchResult>& results) {
+
+    std::vector<std::unique_ptr<DFSClientNodeP2>> clients;
+    std::vector<std::string> filenames;
+    std::string server_path = dfs_clean_path(work_dir + "/server");
+    for (int i = 0; i < concurrency; i++) {
+        std::string mount_path = dfs_clean_path(work_dir + "/client-" + std::to_string(i));
+        dfs_bench_mkdirs(mount_path);
+
+        grpc::ChannelArguments channel_args;
+        channel_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        std::unique_ptr<DFSClientNodeP2> client(new DFSClientNodeP2());
+        client->SetMountPath(mount_path);
+        client->SetClientId("bench-" + std::to_string(i));
+        client->SetDeadlineTimeout(deadline_timeout);
+        if (bulk_lanes >= 0) {
+            client->SetChannelPool(std::make_shared<DFSChannelPool>(server_address, bulk_lanes));
+        } else {
+            client->CreateStub(grpc::CreateCustomChannel(server_address, grpc::InsecureChannelCredentials(), channel_args));
+        }
+
+        std::string filename = "bench-" + dfs_bench_format_size(file_size) + "-" + std::to_string(i) + ".bin";
+        uint64_t seed = file_size ^ static_cast<uint64_t>(i);
+        bool created = sparse ? dfs_bench_make_sparse_file(mount_path + filename, file_size, seed)
+                              : dfs_bench_make_file(mount_path + filename, file_size, seed);
+        if (!created) {
+            std::cerr << "Unable to create " << mount_path + filename << std::endl;
+            exit(1);
+        }
+        clients.push_back(std::move(client));
+        filenames.push_back(filename);
+    }
+
+    std::unique_ptr<DFSHistogram> latency[BENCH_OP_COUNT];
+    std::atomic<uint64_t> errors[BENCH_OP_COUNT];
+    uint64_t wall_us[BENCH_OP_COUNT] = {0};
+    for (int op = 0; op < BENCH_OP_COUNT; op++) {
+        latency[op].reset(new DFSHistogram());
+        errors[op].store(0);
+    }
+
+    // Stat calls timed only while a transfer is running
+    DFSHistogram probe_latency;
+    std::atomic<bool> transferring{false};
+    std::atomic<bool> finished{false};
+    std::thread probe;
+    if (probe_ms > 0) {
+        probe = std::thread([&]() {
+            while (!finished) {
+                if (transferring) {
+                    auto start = std::chrono::steady_clock::now();
+                    clients[0]->Stat(filenames[0]);
+                    if (transferring) { probe_latency.Record(dfs_bench_elapsed_us(start)); }
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(probe_ms));
+            }
+        });
+    }
+
+    // Workers and the coordinator meet before and after every operation
+    DFSBenchBarrier barrier(concurrency + 1);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < concurrency; i++) {
+        workers.emplace_back([&, i]() {
+            DFSClientNodeP2& client = *clients[i];
+            const std::string& filename = filenames[i];
+            for (int round = 0; round < repeat; round++) {
+                for (int op = 0; op < BENCH_OP_COUNT; op++) {
+                    barrier.Wait();
+                    if (op == BENCH_FETCH) {
+                        // Fetch skips the transfer when the local copy matches
+                        unlink((client.MountPath() + filename).c_str());
+                    }
+                    std::map<std::string,int> file_map;
+                    auto start = std::chrono::steady_clock::now();
+                    grpc::StatusCode status = grpc::StatusCode::OK;
+                    switch (op) {
+                        case BENCH_STORE: status = client.Store(filename); break;
+                        case BENCH_STAT: status = client.Stat(filename); break;
+                        case BENCH_FETCH: status = client.Fetch(filename); break;
+                        case BENCH_LIST: status = client.List(&file_map, false); break;
+                        case BENCH_DELETE: status = client.Delete(filename); break;
+                    }
+                    latency[op]->Record(dfs_bench_elapsed_us(start));
+                    if (status != grpc::StatusCode::OK) { errors[op]++; }
+                    barrier.Wait();
+                    // Checked outside the timed section, before the next operation starts
+                    if (sparse && status == grpc::StatusCode::OK && (op == BENCH_STORE || op == BENCH_FETCH)) {
+                        const std::string& copy = op == BENCH_STORE ? server_path + filename : client.MountPath() + filename;
+                        if (!dfs_bench_check_sparse_file(copy, file_size, file_size ^ static_cast<uint64_t>(i))) {
+                            errors[op]++;
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < repeat; round++) {
+        for (int op = 0; op < BENCH_OP_COUNT; op++) {
+            barrier.Wait();
+            auto start = std::chrono::steady_clock::now();
+            transferring = op == BENCH_STORE || op == BENCH_FETCH;
+            barrier.Wait();
+            transferring = false;
+            wall_us[op] += dfs_bench_elapsed_us(start);
+        }
+    }
+    for (std::thread& worker : workers) { worker.join(); }
+    finished = true;
+    if (probe.joinable()) { probe.join(); }
+
+    for (int op = 0; op < BENCH_OP_COUNT; op++) {
+        DFSBenchResult result;
+        result.operation = bench_op_names[op];
+        result.file_size = file_size;
+        result.concurrency = concurrency;
+        result.errors = errors[op].load();
+        result.wall_us = wall_us[op];
+        result.FromHistogram(*latency[op]);
+        bool transfers = op == BENCH_STORE || op == BENCH_FETCH;
+        result.bytes = transfers ? (result.count - result.errors) * file_size : 0;
+        results.push_back(result);
+    }
+    if (probe_ms > 0) {
+        DFSBenchResult result;
+        result.operation = "stat_during_transfer";
+        result.file_size = file_size;
+        result.concurrency = concurrency;
+        result.errors = 0;
+        result.bytes = 0;
+        result.wall_us = 0;
+        result.FromHistogram(probe_latency);
+        results.push_back(result);
+    }
+
+    for (int i = 0; i < concurrency; i++) {
+        unlink((clients[i]->MountPath() + filenames[i]).c_str());
+    }
+}
+
+int main(int argc, char** argv) {
+
+    const char* const short_opts = "a:w:s:c:r:B:n:t:f:o:L:p:xd:h";
+
+    const option long_opts[] = {
+        {"address", optional_argument, nullptr, 'a'},
+        {"work_dir", optional_argument, nullptr, 'w'},
+        {"sizes", optional_argument, nullptr, 's'},
+        {"concurrency", optional_argument, nullptr, 'c'},
+        {"repeat", optional_argument, nullptr, 'r'},
+        {"max_cell_bytes", optional_argument, nullptr, 'B'},
+        {"num_async_threads", optional_argument, nullptr, 'n'},
+        {"timeout", optional_argument, nullptr, 't'},
+        {"format", optional_argument, nullptr, 'f'},
+        {"output", optional_argument, nullptr, 'o'},
+        {"bulk_lanes", optional_argument, nullptr, 'L'},
+        {"probe_ms", optional_argument, nullptr, 'p'},
+        {"sparse", no_argument, nullptr, 'x'},
+        {"debug_level", optional_argument, nullptr, 'd'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, no_argument, nullptr, 0}
+    };
+
+    char option_char;
+    int debug_level = -1;
+    int repeat = 3;
+    int num_async_threads = 4;
+    int deadline_timeout = 600000;
+    int bulk_lanes = -1;
+    int probe_ms = 0;
+    bool sparse = false;
+    uint64_t max_cell_bytes = 4ULL << 30;
+    std::string format = "csv";
+    std::string output_path = "";
+    std::string sizes = "1K,64K,1M,16M,256M,4G";
+    std::string concurrency = "1,4,16,64,256";
+    std::string work_dir = "/tmp/dfs-bench-" + std::to_string(getpid());
+    std::string server_address = "127.0.0.1:36901";
+
+    while((option_char = getopt_long(argc, argv, short_opts, long_opts, nullptr)) != -1) {
+        switch(option_char) {
+            case 'a':
+                server_address = std::string(optarg);
+                break;
+            case 'w':
+                work_dir = std::string(optarg);
+                break;
+            case 's':
+                sizes = std::string(optarg);
+                break;
+            case 'c':
+                concurrency = std::string(optarg);
+                break;
+            case 'r':
+                repeat = std::stoi(optarg);
+                break;
+            case 'B':
+                max_cell_bytes = dfs_bench_parse_size(optarg);
+                break;
+            case 'n':
+                num_async_threads = std::stoi(optarg);
+                break;
+            case 't':
+                deadline_timeout = std::stoi(optarg);
+                break;
+            case 'f':
+                format = std::string(optarg);
+                break;
+            case 'o':
+                output_path = std::string(optarg);
+                break;
+            case 'L':
+                bulk_lanes = std::stoi(optarg);
+                break;
+            case 'p':
+                probe_ms = std::stoi(optarg);
+                break;
+            case 'x':
+                sparse = true;
+                break;
+            case 'd':
+                debug_level = std::stoi(optarg);
+                break;
+            case 'h':
+            case '?':
+            default:
+                Usage();
+                break;
+        }
+    }
+
+    if (format != "csv" && format != "json") {
+        Usage();
+    }
+
+    // SYSINFO lines are logged for every call, keep them out of the measurements
+    FILE* null_output = nullptr;
+    if (debug_level < 0) {
+        null_output = fopen("/dev/null", "w");
+        dfs_log_set_output(null_output);
+    }
+    else if (debug_level > 0 && debug_level <= 3) {
+        DFS_LOG_LEVEL = static_cast<dfs_log_level_e>(debug_level + 1);
+    }
+
+    FILE* output = stdout;
+    if (!output_path.empty() && (output = fopen(output_path.c_str(), "w")) == nullptr) {
+        std::cerr << "Unable to open " << output_path << std::endl;
+        return 1;
+    }
+
+    if (!dfs_bench_start_server(server_address, dfs_clean_path(work_dir + "/server"), num_async_threads)) {
+        std::cerr << "Server did not start on " << server_address << std::endl;
+        return 1;
+    }
+
+    std::vector<DFSBenchResult> results;
+    for (const std::string& size_text : dfs_bench_split(sizes)) {
+        uint64_t file_size = dfs_bench_parse_size(size_text);
+        for (const std::string& concurrency_text : dfs_bench_split(concurrency)) {
+            int clients = std::stoi(concurrency_text);
+            if (file_size * static_cast<uint64_t>(clients) > max_cell_bytes) {
+                std::cerr << "Skipping " << size_text << " x " << clients
+                          << ": exceeds --max_cell_bytes " << dfs_bench_format_size(max_cell_bytes) << std::endl;
+                continue;
+            }
+            std::cerr << "Running " << size_text << " x " << clients << std::endl;
+            RunCell(server_address, work_dir, file_size, clients, repeat, deadline_timeout, bulk_lanes, probe_ms, sparse, results);
+        }
+    }
+
+    dfs_bench_write_results(output, results, format == "json");
+    if (output != stdout) { fclose(output); }
+
+    // The server thread runs until the process exits
+    dfs_log_flush();
+    _exit(0);
+}
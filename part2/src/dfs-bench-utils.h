@@ -0,0 +1,364 @@
+#ifndef PR4_DFS_BENCH_UTILS_H
+#define PR4_DFS_BENCH_UTILS_H
+
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <condition_variable>
+#include <grpcpp/grpcpp.h>
+
+#include "dfs-utils.h"
+#include "dfslibx-metrics.h"
+#include "../dfslib-servernode-p2.h"
+
+/**
+ * Helpers shared by the benchmark and load tools. None of them are
+ * linked into the client or server binaries.
+ */
+
+/**
+ * Parse a byte size such as 1024, 64K, 16M or 4G
+ */
+inline uint64_t dfs_bench_parse_size(const std::string& text) {
+    char* end = nullptr;
+    uint64_t value = std::strtoull(text.c_str(), &end, 10);
+    switch (end != nullptr ? *end : '\0') {
+        case 'k': case 'K': return value << 10;
+        case 'm': case 'M': return value << 20;
+        case 'g': case 'G': return value << 30;
+        default: return value;
+    }
+}
+
+/**
+ * Format a byte size the way dfs_bench_parse_size reads it
+ */
+inline std::string dfs_bench_format_size(uint64_t size) {
+    if (size >= (1ULL << 30) && size % (1ULL << 30) == 0) { return std::to_string(size >> 30) + "G"; }
+    if (size >= (1ULL << 20) && size % (1ULL << 20) == 0) { return std::to_string(size >> 20) + "M"; }
+    if (size >= (1ULL << 10) && size % (1ULL << 10) == 0) { return std::to_string(size >> 10) + "K"; }
+    return std::to_string(size);
+}
+
+/**
+ * Split a comma separated list, e.g. "1K,64K,1M"
+ */
+inline std::vector<std::string> dfs_bench_split(const std::string& text) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= text.length()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) { end = text.length(); }
+        if (end > start) { parts.push_back(text.substr(start, end - start)); }
+        start = end + 1;
+    }
+    return parts;
+}
+
+/**
+ * Write size bytes of pseudo random data to path
+ *
+ * @return true if the whole file was written
+ */
+inline bool dfs_bench_make_file(const std::string& path, uint64_t size, uint64_t seed) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { return false; }
+    std::mt19937_64 generator(seed);
+    std::vector<uint64_t> block(1 << 17);
+    uint64_t written = 0;
+    while (written < size) {
+        for (uint64_t& word : block) { word = generator(); }
+        size_t length = static_cast<size_t>(std::min<uint64_t>(size - written, block.size() * sizeof(uint64_t)));
+        ssize_t result = write(fd, block.data(), length);
+        if (result <= 0) { close(fd); return false; }
+        written += static_cast<uint64_t>(result);
+    }
+    close(fd);
+    return true;
+}
+
+/** Distance between the data blocks of a sparse bench file **/
+#define DFS_BENCH_SPARSE_STRIDE (64ULL << 20)
+
+/** Bytes of data at each block of a sparse bench file **/
+#define DFS_BENCH_SPARSE_BLOCK 4096
+
+/**
+ * The pseudo random block a sparse bench file holds at offset
+ */
+inline void dfs_bench_sparse_block(uint64_t offset, uint64_t seed, std::vector<uint64_t>& block) {
+    std::mt19937_64 generator(seed ^ offset);
+    block.resize(DFS_BENCH_SPARSE_BLOCK / sizeof(uint64_t));
+    for (uint64_t& word : block) { word = generator(); }
+}
+
+/**
+ * Offsets of the data blocks of a sparse bench file, in the order they are
+ * written: one every DFS_BENCH_SPARSE_STRIDE bytes, then one ending the file
+ */
+inline std::vector<uint64_t> dfs_bench_sparse_offsets(uint64_t size) {
+    std::vector<uint64_t> offsets;
+    for (uint64_t offset = 0; offset < size; offset += DFS_BENCH_SPARSE_STRIDE) {
+        offsets.push_back(offset);
+    }
+    if (size > DFS_BENCH_SPARSE_BLOCK) {
+        offsets.push_back(size - DFS_BENCH_SPARSE_BLOCK);
+    }
+    return offsets;
+}
+
+/**
+ * Create a sparse file of size bytes that is mostly holes, with a block of
+ * pseudo random data every DFS_BENCH_SPARSE_STRIDE bytes and at the end.
+ * A multi-GB file takes a few MB of disk but still has data past 4G.
+ *
+ * @return true if the whole file was written
+ */
+inline bool dfs_bench_make_sparse_file(const std::string& path, uint64_t size, uint64_t seed) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { return false; }
+    bool written = ftruncate(fd, static_cast<off_t>(size)) == 0;
+    std::vector<uint64_t> block;
+    for (uint64_t offset : dfs_bench_sparse_offsets(size)) {
+        if (!written) { break; }
+        dfs_bench_sparse_block(offset, seed, block);
+        size_t length = static_cast<size_t>(std::min<uint64_t>(size - offset, DFS_BENCH_SPARSE_BLOCK));
+        written = dfs_pwrite_fully(fd, reinterpret_cast<const char*>(block.data()), length, static_cast<off_t>(offset));
+    }
+    return close(fd) == 0 && written;
+}
+
+/**
+ * Check that path holds exactly what dfs_bench_make_sparse_file wrote
+ */
+inline bool dfs_bench_check_sparse_file(const std::string& path, uint64_t size, uint64_t seed) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_size) != size) { return false; }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+
+    // Holes read back as zeros, so everything outside the blocks must be zero
+    std::vector<char> expected(1 << 20);
+    std::vector<char> actual(expected.size());
+    std::vector<uint64_t> offsets = dfs_bench_sparse_offsets(size);
+    std::vector<uint64_t> block;
+    bool matches = true;
+    for (uint64_t start = 0; start < size && matches; start += expected.size()) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(size - start, expected.size()));
+        std::fill(expected.begin(), expected.begin() + length, 0);
+        for (uint64_t offset : offsets) {
+            uint64_t end = std::min<uint64_t>(offset + DFS_BENCH_SPARSE_BLOCK, size);
+            if (end <= start || offset >= start + length) { continue; }
+            dfs_bench_sparse_block(offset, seed, block);
+            uint64_t from = std::max(offset, start);
+            uint64_t to = std::min<uint64_t>(end, start + length);
+            memcpy(expected.data() + (from - start), reinterpret_cast<char*>(block.data()) + (from - offset), to - from);
+        }
+        size_t done = 0;
+        while (done < length) {
+            ssize_t result = pread(fd, actual.data() + done, length - done, static_cast<off_t>(start + done));
+            if (result <= 0) { break; }
+            done += static_cast<size_t>(result);
+        }
+        matches = done == length && memcmp(expected.data(), actual.data(), length) == 0;
+    }
+    close(fd);
+    return matches;
+}
+
+/**
+ * Create a directory and its parents
+ */
+inline void dfs_bench_mkdirs(const std::string& path) {
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        mkdir(path.substr(0, pos).c_str(), 0755);
+        if (pos == std::string::npos) { break; }
+    }
+}
+
+/**
+ * Microseconds elapsed since start
+ */
+inline uint64_t dfs_bench_elapsed_us(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+/**
+ * Start a DFSServerNode on a detached thread of this process and wait
+ * until it accepts connections on server_address
+ *
+ * @return true if the server answered within timeout_ms
+ */
+inline bool dfs_bench_start_server(const std::string& server_address, const std::string& mount_path,
+                                   int num_async_threads, int timeout_ms = 10000) {
+    dfs_bench_mkdirs(mount_path);
+    std::thread server_thread([=]() {
+        DFSServerNode node(server_address, mount_path, num_async_threads, []() {});
+        node.Start();
+    });
+    server_thread.detach();
+
+    std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials());
+    return channel->WaitForConnected(std::chrono::system_clock::now() + std::chrono::milliseconds(timeout_ms));
+}
+
+/**
+ * Start the dfs-server-p2 binary as a child process with its output in log_path
+ *
+ * @return the child pid, or -1 if it could not be started
+ */
+inline pid_t dfs_bench_spawn_server(const std::string& server_bin, const std::string& server_address,
+                                    const std::string& mount_path, int num_async_threads,
+                                    const std::string& log_path) {
+    dfs_bench_mkdirs(mount_path);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int log_fd = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log_fd >= 0) {
+            dup2(log_fd, STDOUT_FILENO);
+            dup2(log_fd, STDERR_FILENO);
+            close(log_fd);
+        }
+        std::string threads = std::to_string(num_async_threads);
+        execl(server_bin.c_str(), server_bin.c_str(), "-a", server_address.c_str(), "-m", mount_path.c_str(),
+              "-n", threads.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * User plus system CPU time used so far by a process, from /proc/<pid>/stat
+ *
+ * @return seconds, or a negative value if the process is gone
+ */
+inline double dfs_bench_process_cpu_seconds(pid_t pid) {
+    std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+    std::string contents;
+    if (!std::getline(stat_file, contents)) { return -1.0; }
+
+    // The command name may contain spaces, the fields start after its closing paren
+    size_t paren = contents.rfind(')');
+    if (paren == std::string::npos) { return -1.0; }
+    std::istringstream fields(contents.substr(paren + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++) {
+        if (i == 14) { utime = std::stoull(field); }
+        if (i == 15) { stime = std::stoull(field); }
+    }
+    return static_cast<double>(utime + stime) / static_cast<double>(sysconf(_SC_CLK_TCK));
+}
+
+/**
+ * Reusable barrier so every worker starts a phase together
+ */
+class DFSBenchBarrier {
+private:
+    std::mutex barrier_mutex;
+    std::condition_variable barrier_cv;
+    int parties;
+    int waiting = 0;
+    uint64_t generation = 0;
+
+public:
+    explicit DFSBenchBarrier(int parties) : parties(parties) {}
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(barrier_mutex);
+        uint64_t arrived = generation;
+        if (++waiting == parties) {
+            waiting = 0;
+            generation++;
+            barrier_cv.notify_all();
+            return;
+        }
+        barrier_cv.wait(lock, [&]() { return generation != arrived; });
+    }
+};
+
+/**
+ * One line of benchmark output
+ */
+struct DFSBenchResult {
+    std::string operation;
+    uint64_t file_size;
+    int concurrency;
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t wall_us;
+    uint64_t p50_us;
+    uint64_t p99_us;
+    uint64_t p999_us;
+    uint64_t max_us;
+
+    double MBPerSecond() const {
+        return wall_us == 0 ? 0.0 : (static_cast<double>(bytes) / (1 << 20)) / (static_cast<double>(wall_us) / 1e6);
+    }
+
+    double OpsPerSecond() const {
+        return wall_us == 0 ? 0.0 : static_cast<double>(count) / (static_cast<double>(wall_us) / 1e6);
+    }
+
+    void FromHistogram(const DFSHistogram& histogram) {
+        count = histogram.Count();
+        p50_us = histogram.Percentile(0.50);
+        p99_us = histogram.Percentile(0.99);
+        p999_us = histogram.Percentile(0.999);
+        max_us = histogram.Max();
+    }
+};
+
+/**
+ * Write results as CSV (with a header line) or as a JSON array
+ */
+inline void dfs_bench_write_results(FILE* output, const std::vector<DFSBenchResult>& results, bool json) {
+    if (!json) {
+        fprintf(output, "operation,file_size,concurrency,count,errors,bytes,wall_us,mb_per_s,ops_per_s,p50_us,p99_us,p999_us,max_us\n");
+    }
+    else {
+        fprintf(output, "[\n");
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        const DFSBenchResult& r = results[i];
+        if (!json) {
+            fprintf(output, "%s,%llu,%d,%llu,%llu,%llu,%llu,%.2f,%.1f,%llu,%llu,%llu,%llu\n",
+                    r.operation.c_str(), (unsigned long long) r.file_size, r.concurrency,
+                    (unsigned long long) r.count, (unsigned long long) r.errors, (unsigned long long) r.bytes,
+                    (unsigned long long) r.wall_us, r.MBPerSecond(), r.OpsPerSecond(),
+                    (unsigned long long) r.p50_us, (unsigned long long) r.p99_us,
+                    (unsigned long long) r.p999_us, (unsigned long long) r.max_us);
+        }
+        else {
+            fprintf(output, "  {\"operation\": \"%s\", \"file_size\": %llu, \"concurrency\": %d, \"count\": %llu, "
+                    "\"errors\": %llu, \"bytes\": %llu, \"wall_us\": %llu, \"mb_per_s\": %.2f, \"ops_per_s\": %.1f, "
+                    "\"p50_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %llu}%s\n",
+                    r.operation.c_str(), (unsigned long long) r.file_size, r.concurrency,
+                    (unsigned long long) r.count, (unsigned long long) r.errors, (unsigned long long) r.bytes,
+                    (unsigned long long) r.wall_us, r.MBPerSecond(), r.OpsPerSecond(),
+                    (unsigned long long) r.p50_us, (unsigned long long) r.p99_us,
+                    (unsigned long long) r.p999_us, (unsigned long long) r.max_us,
+                    i + 1 < results.size() ? "," : "");
+        }
+    }
+    if (json) {
+        fprintf(output, "]\n");
+    }
+    fflush(output);
+}
+
+#endif //PR4_DFS_BENCH_UTILS_H
@@ -17,6 +17,7 @@
 #include "dfs-utils.h"
 #include "dfs-client-p2.h"
 #include "dfslibx-clientnode-p2.h"
+#include "dfslibx-trace.h"
 #include "../dfslib-shared-p2.h"
 #include "../dfslib-clientnode-p2.h"
 
@@ -52,6 +53,15 @@ void DFSClient::ProcessCommand(const std::string &command, const std::string &fi
 
         client_node.Stat(filename);
 
+    } else if (command == "sync") {
+
+        client_node.RemoveStaleParts();
+        client_node.Sync(true);
+
+    } else if (command == "metrics") {
+
+        client_node.Metrics(filename, NULL, true);
+
     } else {
 
         dfs_log(LL_ERROR) << "Invalid command";
@@ -61,7 +71,8 @@ void DFSClient::ProcessCommand(const std::string &command, const std::string &fi
 }
 
 void DFSClient::InitializeClientNode(const std::string &server_address) {
-    this->client_node.CreateStub(grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials()));
+    //Locks, Stat and the callback list get a connection of their own, apart from file data
+    this->client_node.SetChannelPool(std::make_shared<DFSChannelPool>(server_address, this->bulk_lanes));
 }
 
 void DFSClient::SetMountPath(const std::string &path) {
@@ -74,6 +85,26 @@ void DFSClient::SetDeadlineTimeout(int deadline) {
     this->client_node.SetDeadlineTimeout(deadline);
 }
 
+void DFSClient::SetStriping(size_t stripe_size, int stripe_streams) {
+    this->client_node.SetStriping(stripe_size, stripe_streams);
+}
+
+void DFSClient::SetBundling(size_t bundle_threshold) {
+    this->client_node.SetBundling(bundle_threshold);
+}
+
+void DFSClient::SetInlining(size_t inline_threshold) {
+    this->client_node.SetInlining(inline_threshold);
+}
+
+void DFSClient::SetCompactListings(bool compact_listings) {
+    this->client_node.SetCompactListings(compact_listings);
+}
+
+void DFSClient::SetBulkLanes(int bulk_lanes) {
+    this->bulk_lanes = bulk_lanes > 0 ? bulk_lanes : 0;
+}
+
 void DFSClient::Mount(const std::string &filepath) {
 
     this->mount_path = filepath;
@@ -82,6 +113,7 @@ void DFSClient::Mount(const std::string &filepath) {
     }
 
     dfs_log(LL_SYSINFO) << "Mounting on " << this->mount_path;
+    this->client_node.RemoveStaleParts();
 
     std::vector <std::thread> threads;
     //    uint event_flags = IN_CLOSE_WRITE | IN_OPEN;
@@ -241,32 +273,55 @@ void Usage() {
         "-d, --debug_level <level>:  The debug level to use: 0, 1, 2, 3 (default: 0 = no debug, higher numbers increase verbosity)\n"
         "-m, --mount_path <path>:  The mount path this client attaches to\n"
         "-t, --deadline_timeout <int>:  The deadline timeout in milliseconds (default: 10000)\n"
+        "-T, --trace_file <path>:  Record request phase spans and write them as Chrome trace JSON to <path> on exit\n"
+        "-S, --stripe_size <MB>:   Fetch files larger than this as parallel stripes of this size (default: 16, 0 = off)\n"
+        "-j, --stripe_streams <num>:  Streams fetching stripes at the same time (default: 4)\n"
+        "-B, --bulk_lanes <num>:   Connections for file transfers, besides the one for locks, stat and list (default: 1, 0 = share one connection)\n"
+        "-b, --bundle_size <KB>:   Sync files up to this size in bundles of many files per stream (default: 64, 0 = off)\n"
+        "-i, --inline_size <KB>:   Take changed files up to this size inlined in the change listing (default: 4, 0 = off)\n"
+        "-l, --listing <format>:   Encoding asked for in file listings: compact or full (default: compact)\n"
         "-h, --help:               Show help\n"
         "\n"
-        "COMMAND is one of mount|fetch|store|delete|list|stat.\n"
-        "FILENAME is the filename to fetch, store, delete, or stat. The mount and list commands do not require a filename.\n\n";
+        "COMMAND is one of mount|fetch|store|delete|list|stat|sync|metrics.\n"
+        "FILENAME is the filename to fetch, store, delete, or stat. The mount, list and sync commands do not require a filename.\n"
+        "sync compares Merkle trees of the mount and the server, then stores or fetches the files that differ.\n"
+        "For metrics, FILENAME is an optional metric name prefix.\n\n";
     exit(1);
 }
 
 int main(int argc, char** argv) {
 
-    const char* const short_opts = "a:d:m:r:t:h";
+    const char* const short_opts = "a:d:m:r:t:T:S:j:B:b:i:l:h";
 
     const option long_opts[] = {
         {"address", optional_argument, nullptr, 'a'},
         {"deadline_timeout", optional_argument, nullptr, 't'},
         {"mount_path", optional_argument, nullptr, 'm'},
         {"debug_level", optional_argument, nullptr, 'd'},
+        {"trace_file", optional_argument, nullptr, 'T'},
+        {"stripe_size", optional_argument, nullptr, 'S'},
+        {"stripe_streams", optional_argument, nullptr, 'j'},
+        {"bulk_lanes", optional_argument, nullptr, 'B'},
+        {"bundle_size", optional_argument, nullptr, 'b'},
+        {"inline_size", optional_argument, nullptr, 'i'},
+        {"listing", optional_argument, nullptr, 'l'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, no_argument, nullptr, 0}
     };
 
     char option_char;
     int deadline_timeout = 10000;
+    long stripe_size = 16;
+    int stripe_streams = 4;
+    int bulk_lanes = 1;
+    long bundle_size = DFS_BUNDLE_THRESHOLD >> 10;
+    long inline_size = DFS_INLINE_THRESHOLD >> 10;
+    std::string listing = "compact";
     int debug_level = static_cast<int>(LL_ERROR);
     std::string command = "";
     std::string filename = "";
     std::string mount_path = "";
+    std::string trace_file = "";
     std::string server_address = "0.0.0.0:14205";
 
     char cwd[PATH_MAX];
@@ -290,6 +345,27 @@ int main(int argc, char** argv) {
             case 'm':
                 mount_path = std::string(optarg);
                 break;
+            case 'T':
+                trace_file = std::string(optarg);
+                break;
+            case 'S':
+                stripe_size = std::stol(optarg);
+                break;
+            case 'j':
+                stripe_streams = std::stoi(optarg);
+                break;
+            case 'B':
+                bulk_lanes = std::stoi(optarg);
+                break;
+            case 'b':
+                bundle_size = std::stol(optarg);
+                break;
+            case 'i':
+                inline_size = std::stol(optarg);
+                break;
+            case 'l':
+                listing = std::string(optarg);
+                break;
             case 'h':
                 Usage();
                 break;
@@ -335,25 +411,40 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    std::string commands("fetch store delete list stat mount sync");
+    std::string commands("fetch store delete list stat mount sync metrics");
     if (commands.find(command) == std::string::npos ) {
         std::cerr << "\nUnknown command!\n";
         Usage();
         return -1;
     }
 
-    std::string nonpath_commands("list mount sync");
+    std::string nonpath_commands("list mount sync metrics");
     if (filename.empty() && nonpath_commands.find(command) == std::string::npos ) {
         std::cerr << "\nMissing filename!\n";
         Usage();
         return -1;
     }
 
+    if (listing != "compact" && listing != "full") {
+        std::cerr << "\nUnknown listing format: " << listing << "\n";
+        Usage();
+        return -1;
+    }
+
+    if (!trace_file.empty()) {
+        DFSTracer::Instance().Enable(trace_file, "dfs-client");
+    }
+
     signal(SIGINT, HandleSignal);
     signal(SIGTERM, HandleSignal);
 
     client.SetMountPath(mount_path);
     client.SetDeadlineTimeout(deadline_timeout);
+    client.SetStriping(stripe_size > 0 ? static_cast<size_t>(stripe_size) << 20 : 0, stripe_streams);
+    client.SetBulkLanes(bulk_lanes);
+    client.SetBundling(bundle_size > 0 ? static_cast<size_t>(bundle_size) << 10 : 0);
+    client.SetInlining(inline_size > 0 ? static_cast<size_t>(inline_size) << 10 : 0);
+    client.SetCompactListings(listing == "compact");
     client.InitializeClientNode(server_address);
     client.ProcessCommand(command, filename);
 
@@ -21,6 +21,9 @@ class DFSClient {
         // The mount path
         std::string mount_path;
 
+        // Bulk connections for file transfers, besides the control connection
+        int bulk_lanes = 1;
+
         // The current client node
         DFSClientNodeP2 client_node;
 
@@ -57,6 +60,47 @@ class DFSClient {
          */
         void SetDeadlineTimeout(int deadline);
 
+        /**
+         * Sets how large files are fetched: the stripe size in bytes (0
+         * disables striping) and the streams fetching stripes at once
+         *
+         * @param stripe_size
+         * @param stripe_streams
+         */
+        void SetStriping(size_t stripe_size, int stripe_streams);
+
+        /**
+         * Sets the size in bytes up to which the sync engine moves files
+         * in bundles of many files per stream (0 disables bundling)
+         *
+         * @param bundle_threshold
+         */
+        void SetBundling(size_t bundle_threshold);
+
+        /**
+         * Sets the size in bytes up to which changed files come inlined in
+         * the change listing instead of being fetched (0 disables inlining)
+         *
+         * @param inline_threshold
+         */
+        void SetInlining(size_t inline_threshold);
+
+        /**
+         * Sets whether file listings are asked for in the compact encoding
+         *
+         * @param compact_listings
+         */
+        void SetCompactListings(bool compact_listings);
+
+        /**
+         * Sets how many bulk connections carry file transfers beside the
+         * control connection (0 = one connection for everything). Call
+         * before InitializeClientNode.
+         *
+         * @param bulk_lanes
+         */
+        void SetBulkLanes(int bulk_lanes);
+
         /**
          * Sets the mount path on the client node. This is the path
          * where files will be synced/cached with the server.
@@ -0,0 +1,493 @@
+#include <map>
+#include <set>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstdio>
+#include <csignal>
+#include <iostream>
+#include <dirent.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/wait.h>
+#include <grpcpp/grpcpp.h>
+
+#include "dfs-utils.h"
+#include "dfs-bench-utils.h"
+#include "dfslibx-metrics.h"
+#include "../dfslib-shared-p2.h"
+#include "../dfslib-clientnode-p2.h"
+#include "../proto-src/dfs-service.grpc.pb.h"
+
+/**
+ * Multi-client sync load generator.
+ *
+ * Runs many mounted DFSClientNodeP2 instances in one process against a
+ * dfs-server-p2 child process. Every client has its own client id, mount
+ * directory, channel and CallbackList thread, the same as a `mount`
+ * started from the command line. The inotify watcher is replaced by the
+ * workload driver, which calls Store/Delete through InotifyWatcherCallback
+ * so it is coordinated with the sync thread the same way.
+ *
+ * While the workload runs the server's CPU time is sampled from /proc.
+ * When it stops, the time until every client mount holds every server
+ * file with a matching checksum is reported as the convergence time.
+ */
+
+enum dfs_load_op_e {LOAD_CREATE, LOAD_MODIFY, LOAD_DELETE, LOAD_READ, LOAD_OP_COUNT};
+
+static const char* const load_op_names[LOAD_OP_COUNT] = {"create", "modify", "delete", "read"};
+
+struct DFSLoadClient {
+    int index;
+    std::unique_ptr<DFSClientNodeP2> node;
+    std::vector<std::string> own_files;
+    uint64_t next_file = 0;
+    std::mt19937_64 generator;
+};
+
+struct DFSLoadStats {
+    std::unique_ptr<DFSHistogram> latency[LOAD_OP_COUNT];
+    std::atomic<uint64_t> errors[LOAD_OP_COUNT];
+    std::atomic<uint64_t> exhausted[LOAD_OP_COUNT];
+    std::atomic<uint64_t> bytes[LOAD_OP_COUNT];
+
+    DFSLoadStats() {
+        for (int op = 0; op < LOAD_OP_COUNT; op++) {
+            latency[op].reset(new DFSHistogram());
+            errors[op].store(0);
+            exhausted[op].store(0);
+            bytes[op].store(0);
+        }
+    }
+};
+
+void Usage() {
+    std::cout <<
+        "\nUSAGE: dfs-loadgen-p2 [OPTIONS]\n"
+        "-c, --clients <num>:            Number of mounted clients (default: 500)\n"
+        "-D, --duration <seconds>:       How long the workload runs (default: 30)\n"
+        "-R, --rate <ops>:               Operations per second per client (default: 0.5)\n"
+        "-x, --mix <list>:               Workload weights (default: create:10,modify:20,delete:5,read:65)\n"
+        "-H, --hot_files <num>:          Files shared by all clients for modifies (default: 8)\n"
+        "-p, --hot_fraction <0-1>:       Share of modifies that go to a shared file (default: 0.5)\n"
+        "-s, --file_size <size>:         Size of created and modified files (default: 4K)\n"
+        "-C, --converge_timeout <sec>:   How long to wait for the mounts to converge (default: 60)\n"
+        "-a, --address <address>:        Server address (default: 127.0.0.1:36902)\n"
+        "-S, --server_bin <path>:        dfs-server-p2 binary to start (default: next to this binary)\n"
+        "-P, --server_pid <pid>:         Use an already running server with this pid instead of starting one\n"
+        "-n, --num_async_threads <num>:  Server asynchronous threads (default: 4)\n"
+        "-w, --work_dir <path>:          Directory for the client (and server) mounts (default: /tmp/dfs-loadgen-<pid>)\n"
+        "-t, --timeout <ms>:             Per call deadline (default: 10000)\n"
+        "-h, --help:                     Show help\n\n";
+    exit(1);
+}
+
+/**
+ * Parse "create:10,modify:20,..." into per operation weights
+ */
+static bool ParseMix(const std::string& mix, double weights[LOAD_OP_COUNT]) {
+    for (int op = 0; op < LOAD_OP_COUNT; op++) { weights[op] = 0; }
+    for (const std::string& part : dfs_bench_split(mix)) {
+        size_t colon = part.find(':');
+        if (colon == std::string::npos) { return false; }
+        std::string name = part.substr(0, colon);
+        int op = 0;
+        while (op < LOAD_OP_COUNT && name != load_op_names[op]) { op++; }
+        if (op == LOAD_OP_COUNT) { return false; }
+        weights[op] = std::stod(part.substr(colon + 1));
+    }
+    return true;
+}
+
+/**
+ * Regular, non hidden files in a directory
+ */
+static std::set<std::string> ListMount(const std::string& mount_path) {
+    std::set<std::string> names;
+    DIR* dir = opendir(mount_path.c_str());
+    if (dir == nullptr) { return names; }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] != '.' && entry->d_type == DT_REG) { names.insert(entry->d_name); }
+    }
+    closedir(dir);
+    return names;
+}
+
+/**
+ * Run one workload operation for a client
+ */
+static void RunOperation(DFSLoadClient& client, dfs_load_op_e op, uint64_t file_size, int hot_files,
+                         double hot_fraction, DFSLoadStats& stats) {
+    DFSClientNodeP2& node = *client.node;
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::string filename;
+    grpc::StatusCode status = grpc::StatusCode::OK;
+    uint64_t bytes = 0;
+
+    // Without files of its own a client can only create
+    if ((op == LOAD_DELETE || op == LOAD_READ) && client.own_files.empty()) { op = LOAD_CREATE; }
+    if (op == LOAD_MODIFY && client.own_files.empty() && hot_files == 0) { op = LOAD_CREATE; }
+
+    auto start = std::chrono::steady_clock::now();
+    switch (op) {
+        case LOAD_CREATE:
+            filename = "lg-" + std::to_string(client.index) + "-" + std::to_string(client.next_file++) + ".txt";
+            dfs_bench_make_file(node.MountPath() + filename, file_size, client.generator());
+            node.InotifyWatcherCallback([&]() { status = node.Store(filename); });
+            if (status == grpc::StatusCode::OK) { client.own_files.push_back(filename); }
+            bytes = file_size;
+            break;
+        case LOAD_MODIFY:
+            if (hot_files > 0 && (client.own_files.empty() || unit(client.generator) < hot_fraction)) {
+                filename = "hot-" + std::to_string(client.generator() % hot_files) + ".txt";
+            }
+            else {
+                filename = client.own_files[client.generator() % client.own_files.size()];
+            }
+            dfs_bench_make_file(node.MountPath() + filename, file_size, client.generator());
+            node.InotifyWatcherCallback([&]() { status = node.Store(filename); });
+            bytes = file_size;
+            break;
+        case LOAD_DELETE: {
+            size_t victim = client.generator() % client.own_files.size();
+            filename = client.own_files[victim];
+            unlink((node.MountPath() + filename).c_str());
+            node.InotifyWatcherCallback([&]() { status = node.Delete(filename); });
+            client.own_files.erase(client.own_files.begin() + victim);
+            break;
+        }
+        case LOAD_READ:
+            if (unit(client.generator) < 0.5) {
+                filename = client.own_files[client.generator() % client.own_files.size()];
+                status = node.Stat(filename);
+            }
+            else {
+                std::map<std::string,int> file_map;
+                status = node.List(&file_map, false);
+            }
+            break;
+        default:
+            break;
+    }
+    stats.latency[op]->Record(dfs_bench_elapsed_us(start));
+
+    // ALREADY_EXISTS means the server copy already matched, not a failure
+    if (status == grpc::StatusCode::RESOURCE_EXHAUSTED) { stats.exhausted[op]++; }
+    else if (status != grpc::StatusCode::OK && status != grpc::StatusCode::ALREADY_EXISTS) { stats.errors[op]++; }
+    else { stats.bytes[op] += bytes; }
+}
+
+/**
+ * Files on the server and their checksums, read with a synchronous CallbackList
+ */
+static bool ServerFiles(dfs_service::DFSService::Stub* stub, int deadline_timeout,
+                        std::map<std::string, uint32_t>& files) {
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(deadline_timeout));
+    dfs_service::CBLRequest request;
+    dfs_service::CBLResponse response;
+    if (!stub->CallbackList(&context, request, &response).ok()) { return false; }
+    files.clear();
+    for (const dfs_service::CBLElementResponse& element : response.fileinfo()) {
+        files[element.filename()] = element.filechecksum();
+    }
+    return true;
+}
+
+/**
+ * Count the clients still missing a server file or holding a different copy.
+ * Files only a client still has (deleted on the server) are counted as stale.
+ */
+static int DivergedClients(const std::vector<std::unique_ptr<DFSLoadClient>>& clients,
+                           const std::map<std::string, uint32_t>& server_files,
+                           CRC::Table<std::uint32_t, 32>& crc_table, uint64_t* stale_files) {
+    int diverged = 0;
+    *stale_files = 0;
+    for (const std::unique_ptr<DFSLoadClient>& client : clients) {
+        std::string mount_path = client->node->MountPath();
+        std::set<std::string> local = ListMount(mount_path);
+        bool matches = true;
+        for (const std::pair<const std::string, uint32_t>& file : server_files) {
+            if (local.find(file.first) == local.end() ||
+                dfs_file_checksum(mount_path + file.first, &crc_table) != file.second) {
+                matches = false;
+                break;
+            }
+        }
+        for (const std::string& name : local) {
+            if (server_files.find(name) == server_files.end()) { (*stale_files)++; }
+        }
+        if (!matches) { diverged++; }
+    }
+    return diverged;
+}
+
+int main(int argc, char** argv) {
+
+    const char* const short_opts = "c:D:R:x:H:p:s:C:a:S:P:n:w:t:h";
+
+    const option long_opts[] = {
+        {"clients", optional_argument, nullptr, 'c'},
+        {"duration", optional_argument, nullptr, 'D'},
+        {"rate", optional_argument, nullptr, 'R'},
+        {"mix", optional_argument, nullptr, 'x'},
+        {"hot_files", optional_argument, nullptr, 'H'},
+        {"hot_fraction", optional_argument, nullptr, 'p'},
+        {"file_size", optional_argument, nullptr, 's'},
+        {"converge_timeout", optional_argument, nullptr, 'C'},
+        {"address", optional_argument, nullptr, 'a'},
+        {"server_bin", optional_argument, nullptr, 'S'},
+        {"server_pid", optional_argument, nullptr, 'P'},
+        {"num_async_threads", optional_argument, nullptr, 'n'},
+        {"work_dir", optional_argument, nullptr, 'w'},
+        {"timeout", optional_argument, nullptr, 't'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, no_argument, nullptr, 0}
+    };
+
+    char option_char;
+    int num_clients = 500;
+    int duration = 30;
+    double rate = 0.5;
+    int hot_files = 8;
+    double hot_fraction = 0.5;
+    uint64_t file_size = 4096;
+    int converge_timeout = 60;
+    int num_async_threads = 4;
+    int deadline_timeout = 10000;
+    pid_t server_pid = 0;
+    std::string mix = "create:10,modify:20,delete:5,read:65";
+    std::string server_address = "127.0.0.1:36902";
+    std::string work_dir = "/tmp/dfs-loadgen-" + std::to_string(getpid());
+    std::string argv0(argv[0]);
+    std::string server_bin = std::string(dirname(&argv0[0])) + "/dfs-server-p2";
+
+    while((option_char = getopt_long(argc, argv, short_opts, long_opts, nullptr)) != -1) {
+        switch(option_char) {
+            case 'c':
+                num_clients = std::stoi(optarg);
+                break;
+            case 'D':
+                duration = std::stoi(optarg);
+                break;
+            case 'R':
+                rate = std::stod(optarg);
+                break;
+            case 'x':
+                mix = std::string(optarg);
+                break;
+            case 'H':
+                hot_files = std::stoi(optarg);
+                break;
+            case 'p':
+                hot_fraction = std::stod(optarg);
+                break;
+            case 's':
+                file_size = dfs_bench_parse_size(optarg);
+                break;
+            case 'C':
+                converge_timeout = std::stoi(optarg);
+                break;
+            case 'a':
+                server_address = std::string(optarg);
+                break;
+            case 'S':
+                server_bin = std::string(optarg);
+                break;
+            case 'P':
+                server_pid = static_cast<pid_t>(std::stoi(optarg));
+                break;
+            case 'n':
+                num_async_threads = std::stoi(optarg);
+                break;
+            case 'w':
+                work_dir = std::string(optarg);
+                break;
+            case 't':
+                deadline_timeout = std::stoi(optarg);
+                break;
+            case 'h':
+            case '?':
+            default:
+                Usage();
+                break;
+        }
+    }
+
+    double weights[LOAD_OP_COUNT];
+    if (num_clients <= 0 || rate <= 0 || !ParseMix(mix, weights)) {
+        Usage();
+    }
+
+    // Every call logs at SYSINFO, which would swamp the terminal with hundreds of clients
+    FILE* null_output = fopen("/dev/null", "w");
+    dfs_log_set_output(null_output);
+
+    bool spawned = server_pid == 0;
+    if (spawned) {
+        server_pid = dfs_bench_spawn_server(server_bin, server_address, dfs_clean_path(work_dir + "/server"),
+                                            num_async_threads, work_dir + "/server.log");
+        if (server_pid < 0) {
+            std::cerr << "Unable to start " << server_bin << std::endl;
+            return 1;
+        }
+    }
+
+    std::shared_ptr<grpc::Channel> control_channel = grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials());
+    if (!control_channel->WaitForConnected(std::chrono::system_clock::now() + std::chrono::seconds(10))) {
+        std::cerr << "Server did not answer on " << server_address << std::endl;
+        if (spawned) { kill(server_pid, SIGTERM); }
+        return 1;
+    }
+    std::unique_ptr<dfs_service::DFSService::Stub> control_stub = dfs_service::DFSService::NewStub(control_channel);
+    DFSClientNodeP2 control_node;
+    control_node.SetDeadlineTimeout(deadline_timeout);
+    control_node.CreateStub(control_channel);
+
+    // Mount every client, each with its own connection and sync thread
+    std::cerr << "Mounting " << num_clients << " clients" << std::endl;
+    std::vector<std::unique_ptr<DFSLoadClient>> clients;
+    for (int i = 0; i < num_clients; i++) {
+        std::string mount_path = dfs_clean_path(work_dir + "/client-" + std::to_string(i));
+        dfs_bench_mkdirs(mount_path);
+
+        grpc::ChannelArguments channel_args;
+        channel_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        std::unique_ptr<DFSLoadClient> client(new DFSLoadClient());
+        client->index = i;
+        client->generator.seed(static_cast<uint64_t>(i) * 7919 + 1);
+        client->node.reset(new DFSClientNodeP2());
+        client->node->SetMountPath(mount_path);
+        client->node->SetClientId("loadgen-" + std::to_string(i));
+        client->node->SetDeadlineTimeout(deadline_timeout);
+        client->node->CreateStub(grpc::CreateCustomChannel(server_address, grpc::InsecureChannelCredentials(), channel_args));
+
+        std::thread sync_thread(&DFSClientNodeP2::HandleCallbackList, client->node.get());
+        sync_thread.detach();
+        client->node->InitCallbackList();
+        clients.push_back(std::move(client));
+    }
+
+    DFSLoadStats stats;
+    std::atomic<bool> running(true);
+    std::vector<std::thread> workers;
+    double cpu_start = dfs_bench_process_cpu_seconds(server_pid);
+    auto workload_start = std::chrono::steady_clock::now();
+
+    std::cerr << "Running workload for " << duration << "s" << std::endl;
+    for (int i = 0; i < num_clients; i++) {
+        workers.emplace_back([&, i]() {
+            DFSLoadClient& client = *clients[i];
+            std::exponential_distribution<double> arrival(rate);
+            std::discrete_distribution<int> choose(weights, weights + LOAD_OP_COUNT);
+            while (running.load()) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(arrival(client.generator)));
+                if (!running.load()) { break; }
+                RunOperation(client, static_cast<dfs_load_op_e>(choose(client.generator)),
+                             file_size, hot_files, hot_fraction, stats);
+            }
+        });
+    }
+
+    // Sample the server CPU once a second for the peak
+    double peak_cores = 0;
+    double cpu_previous = cpu_start;
+    for (int second = 0; second < duration; second++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        double cpu_now = dfs_bench_process_cpu_seconds(server_pid);
+        peak_cores = std::max(peak_cores, cpu_now - cpu_previous);
+        cpu_previous = cpu_now;
+    }
+    running.store(false);
+    for (std::thread& worker : workers) { worker.join(); }
+    double workload_seconds = static_cast<double>(dfs_bench_elapsed_us(workload_start)) / 1e6;
+    double server_cpu = dfs_bench_process_cpu_seconds(server_pid) - cpu_start;
+
+    // Convergence: every mount holds every server file with the server's checksum
+    std::cerr << "Waiting for the mounts to converge" << std::endl;
+    CRC::Table<std::uint32_t, 32> crc_table(CRC::CRC_32());
+    std::map<std::string, uint32_t> server_files;
+    uint64_t stale_files = 0;
+    int diverged = num_clients;
+    auto converge_start = std::chrono::steady_clock::now();
+    uint64_t converge_us = 0;
+    while (converge_us < static_cast<uint64_t>(converge_timeout) * 1000000) {
+        if (ServerFiles(control_stub.get(), deadline_timeout, server_files)) {
+            diverged = DivergedClients(clients, server_files, crc_table, &stale_files);
+        }
+        converge_us = dfs_bench_elapsed_us(converge_start);
+        if (diverged == 0) { break; }
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+
+    dfs_service::MetricsResponse metrics;
+    control_node.Metrics("dfs_", &metrics, false);
+
+    std::vector<DFSBenchResult> results;
+    for (int op = 0; op < LOAD_OP_COUNT; op++) {
+        DFSBenchResult result;
+        result.operation = load_op_names[op];
+        result.file_size = file_size;
+        result.concurrency = num_clients;
+        result.errors = stats.errors[op].load() + stats.exhausted[op].load();
+        result.bytes = stats.bytes[op].load();
+        result.wall_us = static_cast<uint64_t>(workload_seconds * 1e6);
+        result.FromHistogram(*stats.latency[op]);
+        results.push_back(result);
+    }
+    dfs_bench_write_results(stdout, results, false);
+
+    uint64_t writes = stats.latency[LOAD_CREATE]->Count() + stats.latency[LOAD_MODIFY]->Count() +
+                      stats.latency[LOAD_DELETE]->Count();
+    uint64_t exhausted = stats.exhausted[LOAD_CREATE].load() + stats.exhausted[LOAD_MODIFY].load() +
+                         stats.exhausted[LOAD_DELETE].load();
+
+    printf("\nmetric,value\n");
+    printf("clients,%d\n", num_clients);
+    printf("workload_seconds,%.1f\n", workload_seconds);
+    printf("server_cpu_seconds,%.2f\n", server_cpu);
+    printf("server_cpu_mean_cores,%.2f\n", workload_seconds > 0 ? server_cpu / workload_seconds : 0.0);
+    printf("server_cpu_peak_cores,%.2f\n", peak_cores);
+    printf("write_ops,%llu\n", (unsigned long long) writes);
+    printf("resource_exhausted,%llu\n", (unsigned long long) exhausted);
+    printf("resource_exhausted_rate,%.4f\n", writes > 0 ? static_cast<double>(exhausted) / writes : 0.0);
+    printf("server_files,%zu\n", server_files.size());
+    printf("converged,%s\n", diverged == 0 ? "true" : "false");
+    printf("converge_ms,%.1f\n", static_cast<double>(converge_us) / 1000.0);
+    printf("diverged_clients,%d\n", diverged);
+    printf("stale_client_files,%llu\n", (unsigned long long) stale_files);
+
+    // Listing cost as seen by the server
+    for (const dfs_service::MetricValue& metric : metrics.metric()) {
+        if (metric.name() == "dfs_rpc_latency_us" &&
+            (metric.labels().find("CallbackList") != std::string::npos ||
+             metric.labels().find("fileLister") != std::string::npos)) {
+            bool callback = metric.labels().find("CallbackList") != std::string::npos;
+            const char* name = callback ? "callbacklist" : "list";
+            printf("%s_calls,%llu\n", name, (unsigned long long) metric.count());
+            printf("%s_calls_per_s,%.1f\n", name, metric.count() / (workload_seconds + converge_us / 1e6));
+            printf("%s_p50_us,%llu\n", name, (unsigned long long) metric.p50());
+            printf("%s_p99_us,%llu\n", name, (unsigned long long) metric.p99());
+            if (callback && metric.count() > 0) {
+                printf("server_cpu_us_per_callbacklist,%.1f\n", server_cpu * 1e6 / metric.count());
+            }
+        }
+        if (metric.name() == "dfs_lock_conflicts_total") {
+            printf("server_lock_conflicts,%lld\n", (long long) metric.value());
+        }
+    }
+    fflush(stdout);
+
+    if (spawned) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, nullptr, 0);
+    }
+    dfs_log_flush();
+    _exit(0);
+}
@@ -0,0 +1,606 @@
+#include <new>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <zlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <benchmark/benchmark.h>
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/impl/codegen/proto_utils.h>
+
+#include "dfs-utils.h"
+#include "dfs-bench-utils.h"
+#include "dfslibx-crc32.h"
+#include "dfslibx-io-engine.h"
+#include "dfslibx-upload-pipeline.h"
+#include "dfslibx-file-mutex-table.h"
+#include "dfslibx-compact-listing.h"
+#include "dfslibx-arena.h"
+#include "../proto-src/dfs-service.pb.h"
+
+/**
+ * Microbenchmarks for the server's hot paths.
+ *
+ * Build with `make microbench` and run from the bin directory, e.g.
+ *
+ *      ./dfs-microbench-p2 --benchmark_repetitions=5 --benchmark_report_aggregates_only=true \
+ *          --benchmark_out=run.json --benchmark_out_format=json
+ *
+ * and compare two runs with Google Benchmark's tools/compare.py. Fixture
+ * files and directories go under $DFS_MICROBENCH_DIR (default
+ * /tmp/dfs-microbench) and are kept between runs, so the 100k file
+ * directory is only created once.
+ */
+
+//
+// Every heap allocation in the process is counted, so the receive
+// benchmarks can report allocations per chunk
+//
+static std::atomic<uint64_t> allocation_count{0};
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* memory = malloc(size > 0 ? size : 1);
+    if (memory == nullptr) { throw std::bad_alloc(); }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+
+static std::string FixtureDir() {
+    const char* dir = getenv("DFS_MICROBENCH_DIR");
+    return dfs_clean_path(dir != nullptr ? dir : "/tmp/dfs-microbench");
+}
+
+/**
+ * A file of the given size, created on first use
+ */
+static std::string FixtureFile(uint64_t size) {
+    std::string path = FixtureDir() + "file-" + dfs_bench_format_size(size) + ".bin";
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_size) != size) {
+        dfs_bench_mkdirs(FixtureDir());
+        dfs_bench_make_file(path, size, size);
+    }
+    return path;
+}
+
+/**
+ * A directory holding count small files, created on first use
+ */
+static std::string FixtureDirectory(int count) {
+    std::string directory = FixtureDir() + "dir-" + std::to_string(count) + "/";
+    long existing = dfs_scan_files(directory, [](const std::string&, const struct stat&) {});
+    if (existing != count) {
+        dfs_bench_mkdirs(directory);
+        for (int i = 0; i < count; i++) {
+            dfs_bench_make_file(directory + "file-" + std::to_string(i) + ".txt", 64, static_cast<uint64_t>(i));
+        }
+    }
+    return directory;
+}
+
+static std::vector<char> RandomBuffer(size_t size) {
+    std::vector<char> buffer(size);
+    std::mt19937 generator(static_cast<unsigned>(size));
+    for (char& byte : buffer) { byte = static_cast<char>(generator()); }
+    return buffer;
+}
+
+//
+// dfs_file_checksum over files of increasing size
+//
+static void BM_FileChecksum(benchmark::State& state) {
+    uint64_t size = static_cast<uint64_t>(state.range(0));
+    std::string path = FixtureFile(size);
+    CRC::Table<std::uint32_t, 32> table(CRC::CRC_32());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(dfs_file_checksum(path, &table));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(size));
+}
+BENCHMARK(BM_FileChecksum)->Arg(1 << 10)->Arg(64 << 10)->Arg(1 << 20)->Arg(16 << 20)->Arg(256 << 20)
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// CRC-32 implementations over the same in-memory buffer
+//
+static void BM_CrcTable(benchmark::State& state) {
+    std::vector<char> buffer = RandomBuffer(static_cast<size_t>(state.range(0)));
+    CRC::Table<std::uint32_t, 32> table(CRC::CRC_32());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CRC::Calculate(buffer.data(), buffer.size(), table, std::uint32_t(0)));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_CrcTable)->Arg(4 << 10)->Arg(1 << 20);
+
+static void BM_CrcSlice8(benchmark::State& state) {
+    std::vector<char> buffer = RandomBuffer(static_cast<size_t>(state.range(0)));
+    CRC::Table<std::uint32_t, 32> table(CRC::CRC_32());
+    if (dfs_crc32_slice8(buffer.data(), buffer.size()) != CRC::Calculate(buffer.data(), buffer.size(), table, std::uint32_t(0))) {
+        state.SkipWithError("slicing-by-8 result differs from CRC::Calculate");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(dfs_crc32_slice8(buffer.data(), buffer.size()));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_CrcSlice8)->Arg(4 << 10)->Arg(1 << 20);
+
+static void BM_CrcZlib(benchmark::State& state) {
+    std::vector<char> buffer = RandomBuffer(static_cast<size_t>(state.range(0)));
+    CRC::Table<std::uint32_t, 32> table(CRC::CRC_32());
+    const Bytef* bytes = reinterpret_cast<const Bytef*>(buffer.data());
+    if (crc32(0L, bytes, static_cast<uInt>(buffer.size())) != CRC::Calculate(buffer.data(), buffer.size(), table, std::uint32_t(0))) {
+        state.SkipWithError("zlib result differs from CRC::Calculate");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(crc32(0L, bytes, static_cast<uInt>(buffer.size())));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_CrcZlib)->Arg(4 << 10)->Arg(1 << 20);
+
+//
+// Disk reads and writes: the old 4K iostream loop against the I/O engines.
+// Items are disk requests, so items_per_second is IOPS; cpu_s_per_GB counts
+// every thread in the process, including io_uring workers.
+//
+static double ProcessCpuSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) / 1e9;
+}
+
+static void SetIoCounters(benchmark::State& state, int64_t bytes, int64_t requests, double cpu_seconds) {
+    state.SetBytesProcessed(bytes);
+    state.SetItemsProcessed(requests);
+    state.counters["cpu_s_per_GB"] = bytes > 0 ? cpu_seconds * 1e9 / static_cast<double>(bytes) : 0;
+}
+
+static void BM_StreamRead(benchmark::State& state) {
+    uint64_t size = static_cast<uint64_t>(state.range(0));
+    std::string path = FixtureFile(size);
+    std::vector<char> chunk(4096);
+    int64_t requests = 0;
+    double cpu_start = ProcessCpuSeconds();
+    for (auto _ : state) {
+        std::ifstream file(path, std::ios::in);
+        while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0) {
+            benchmark::DoNotOptimize(chunk.data());
+            requests++;
+        }
+    }
+    SetIoCounters(state, static_cast<int64_t>(state.iterations() * size), requests, ProcessCpuSeconds() - cpu_start);
+}
+BENCHMARK(BM_StreamRead)->Arg(1 << 20)->Arg(64 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_EngineRead(benchmark::State& state, DFSIoKind kind) {
+    uint64_t size = static_cast<uint64_t>(state.range(0));
+    std::string path = FixtureFile(size);
+    std::unique_ptr<DFSIoEngine> engine = DFSIoEngine::Create(kind);
+    state.SetLabel(engine->Name());
+    int64_t requests = 0;
+    double cpu_start = ProcessCpuSeconds();
+    for (auto _ : state) {
+        int fd = open(path.c_str(), O_RDONLY);
+        off_t offset = 0;
+        int slot;
+        while (offset < static_cast<off_t>(size) || engine->InFlight() > 0) {
+            while (offset < static_cast<off_t>(size) && (slot = engine->AcquireSlot()) >= 0) {
+                size_t length = std::min(engine->BlockSize(), static_cast<size_t>(size - offset));
+                engine->QueueRead(static_cast<unsigned>(slot), fd, length, offset);
+                offset += length;
+                requests++;
+            }
+            unsigned completed;
+            ssize_t result;
+            if (engine->Wait(&completed, &result)) {
+                benchmark::DoNotOptimize(engine->Buffer(completed));
+                engine->ReleaseSlot(completed);
+            }
+        }
+        close(fd);
+    }
+    SetIoCounters(state, static_cast<int64_t>(state.iterations() * size), requests, ProcessCpuSeconds() - cpu_start);
+}
+BENCHMARK_CAPTURE(BM_EngineRead, uring, DFS_IO_URING)->Arg(1 << 20)->Arg(64 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_EngineRead, posix, DFS_IO_POSIX)->Arg(1 << 20)->Arg(64 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_StreamWrite(benchmark::State& state) {
+    uint64_t size = static_cast<uint64_t>(state.range(0));
+    std::string path = FixtureDir() + "write-stream.bin";
+    dfs_bench_mkdirs(FixtureDir());
+    std::vector<char> chunk = RandomBuffer(4096);
+    int64_t requests = 0;
+    double cpu_start = ProcessCpuSeconds();
+    for (auto _ : state) {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        for (uint64_t written = 0; written < size; written += chunk.size()) {
+            file.write(chunk.data(), static_cast<std::streamsize>(std::min<uint64_t>(chunk.size(), size - written)));
+            requests++;
+        }
+    }
+    SetIoCounters(state, static_cast<int64_t>(state.iterations() * size), requests, ProcessCpuSeconds() - cpu_start);
+    unlink(path.c_str());
+}
+BENCHMARK(BM_StreamWrite)->Arg(1 << 20)->Arg(64 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_EngineWrite(benchmark::State& state, DFSIoKind kind) {
+    uint64_t size = static_cast<uint64_t>(state.range(0));
+    std::string path = FixtureDir() + "write-engine.bin";
+    dfs_bench_mkdirs(FixtureDir());
+    std::unique_ptr<DFSIoEngine> engine = DFSIoEngine::Create(kind);
+    state.SetLabel(engine->Name());
+    std::vector<char> block = RandomBuffer(engine->BlockSize());
+    int64_t requests = 0;
+    double cpu_start = ProcessCpuSeconds();
+    for (auto _ : state) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        for (off_t offset = 0; offset < static_cast<off_t>(size);) {
+            int slot;
+            while ((slot = engine->AcquireSlot()) < 0) {
+                unsigned completed;
+                ssize_t result;
+                if (engine->Wait(&completed, &result)) { engine->ReleaseSlot(completed); }
+            }
+            size_t length = std::min(engine->BlockSize(), static_cast<size_t>(size - offset));
+            memcpy(engine->Buffer(static_cast<unsigned>(slot)), block.data(), length);
+            engine->QueueWrite(static_cast<unsigned>(slot), fd, length, offset);
+            engine->Submit();
+            offset += length;
+            requests++;
+        }
+        engine->Drain();
+        close(fd);
+    }
+    SetIoCounters(state, static_cast<int64_t>(state.iterations() * size), requests, ProcessCpuSeconds() - cpu_start);
+    unlink(path.c_str());
+}
+BENCHMARK_CAPTURE(BM_EngineWrite, uring, DFS_IO_URING)->Arg(1 << 20)->Arg(64 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_EngineWrite, posix, DFS_IO_POSIX)->Arg(1 << 20)->Arg(64 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//
+// Chunk receive paths: each iteration parses a 1MB file's worth of 4K chunk
+// messages into one reused message and writes them out, the way the
+// upload and fetch handlers do. allocs_per_chunk only counts allocations
+// inside the chunk loop.
+//
+static const int kReceiveChunks = 256;
+
+static std::string UploadChunkWire() {
+    dfs_service::UploadRequest request;
+    request.set_filename("receive.bin");
+    request.set_clientid("client-0");
+    std::vector<char> chunk = RandomBuffer(4096);
+    request.set_filechunk(chunk.data(), chunk.size());
+    return request.SerializeAsString();
+}
+
+static std::string FetchChunkWire() {
+    dfs_service::FetchResponse response;
+    response.set_copyfile(true);
+    response.set_filesize(kReceiveChunks * 4096);
+    std::vector<char> chunk = RandomBuffer(4096);
+    response.set_content(chunk.data(), chunk.size());
+    return response.SerializeAsString();
+}
+
+static void SetReceiveCounters(benchmark::State& state, uint64_t allocations) {
+    int64_t chunks = static_cast<int64_t>(state.iterations()) * kReceiveChunks;
+    state.SetItemsProcessed(chunks);
+    state.SetBytesProcessed(chunks * 4096);
+    state.counters["allocs_per_chunk"] = static_cast<double>(allocations) / static_cast<double>(chunks);
+}
+
+//The upload handler before the pipeline: copy the chunk, stream it to an ofstream
+static void BM_UploadReceiveCopy(benchmark::State& state) {
+    std::string wire = UploadChunkWire();
+    std::string path = FixtureDir() + "receive-upload.bin";
+    dfs_bench_mkdirs(FixtureDir());
+    dfs_service::UploadRequest request;
+    uint64_t allocations = 0;
+    for (auto _ : state) {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        uint64_t start = allocation_count.load();
+        for (int chunk = 0; chunk < kReceiveChunks; chunk++) {
+            request.ParseFromString(wire);
+            const std::string chunkContents = request.filechunk();
+            file << chunkContents;
+        }
+        allocations += allocation_count.load() - start;
+    }
+    SetReceiveCounters(state, allocations);
+    unlink(path.c_str());
+}
+BENCHMARK(BM_UploadReceiveCopy)->UseRealTime();
+
+//The upload handler now: parse into a spare buffer and move it to the writer
+static void BM_UploadReceivePipeline(benchmark::State& state) {
+    std::string wire = UploadChunkWire();
+    std::string path = FixtureDir() + "receive-upload.bin";
+    dfs_bench_mkdirs(FixtureDir());
+    dfs_service::UploadRequest request;
+    uint64_t allocations = 0;
+    for (auto _ : state) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        DFSUploadPipeline pipeline(fd);
+        std::string buffer = pipeline.TakeSpare();
+        request.mutable_filechunk()->swap(buffer);
+        uint64_t start = allocation_count.load();
+        for (int chunk = 0; chunk < kReceiveChunks; chunk++) {
+            request.ParseFromString(wire);
+            buffer = pipeline.TakeSpare();
+            request.mutable_filechunk()->swap(buffer);
+            pipeline.Push(std::move(buffer));
+        }
+        allocations += allocation_count.load() - start;
+        pipeline.Finish();
+        close(fd);
+    }
+    SetReceiveCounters(state, allocations);
+    unlink(path.c_str());
+}
+BENCHMARK(BM_UploadReceivePipeline)->UseRealTime();
+
+//Client Fetch before: copy the content, stream it to an ofstream
+static void BM_FetchReceiveCopy(benchmark::State& state) {
+    std::string wire = FetchChunkWire();
+    std::string path = FixtureDir() + "receive-fetch.bin";
+    dfs_bench_mkdirs(FixtureDir());
+    dfs_service::FetchResponse response;
+    uint64_t allocations = 0;
+    for (auto _ : state) {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        uint64_t start = allocation_count.load();
+        for (int chunk = 0; chunk < kReceiveChunks; chunk++) {
+            response.ParseFromString(wire);
+            const std::string chunkContents = response.content();
+            file << chunkContents;
+        }
+        allocations += allocation_count.load() - start;
+    }
+    SetReceiveCounters(state, allocations);
+    unlink(path.c_str());
+}
+BENCHMARK(BM_FetchReceiveCopy)->UseRealTime();
+
+//Client Fetch now: write the reused message's content straight to the fd
+static void BM_FetchReceiveDirect(benchmark::State& state) {
+    std::string wire = FetchChunkWire();
+    std::string path = FixtureDir() + "receive-fetch.bin";
+    dfs_bench_mkdirs(FixtureDir());
+    dfs_service::FetchResponse response;
+    uint64_t allocations = 0;
+    for (auto _ : state) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        uint64_t start = allocation_count.load();
+        for (int chunk = 0; chunk < kReceiveChunks; chunk++) {
+            response.ParseFromString(wire);
+            dfs_write_fully(fd, response.content().data(), response.content().length());
+        }
+        allocations += allocation_count.load() - start;
+        close(fd);
+    }
+    SetReceiveCounters(state, allocations);
+    unlink(path.c_str());
+}
+BENCHMARK(BM_FetchReceiveDirect)->UseRealTime();
+
+//
+// Write lock table: every thread locks its own file, or all threads fight over one
+//
+static DFSFileMutexTable* mutex_table = nullptr;
+
+static void BM_LockTable(benchmark::State& state, bool shared_file) {
+    if (state.thread_index() == 0) { mutex_table = new DFSFileMutexTable(); }
+    std::string client = "client-" + std::to_string(state.thread_index());
+    std::string filename = shared_file ? "shared.txt" : "file-" + std::to_string(state.thread_index()) + ".txt";
+    uint64_t conflicts = 0;
+    for (auto _ : state) {
+        if (mutex_table->Request(filename, client)) {
+            mutex_table->Release(filename, client);
+        }
+        else {
+            conflicts++;
+        }
+    }
+    state.counters["conflicts"] = benchmark::Counter(static_cast<double>(conflicts), benchmark::Counter::kAvgThreads);
+    if (state.thread_index() == 0) { delete mutex_table; mutex_table = nullptr; }
+}
+BENCHMARK_CAPTURE(BM_LockTable, own_file, false)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LockTable, shared_file, true)->ThreadRange(1, 16)->UseRealTime();
+
+//
+// fileLister and CallbackList directory scans
+//
+static void BM_ListScan(benchmark::State& state) {
+    std::string directory = FixtureDirectory(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        dfs_service::ListResponse response;
+        dfs_scan_files(directory, [&](const std::string& name, const struct stat& st) {
+            dfs_service::ListElementResponse* info = response.add_file();
+            info->set_filename(name);
+            info->mutable_mtime()->set_seconds(st.st_mtim.tv_sec);
+        });
+        benchmark::DoNotOptimize(response.ByteSizeLong());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_ListScan)->Arg(1000)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+static void BM_CallbackListScan(benchmark::State& state) {
+    std::string directory = FixtureDirectory(static_cast<int>(state.range(0)));
+    CRC::Table<std::uint32_t, 32> table(CRC::CRC_32());
+    for (auto _ : state) {
+        dfs_service::CBLResponse response;
+        dfs_scan_files(directory, [&](const std::string& name, const struct stat& st) {
+            dfs_service::CBLElementResponse* info = response.add_fileinfo();
+            info->set_filename(name);
+            info->set_filesize(st.st_size);
+            info->set_filechecksum(dfs_file_checksum(directory + name, &table));
+            info->mutable_mtime()->set_seconds(st.st_mtim.tv_sec);
+            info->mutable_ctime()->set_seconds(st.st_ctim.tv_sec);
+        });
+        benchmark::DoNotOptimize(response.ByteSizeLong());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_CallbackListScan)->Arg(1000)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+//
+// CallbackList listing encodings: one message per file against the compact
+// columns. Each iteration encodes or decodes a listing of range(0) files;
+// bytes is the serialized size and allocs counts decode allocations.
+//
+struct ListingRow {
+    std::string name;
+    int64_t size;
+    int64_t mtime_ns;
+    uint32_t checksum;
+};
+
+static std::vector<ListingRow> ListingRows(int count) {
+    std::vector<ListingRow> rows;
+    std::mt19937 generator(static_cast<unsigned>(count));
+    for (int i = 0; i < count; i++) {
+        rows.push_back({"file-" + std::to_string(i) + ".txt", static_cast<int64_t>(generator() % 100000),
+                        1700000000000000000LL + static_cast<int64_t>(generator()), static_cast<uint32_t>(generator())});
+    }
+    return rows;
+}
+
+static std::string EncodeMessages(const std::vector<ListingRow>& rows) {
+    dfs_service::CBLResponse response;
+    for (const ListingRow& row : rows) {
+        dfs_service::CBLElementResponse* info = response.add_fileinfo();
+        info->set_filename(row.name);
+        info->set_filesize(row.size);
+        info->set_filechecksum(row.checksum);
+        info->mutable_mtime()->set_seconds(row.mtime_ns / 1000000000LL);
+        info->mutable_ctime()->set_seconds(row.mtime_ns / 1000000000LL);
+    }
+    return response.SerializeAsString();
+}
+
+static std::string EncodeCompact(const std::vector<ListingRow>& rows) {
+    dfs_service::CBLResponse response;
+    DFSCompactListingBuilder builder(true, true);
+    builder.Reserve(rows.size());
+    for (const ListingRow& row : rows) {
+        builder.Add(row.name, row.size, row.mtime_ns, row.checksum);
+    }
+    builder.Finish(response.mutable_compact());
+    return response.SerializeAsString();
+}
+
+static void SetListingCounters(benchmark::State& state, size_t bytes, uint64_t allocations) {
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+    state.counters["bytes"] = static_cast<double>(bytes);
+    state.counters["allocs"] = static_cast<double>(allocations) / static_cast<double>(state.iterations());
+}
+
+static void BM_ListingEncode(benchmark::State& state, bool compact) {
+    std::vector<ListingRow> rows = ListingRows(static_cast<int>(state.range(0)));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        std::string wire = compact ? EncodeCompact(rows) : EncodeMessages(rows);
+        bytes = wire.size();
+        benchmark::DoNotOptimize(wire.data());
+    }
+    SetListingCounters(state, bytes, 0);
+}
+BENCHMARK_CAPTURE(BM_ListingEncode, messages, false)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ListingEncode, compact, true)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+//Parse the listing and visit every file the way the sync engine does,
+//into a message on the heap or on an arena like the client's
+static void BM_ListingDecode(benchmark::State& state, bool compact, bool arena) {
+    std::vector<ListingRow> rows = ListingRows(static_cast<int>(state.range(0)));
+    std::string wire = compact ? EncodeCompact(rows) : EncodeMessages(rows);
+    uint64_t allocations = 0;
+    for (auto _ : state) {
+        uint64_t start = allocation_count.load();
+        std::unique_ptr<google::protobuf::Arena> messages(arena ? new google::protobuf::Arena(dfs_arena_options()) : nullptr);
+        dfs_service::CBLResponse* parsed = google::protobuf::Arena::CreateMessage<dfs_service::CBLResponse>(messages.get());
+        std::unique_ptr<dfs_service::CBLResponse> owned(arena ? nullptr : parsed);
+        const dfs_service::CBLResponse& response = *parsed;
+        parsed->ParseFromString(wire);
+        uint64_t total = 0;
+        if (compact) {
+            dfs_compact_listing_each(response.compact(), [&](int row, const std::string& name, int64_t size,
+                                                              int64_t mtime_ns, uint32_t checksum) {
+                total += name.length() + static_cast<uint64_t>(size) + checksum;
+            });
+        } else {
+            for (const dfs_service::CBLElementResponse& info : response.fileinfo()) {
+                total += info.filename().length() + static_cast<uint64_t>(info.filesize()) + info.filechecksum();
+            }
+        }
+        benchmark::DoNotOptimize(total);
+        owned.reset();
+        messages.reset();
+        allocations += allocation_count.load() - start;
+    }
+    SetListingCounters(state, wire.size(), allocations);
+}
+BENCHMARK_CAPTURE(BM_ListingDecode, messages, false, false)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ListingDecode, messages_arena, false, true)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ListingDecode, compact, true, false)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ListingDecode, compact_arena, true, true)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+//Copy a scanned listing into a reply and serialize it, as the listing hub
+//does for a full listing, with the reply on the heap or on an arena
+static void BM_ListingRender(benchmark::State& state, bool arena) {
+    std::vector<ListingRow> rows = ListingRows(static_cast<int>(state.range(0)));
+    dfs_service::CBLResponse listing;
+    listing.ParseFromString(EncodeMessages(rows));
+    size_t bytes = 0;
+    uint64_t allocations = 0;
+    for (auto _ : state) {
+        uint64_t start = allocation_count.load();
+        std::unique_ptr<google::protobuf::Arena> messages(arena ? new google::protobuf::Arena(dfs_arena_options()) : nullptr);
+        dfs_service::CBLResponse* response = google::protobuf::Arena::CreateMessage<dfs_service::CBLResponse>(messages.get());
+        std::unique_ptr<dfs_service::CBLResponse> owned(arena ? nullptr : response);
+        *response = listing;
+        grpc::ByteBuffer buffer;
+        bool own_buffer;
+        grpc::SerializationTraits<dfs_service::CBLResponse>::Serialize(*response, &buffer, &own_buffer);
+        bytes = buffer.Length();
+        owned.reset();
+        messages.reset();
+        allocations += allocation_count.load() - start;
+    }
+    SetListingCounters(state, bytes, allocations);
+}
+BENCHMARK_CAPTURE(BM_ListingRender, heap, false)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ListingRender, arena, true)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv) {
+    // The lock table logs every step at SYSINFO
+    FILE* null_output = fopen("/dev/null", "w");
+    dfs_log_set_output(null_output);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    dfs_log_flush();
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <csignal>
 
 #include "dfs-utils.h"
+#include "dfslibx-trace.h"
 #include "../dfslib-servernode-p2.h"
 
 void HandleSignal(int signum) {
@@ -17,20 +18,36 @@ void Usage() {
         "-a, --address <address>:       The server address to connect to (default: 0.0.0.0:36801)\n"
         "-d, --debug_level <level>:  The debug level to use: 0, 1, 2, 3 (default: 0 = no debug, higher numbers increase verbosity)\n"
         "-m, --mount_path <path>:       The mount storage path (default: mnt/server)\n"
-        "-n, --num_async_threads <num>: The number of asynchronous threads to generate (default: 4)\n"
+        "-n, --num_async_threads <num>: The number of asynchronous threads to generate, each with its own completion queue (default: 4)\n"
+        "-c, --cpu_affinity:            Pin each asynchronous thread to its own CPU\n"
+        "-s, --stats_interval <ms>:     Log per completion queue depth and latency every <ms> milliseconds (default: 0 = off)\n"
+        "-P, --metrics_file <path>:     Periodically write Prometheus text format metrics to <path>\n"
+        "-i, --metrics_interval <ms>:   How often the metrics file is rewritten (default: 5000)\n"
+        "-T, --trace_file <path>:       Record request phase spans and write them as Chrome trace JSON to <path> on exit\n"
+        "-C, --cache_size <MB>:         Memory for caching small and popular file contents (default: 64, 0 = off)\n"
+        "-I, --io_engine <engine>:      Disk I/O engine for fetches: auto, uring or posix (default: auto = io_uring when available)\n"
+        "-x, --index_file <path>:       Where file metadata and checksums are kept across restarts (default: .dfs-index in the mount path)\n"
         "-h, --help:                    Show help\n\n";
     exit(1);
 }
 
 int main(int argc, char** argv) {
 
-    const char* const short_opts = "a:d:m:n:h";
+    const char* const short_opts = "a:d:m:n:cs:P:i:T:C:I:x:h";
 
     const option long_opts[] = {
         {"debug_level", optional_argument, nullptr, 'd'},
         {"mount_path", optional_argument, nullptr, 'm'},
         {"address", optional_argument, nullptr, 'a'},
         {"num_async_threads", optional_argument, nullptr, 'n'},
+        {"cpu_affinity", no_argument, nullptr, 'c'},
+        {"stats_interval", optional_argument, nullptr, 's'},
+        {"metrics_file", optional_argument, nullptr, 'P'},
+        {"metrics_interval", optional_argument, nullptr, 'i'},
+        {"trace_file", optional_argument, nullptr, 'T'},
+        {"cache_size", optional_argument, nullptr, 'C'},
+        {"io_engine", optional_argument, nullptr, 'I'},
+        {"index_file", optional_argument, nullptr, 'x'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, no_argument, nullptr, 0}
     };
@@ -38,6 +55,14 @@ int main(int argc, char** argv) {
     char option_char;
     int debug_level = static_cast<int>(LL_ERROR);
     long num_async_threads = 4;
+    bool cpu_affinity = false;
+    int stats_interval = 0;
+    int metrics_interval = 5000;
+    long cache_size = 64;
+    DFSIoKind io_kind = DFS_IO_AUTO;
+    std::string metrics_file = "";
+    std::string trace_file = "";
+    std::string index_file = "";
     std::string mount_path = "mnt/server/";
     std::string server_address = "0.0.0.0:36801";
 
@@ -55,6 +80,30 @@ int main(int argc, char** argv) {
             case 'n':
                 num_async_threads = std::stoi(optarg);
                 break;
+            case 'c':
+                cpu_affinity = true;
+                break;
+            case 's':
+                stats_interval = std::stoi(optarg);
+                break;
+            case 'P':
+                metrics_file = std::string(optarg);
+                break;
+            case 'i':
+                metrics_interval = std::stoi(optarg);
+                break;
+            case 'T':
+                trace_file = std::string(optarg);
+                break;
+            case 'C':
+                cache_size = std::stol(optarg);
+                break;
+            case 'I':
+                io_kind = dfs_io_kind_from_string(optarg);
+                break;
+            case 'x':
+                index_file = std::string(optarg);
+                break;
             case 'h':
             case '?':
             default:
@@ -67,10 +116,20 @@ int main(int argc, char** argv) {
         DFS_LOG_LEVEL = static_cast<dfs_log_level_e>(debug_level + 1);
     }
 
+    if (!trace_file.empty()) {
+        DFSTracer::Instance().Enable(trace_file, "dfs-server");
+    }
+
     signal(SIGINT, HandleSignal);
     signal(SIGTERM, HandleSignal);
 
     DFSServerNode server_node(server_address, dfs_clean_path(mount_path), num_async_threads, [&]{ return; });
+    server_node.SetCpuAffinity(cpu_affinity);
+    server_node.SetStatsInterval(stats_interval);
+    server_node.SetMetricsFile(metrics_file, metrics_interval);
+    server_node.SetCacheSize(cache_size > 0 ? static_cast<size_t>(cache_size) << 20 : 0);
+    server_node.SetIoEngine(io_kind);
+    server_node.SetIndexFile(index_file);
     server_node.Start();
 
     return 0;
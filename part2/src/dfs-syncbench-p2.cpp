@@ -0,0 +1,300 @@
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <getopt.h>
+#include <unistd.h>
+#include <grpcpp/grpcpp.h>
+
+#include "dfs-utils.h"
+#include "dfs-client-p2.h"
+#include "dfs-bench-utils.h"
+#include "dfslibx-metrics.h"
+#include "../dfslib-shared-p2.h"
+#include "../dfslib-clientnode-p2.h"
+
+/**
+ * Sync propagation benchmark.
+ *
+ * Runs a server and two fully mounted DFSClients (inotify watcher and
+ * CallbackList thread, exactly as `dfs-client-p2 mount`) in this process.
+ * Each change writes a sequence number into a file in mount A, then mount
+ * B is polled until the file holds that sequence number. The time
+ * between the write and B seeing it is the propagation latency.
+ *
+ * The server's GetMetrics counters are read before and after the run to
+ * report file bytes and RPCs per logical change, including any echo
+ * Stores from B's watcher seeing its own Fetch.
+ */
+
+/** Server metrics compared before and after the run **/
+struct DFSSyncCounters {
+    int64_t bytes_in = 0;
+    int64_t bytes_out = 0;
+    uint64_t uploads = 0;
+    uint64_t fetches = 0;
+    uint64_t callback_lists = 0;
+    uint64_t lock_requests = 0;
+
+    static DFSSyncCounters Read(DFSClientNodeP2& node) {
+        DFSSyncCounters counters;
+        dfs_service::MetricsResponse metrics;
+        node.Metrics("dfs_", &metrics, false);
+        for (const dfs_service::MetricValue& metric : metrics.metric()) {
+            if (metric.name() == "dfs_bytes_in_total") { counters.bytes_in = metric.value(); }
+            if (metric.name() == "dfs_bytes_out_total") { counters.bytes_out = metric.value(); }
+            if (metric.name() != "dfs_rpc_latency_us") { continue; }
+            if (metric.labels() == "method=\"fileUploadRequest\"") { counters.uploads = metric.count(); }
+            if (metric.labels() == "method=\"fileFetcher\"") { counters.fetches = metric.count(); }
+            if (metric.labels() == "method=\"CallbackList\"") { counters.callback_lists = metric.count(); }
+            if (metric.labels() == "method=\"fileGetLocker\"") { counters.lock_requests = metric.count(); }
+        }
+        return counters;
+    }
+};
+
+void Usage() {
+    std::cout <<
+        "\nUSAGE: dfs-syncbench-p2 [OPTIONS]\n"
+        "-c, --changes <num>:            Number of changes written in mount A (default: 100)\n"
+        "-F, --files <num>:              Distinct files; the first write to each is a create, later ones modify (default: 10)\n"
+        "-s, --file_size <size>:         Size of each write (default: 4K)\n"
+        "-g, --gap <ms>:                 Pause between changes (default: 200)\n"
+        "-W, --wait <ms>:                Give up on a change after this long (default: 30000)\n"
+        "-a, --address <address>:        Loopback address for the in-process server (default: 127.0.0.1:36903)\n"
+        "-n, --num_async_threads <num>:  Server asynchronous threads (default: 4)\n"
+        "-w, --work_dir <path>:          Directory for the server and both mounts (default: /tmp/dfs-syncbench-<pid>)\n"
+        "-t, --timeout <ms>:             Per call deadline (default: 10000)\n"
+        "-o, --output <path>:            Write results to <path> instead of stdout\n"
+        "-d, --debug_level <level>:      Show logs at this level (default: logs are discarded)\n"
+        "-h, --help:                     Show help\n\n";
+    exit(1);
+}
+
+/**
+ * Mount a DFSClient on its own thread. The client id is derived from the
+ * constructing thread, so each client is created on the thread that mounts it.
+ */
+static void MountClient(const std::string& server_address, const std::string& mount_path, int deadline_timeout) {
+    std::thread mount_thread([=]() {
+        DFSClient* client = new DFSClient();
+        client->SetMountPath(mount_path);
+        client->SetDeadlineTimeout(deadline_timeout);
+        client->InitializeClientNode(server_address);
+        client->Mount(mount_path);
+    });
+    mount_thread.detach();
+}
+
+/**
+ * Write the sequence number header and padding up to size bytes in place,
+ * so the watcher sees IN_CREATE/IN_MODIFY as it would for an editor save
+ */
+static bool WriteChange(const std::string& path, uint64_t sequence, uint64_t size) {
+    std::string contents = "dfs-sync " + std::to_string(sequence) + "\n";
+    if (contents.length() < size) { contents.append(size - contents.length(), static_cast<char>('a' + sequence % 26)); }
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { return false; }
+    bool written = write(fd, contents.data(), contents.length()) == static_cast<ssize_t>(contents.length());
+    close(fd);
+    return written;
+}
+
+/**
+ * The sequence number in a file's header, or -1 if it has none yet
+ */
+static long long ReadSequence(const std::string& path) {
+    char header[32] = {0};
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return -1; }
+    ssize_t length = read(fd, header, sizeof(header) - 1);
+    close(fd);
+    if (length <= 9 || strncmp(header, "dfs-sync ", 9) != 0) { return -1; }
+    return std::atoll(header + 9);
+}
+
+int main(int argc, char** argv) {
+
+    const char* const short_opts = "c:F:s:g:W:a:n:w:t:o:d:h";
+
+    const option long_opts[] = {
+        {"changes", optional_argument, nullptr, 'c'},
+        {"files", optional_argument, nullptr, 'F'},
+        {"file_size", optional_argument, nullptr, 's'},
+        {"gap", optional_argument, nullptr, 'g'},
+        {"wait", optional_argument, nullptr, 'W'},
+        {"address", optional_argument, nullptr, 'a'},
+        {"num_async_threads", optional_argument, nullptr, 'n'},
+        {"work_dir", optional_argument, nullptr, 'w'},
+        {"timeout", optional_argument, nullptr, 't'},
+        {"output", optional_argument, nullptr, 'o'},
+        {"debug_level", optional_argument, nullptr, 'd'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, no_argument, nullptr, 0}
+    };
+
+    char option_char;
+    int changes = 100;
+    int files = 10;
+    uint64_t file_size = 4096;
+    int gap = 200;
+    int wait = 30000;
+    int num_async_threads = 4;
+    int deadline_timeout = 10000;
+    int debug_level = -1;
+    std::string output_path = "";
+    std::string server_address = "127.0.0.1:36903";
+    std::string work_dir = "/tmp/dfs-syncbench-" + std::to_string(getpid());
+
+    while((option_char = getopt_long(argc, argv, short_opts, long_opts, nullptr)) != -1) {
+        switch(option_char) {
+            case 'c':
+                changes = std::stoi(optarg);
+                break;
+            case 'F':
+                files = std::stoi(optarg);
+                break;
+            case 's':
+                file_size = dfs_bench_parse_size(optarg);
+                break;
+            case 'g':
+                gap = std::stoi(optarg);
+                break;
+            case 'W':
+                wait = std::stoi(optarg);
+                break;
+            case 'a':
+                server_address = std::string(optarg);
+                break;
+            case 'n':
+                num_async_threads = std::stoi(optarg);
+                break;
+            case 'w':
+                work_dir = std::string(optarg);
+                break;
+            case 't':
+                deadline_timeout = std::stoi(optarg);
+                break;
+            case 'o':
+                output_path = std::string(optarg);
+                break;
+            case 'd':
+                debug_level = std::stoi(optarg);
+                break;
+            case 'h':
+            case '?':
+            default:
+                Usage();
+                break;
+        }
+    }
+
+    if (changes <= 0 || files <= 0) {
+        Usage();
+    }
+
+    FILE* null_output = nullptr;
+    if (debug_level < 0) {
+        null_output = fopen("/dev/null", "w");
+        dfs_log_set_output(null_output);
+    }
+    else if (debug_level > 0 && debug_level <= 3) {
+        DFS_LOG_LEVEL = static_cast<dfs_log_level_e>(debug_level + 1);
+    }
+
+    FILE* output = stdout;
+    if (!output_path.empty() && (output = fopen(output_path.c_str(), "w")) == nullptr) {
+        std::cerr << "Unable to open " << output_path << std::endl;
+        return 1;
+    }
+
+    if (!dfs_bench_start_server(server_address, dfs_clean_path(work_dir + "/server"), num_async_threads)) {
+        std::cerr << "Server did not start on " << server_address << std::endl;
+        return 1;
+    }
+
+    std::string mount_a = dfs_clean_path(work_dir + "/client-a");
+    std::string mount_b = dfs_clean_path(work_dir + "/client-b");
+    dfs_bench_mkdirs(mount_a);
+    dfs_bench_mkdirs(mount_b);
+    MountClient(server_address, mount_a, deadline_timeout);
+    MountClient(server_address, mount_b, deadline_timeout);
+
+    DFSClientNodeP2 control_node;
+    control_node.SetDeadlineTimeout(deadline_timeout);
+    control_node.CreateStub(grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials()));
+
+    // Let both watchers and sync threads start before the first change
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    DFSSyncCounters before = DFSSyncCounters::Read(control_node);
+
+    DFSHistogram latency[2];
+    const char* kinds[2] = {"create", "modify"};
+    uint64_t lost[2] = {0, 0};
+    auto run_start = std::chrono::steady_clock::now();
+
+    std::cerr << "Writing " << changes << " changes" << std::endl;
+    for (int sequence = 0; sequence < changes; sequence++) {
+        std::string filename = "sync-" + std::to_string(sequence % files) + ".txt";
+        int kind = sequence < files ? 0 : 1;
+
+        auto start = std::chrono::steady_clock::now();
+        if (!WriteChange(mount_a + filename, static_cast<uint64_t>(sequence), file_size)) {
+            std::cerr << "Unable to write " << mount_a + filename << std::endl;
+            return 1;
+        }
+
+        bool arrived = false;
+        while (dfs_bench_elapsed_us(start) < static_cast<uint64_t>(wait) * 1000) {
+            if (ReadSequence(mount_b + filename) == sequence) {
+                arrived = true;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+        if (arrived) { latency[kind].Record(dfs_bench_elapsed_us(start)); }
+        else { lost[kind]++; }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(gap));
+    }
+    uint64_t run_us = dfs_bench_elapsed_us(run_start);
+    DFSSyncCounters after = DFSSyncCounters::Read(control_node);
+
+    std::vector<DFSBenchResult> results;
+    for (int kind = 0; kind < 2; kind++) {
+        DFSBenchResult result;
+        result.operation = kinds[kind];
+        result.file_size = file_size;
+        result.concurrency = 2;
+        result.errors = lost[kind];
+        result.bytes = latency[kind].Count() * file_size;
+        result.wall_us = run_us;
+        result.FromHistogram(latency[kind]);
+        results.push_back(result);
+    }
+    dfs_bench_write_results(output, results, false);
+
+    double per_change = 1.0 / changes;
+    fprintf(output, "\nmetric,value\n");
+    fprintf(output, "changes,%d\n", changes);
+    fprintf(output, "lost_changes,%llu\n", (unsigned long long) (lost[0] + lost[1]));
+    fprintf(output, "bytes_in_per_change,%.1f\n", (after.bytes_in - before.bytes_in) * per_change);
+    fprintf(output, "bytes_out_per_change,%.1f\n", (after.bytes_out - before.bytes_out) * per_change);
+    fprintf(output, "payload_amplification,%.2f\n",
+            static_cast<double>((after.bytes_in - before.bytes_in) + (after.bytes_out - before.bytes_out)) /
+            (static_cast<double>(file_size) * changes));
+    fprintf(output, "uploads_per_change,%.2f\n", (after.uploads - before.uploads) * per_change);
+    fprintf(output, "fetches_per_change,%.2f\n", (after.fetches - before.fetches) * per_change);
+    fprintf(output, "lock_requests_per_change,%.2f\n", (after.lock_requests - before.lock_requests) * per_change);
+    fprintf(output, "callback_lists_per_change,%.1f\n", (after.callback_lists - before.callback_lists) * per_change);
+    fflush(output);
+    if (output != stdout) { fclose(output); }
+
+    // The server and both mounts run until the process exits
+    dfs_log_flush();
+    _exit(0);
+}
@@ -3,12 +3,22 @@
 
 #include <string>
 #include <fstream>
+#include <iostream>
 #include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #define CRCPP_USE_CPP11
 #include "CRC.h"
 
+#include "dfslibx-log.h"
+#include "dfslibx-crc32.h"
+
 #define DFS_BUFFERSIZE 0x1000
 
 /**
@@ -28,8 +38,61 @@ inline std::string dfs_clean_path(const std::string& path) {
     return mount_path;
 }
 
+/** Files the server keeps for itself in its mount start with this and are never listed or served **/
+#define DFS_RESERVED_PREFIX ".dfs-"
+
+/**
+ * True if name is reserved for the server's own files in its mount
+ *
+ * @param name
+ * @return
+ */
+inline bool dfs_reserved_name(const std::string& name) {
+    return name.compare(0, sizeof(DFS_RESERVED_PREFIX) - 1, DFS_RESERVED_PREFIX) == 0;
+}
+
 /**
- * Calculate the crc checksum for a file
+ * True if the file has fewer blocks allocated than its size, so it has holes
+ *
+ * @param st
+ * @return
+ */
+inline bool dfs_file_is_sparse(const struct stat& st) {
+    return static_cast<off_t>(st.st_blocks) * 512 < st.st_size;
+}
+
+/**
+ * Find the first data extent of fd that starts before end, at or after
+ * offset, with SEEK_DATA and SEEK_HOLE. A filesystem that can not report
+ * holes has all of [offset, end) as data.
+ *
+ * @param fd
+ * @param offset
+ * @param end
+ * @param data_start - set to the start of the extent
+ * @param data_end - set to the end of the extent, at most end
+ * @return false if there is no data in [offset, end)
+ */
+inline bool dfs_next_data_extent(int fd, off_t offset, off_t end, off_t* data_start, off_t* data_end) {
+    off_t start = lseek(fd, offset, SEEK_DATA);
+    if (start < 0) {
+        if (errno == ENXIO) {
+            return false;
+        }
+        start = offset;
+    }
+    if (start >= end) {
+        return false;
+    }
+    off_t stop = lseek(fd, start, SEEK_HOLE);
+    *data_start = start;
+    *data_end = stop < 0 || stop > end ? end : stop;
+    return true;
+}
+
+/**
+ * Calculate the crc checksum for a file. Whole chunks that fall in holes
+ * of a sparse file are checksummed as zeros without being read.
  *
  * @param filepath
  * @param table
@@ -41,8 +104,8 @@ inline std::uint32_t dfs_file_checksum(const std::string &filepath, CRC::Table<s
     size_t file_size;
     std::uint32_t crc = 0;
     std::ifstream stream;
-    uint32_t chunk_count = 0;
-    uint32_t chunk_sequence = 0;
+    uint64_t chunk_count = 0;
+    uint64_t chunk_sequence = 0;
     std::ifstream::pos_type current_position = 0;
 
     stream.seekg(0, std::ios::beg);
@@ -65,8 +128,8 @@ inline std::uint32_t dfs_file_checksum(const std::string &filepath, CRC::Table<s
 
     char buffer[buffer_size];
 
-    chunk_count = static_cast<uint32_t>(file_size / buffer_size) +
-                  static_cast<uint32_t>(static_cast<bool>(file_size % buffer_size));
+    chunk_count = static_cast<uint64_t>(file_size / buffer_size) +
+                  static_cast<uint64_t>(static_cast<bool>(file_size % buffer_size));
 
     stream.open(filepath, std::ios::in | std::ios::binary);
 
@@ -74,12 +137,38 @@ inline std::uint32_t dfs_file_checksum(const std::string &filepath, CRC::Table<s
         return 0;
     }
 
+    // Holes are only looked for in files that have some
+    int hole_fd = dfs_file_is_sparse(st) ? open(filepath.c_str(), O_RDONLY) : -1;
+    off_t data_start = 0;
+    off_t data_end = 0;
+
     while(chunk_count != chunk_sequence) {
+        off_t position = static_cast<off_t>(current_position);
+        if (hole_fd >= 0 && position >= data_end) {
+            if (!dfs_next_data_extent(hole_fd, position, static_cast<off_t>(file_size), &data_start, &data_end)) {
+                data_start = data_end = static_cast<off_t>(file_size);
+            }
+            // Only full chunks are skipped, the last partial one is always read
+            uint64_t skip = std::min(static_cast<uint64_t>(data_start - position) / buffer_size,
+                                     static_cast<uint64_t>(file_size / buffer_size) - chunk_sequence);
+            if (skip > 0) {
+                crc = dfs_crc32_zeros(crc, skip * buffer_size);
+                memset(buffer, 0, buffer_size);
+                chunk_sequence += skip;
+                current_position = position + static_cast<off_t>(skip * buffer_size);
+                stream.seekg(current_position);
+                continue;
+            }
+        }
+
         size_t read_size = (file_size - current_position < buffer_size) ?
                            file_size - current_position :
                            buffer_size;
 
         if (!stream.read(buffer, read_size)) {
+            if (hole_fd >= 0) {
+                close(hole_fd);
+            }
             return crc;
 
         }
@@ -91,69 +180,177 @@ inline std::uint32_t dfs_file_checksum(const std::string &filepath, CRC::Table<s
 
     }
 
+    if (hole_fd >= 0) {
+        close(hole_fd);
+    }
     return crc;
 
 }
 
 /**
- * Logging levels
+ * The checksum dfs_file_checksum gives a file holding exactly data, so
+ * content already in memory is checked against a listed checksum without
+ * writing it out first. Like the file version it takes chunks of half a
+ * small file, and checksums the whole buffer for a last partial chunk:
+ * the chunk followed by the tail of the chunk before it.
+ *
+ * @param data
+ * @param size
+ * @return
  */
-enum dfs_log_level_e {LL_SYSINFO, LL_ERROR, LL_DEBUG, LL_DEBUG2, LL_DEBUG3};
+inline std::uint32_t dfs_content_checksum(const char* data, size_t size) {
+    size_t buffer_size = DFS_BUFFERSIZE;
+    if (size < DFS_BUFFERSIZE) {
+        buffer_size = std::max<size_t>(size / 2, 1);
+    }
+
+    size_t full = size - size % buffer_size;
+    std::uint32_t crc = dfs_crc32_slice8(data, full);
+    if (full < size) {
+        size_t tail = size - full;
+        crc = dfs_crc32_slice8(data + full, tail, crc);
+        crc = dfs_crc32_slice8(data + full - buffer_size + tail, buffer_size - tail, crc);
+    }
+    return crc;
+}
 
 /**
- * Simple logging class
- *
- * This is a simple multi-tiered logging class
- * that can be used throughout the project.
+ * Write all of data to fd, retrying short and interrupted writes
  *
- * The `dfs_log` utility defined below provides the interface
- * and acts as a streaming input that you can send information to.
- *
- * You can set the log-level when you use the `dfs-client` or `dfs-server`
- * commands.
- *
- * NOTE: during testing, the log will only output DEBUG1 and up levels (i.e., LL_DEBUG, LL_ERROR, LL_SYSINFO)
- *
- * Usage:
- *
- *      dfs_log(LL_DEBUG) << "Type your message here: " << add_a_variable << ", and more info, etc."
+ * @param fd
+ * @param data
+ * @param length
+ * @return false if a write failed, with errno set
+ */
+inline bool dfs_write_fully(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+/**
+ * Write all of data to fd at offset, retrying short and interrupted writes
  *
+ * @param fd
+ * @param data
+ * @param length
+ * @param offset
+ * @return false if a write failed, with errno set
  */
-class DFSLog
-{
-    private:
-        std::ostringstream buffer;
-
-    public:
-        DFSLog(dfs_log_level_e level = LL_ERROR) {
-#ifdef DFS_GRADER
-            std::string desc = level == LL_SYSINFO ? "-S" : (level == LL_ERROR ? "!E" : ">D");
-#else
-            std::string desc = level == LL_SYSINFO ? "-- SYSINFO" : (level == LL_ERROR ? "!! ERROR" : ">> DEBUG");
-#endif
-            buffer << desc << ((level > 1) ? std::to_string(level - 1) : "") << ": ";
+inline bool dfs_pwrite_fully(int fd, const char* data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
         }
+        data += written;
+        offset += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
 
-        template <typename  T>
-            DFSLog & operator<<(T const & value) {
-                buffer << value;
-                return *this;
-            }
+/**
+ * Replace the contents of the file at path with data
+ *
+ * @param path
+ * @param data
+ * @param length
+ * @return false if the file could not be opened or written, with errno set
+ */
+inline bool dfs_write_file(const std::string& path, const char* data, size_t length) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = dfs_write_fully(fd, data, length);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return written;
+}
 
-        ~DFSLog() {
-            buffer << std::endl;
-            std::cerr << buffer.str();
+/**
+ * Read length bytes of fd at offset, retrying short and interrupted reads
+ *
+ * @param fd
+ * @param data
+ * @param length
+ * @param offset
+ * @return false if a read failed or hit the end of the file
+ */
+inline bool dfs_pread_fully(int fd, char* data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t result = pread(fd, data, length, offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
         }
-};
+        if (result <= 0) {
+            return false;
+        }
+        data += result;
+        offset += result;
+        length -= static_cast<size_t>(result);
+    }
+    return true;
+}
 
 /**
- * Log level defined in dfslib-shared-*.cpp
+ * Free the blocks of [offset, offset + length) in fd without changing its
+ * size. Meant for preallocated ranges that were never written, which read
+ * back as zeros whether or not this succeeds.
+ *
+ * @param fd
+ * @param offset
+ * @param length
+ * @return false if the filesystem could not punch the hole
  */
-extern dfs_log_level_e DFS_LOG_LEVEL;
+inline bool dfs_punch_hole(int fd, off_t offset, off_t length) {
+    return length <= 0 || fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0;
+}
 
 /**
- * Utility function for logging details to std::cerr
+ * Call callback(name, stat) for every regular file in a directory, except
+ * the reserved names the server and client keep for themselves
+ *
+ * @param directory - must end with a directory separator
+ * @param callback
+ * @return the number of regular files, or -1 if the directory could not be opened
  */
-#define dfs_log(_level) if (_level > DFS_LOG_LEVEL) ; else DFSLog(_level)
+template <typename Callback>
+inline long dfs_scan_files(const std::string& directory, Callback callback) {
+    DIR* dr = opendir(directory.c_str());
+    if (dr == nullptr) {
+        return -1;
+    }
+
+    long count = 0;
+    struct dirent* en;
+    struct stat st;
+    while ((en = readdir(dr)) != nullptr) {
+        std::string name = en->d_name;
+        if (dfs_reserved_name(name)) {
+            continue;
+        }
+        if (stat((directory + name).c_str(), &st) == 0 && st.st_mode & S_IFREG) {
+            callback(name, st);
+            count++;
+        }
+    }
+    closedir(dr);
+    return count;
+}
 
-#endif //PR4_DFS_LOG_H
+#endif //PR4_DFS_UTILS_H
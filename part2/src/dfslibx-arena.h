@@ -0,0 +1,32 @@
+#ifndef PR4_DFS_ARENA_H
+#define PR4_DFS_ARENA_H
+
+#include <cstddef>
+#include <google/protobuf/arena.h>
+
+/** First block a listing arena takes from the allocator **/
+#define DFS_ARENA_START_BLOCK 0x4000
+
+/** Largest block a listing arena grows to, so a big listing takes few blocks **/
+#define DFS_ARENA_MAX_BLOCK 0x400000
+
+/** Stack block a CallbackList request is parsed into **/
+#define DFS_ARENA_REQUEST_BLOCK 0x400
+
+/**
+ * Options for an arena that holds a listing: every message, string and
+ * repeated field of it comes out of a few large blocks, and they are all
+ * freed at once with the arena instead of one by one.
+ *
+ * @param initial - a block to use first, such as one on the stack, or null
+ */
+inline google::protobuf::ArenaOptions dfs_arena_options(char* initial = nullptr, size_t initial_size = 0) {
+    google::protobuf::ArenaOptions options;
+    options.start_block_size = DFS_ARENA_START_BLOCK;
+    options.max_block_size = DFS_ARENA_MAX_BLOCK;
+    options.initial_block = initial;
+    options.initial_block_size = initial_size;
+    return options;
+}
+
+#endif //PR4_DFS_ARENA_H
@@ -0,0 +1,60 @@
+#include <mutex>
+#include <thread>
+#include <functional>
+
+#include "dfslibx-bundle.h"
+
+DFSBundleWorkers::DFSBundleWorkers(size_t max_threads, size_t window) :
+    max_threads(max_threads > 0 ? max_threads : 1), window(window > 0 ? window : 1) {}
+
+DFSBundleWorkers::~DFSBundleWorkers() {
+    {
+        std::unique_lock<std::mutex> lock(task_mutex);
+        task_done.wait(lock, [this] { return tasks.empty() && running == 0; });
+        closed = true;
+    }
+    task_ready.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void DFSBundleWorkers::Submit(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(task_mutex);
+    task_done.wait(lock, [this] { return tasks.size() < window; });
+    tasks.push_back(std::move(task));
+    //A bundle of a few files only starts the threads it keeps busy
+    if (idle == 0 && threads.size() < max_threads) {
+        threads.emplace_back(&DFSBundleWorkers::Work, this);
+    }
+    lock.unlock();
+    task_ready.notify_one();
+}
+
+void DFSBundleWorkers::Wait() {
+    std::unique_lock<std::mutex> lock(task_mutex);
+    task_done.wait(lock, [this] { return tasks.empty() && running == 0; });
+}
+
+void DFSBundleWorkers::Work() {
+    std::unique_lock<std::mutex> lock(task_mutex);
+    while (true) {
+        idle++;
+        task_ready.wait(lock, [this] { return closed || !tasks.empty(); });
+        idle--;
+        if (tasks.empty()) {
+            return;
+        }
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        running++;
+        lock.unlock();
+        task_done.notify_all();
+
+        task();
+
+        lock.lock();
+        running--;
+        task_done.notify_all();
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef PR4_DFS_BUNDLE_H
+#define PR4_DFS_BUNDLE_H
+
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+/** Files up to this size are synced in bundles by default (0 disables bundling) **/
+#define DFS_BUNDLE_THRESHOLD 0x10000
+
+/** A bundle message is sent once its records add up to this many bytes **/
+#define DFS_BUNDLE_MESSAGE_BYTES 0x100000
+
+/** Files asked for in one bundle RPC, longer lists are split over several **/
+#define DFS_BUNDLE_MAX_FILES 1024
+
+/** Largest file the server puts in a bundle, larger ones are left to fileFetcher **/
+#define DFS_BUNDLE_MAX_RECORD 0x100000
+
+/** Files up to this size are inlined in a change listing by default (0 disables) **/
+#define DFS_INLINE_THRESHOLD 0x1000
+
+/** Bytes of file content inlined in one change listing by default **/
+#define DFS_INLINE_BUDGET 0x40000
+
+/**
+ * Largest inline threshold and budget the server grants a client. The budget
+ * stays well under gRPC's default 4MB receive limit, so content plus the
+ * listing itself still fits in one CallbackList reply.
+ */
+#define DFS_INLINE_MAX_THRESHOLD 0x10000
+#define DFS_INLINE_MAX_BUDGET 0x100000
+
+/** Threads applying the records of one bundle **/
+#define DFS_BUNDLE_WORKERS 4
+
+/** Records queued or read ahead of the ones being applied or sent **/
+#define DFS_BUNDLE_WINDOW 64
+
+/**
+ * Small pool that applies the records of one bundle in parallel. Threads
+ * are started as tasks arrive, up to the thread limit, and Submit waits
+ * while window tasks are already queued so a fast sender can not buffer a
+ * whole bundle in memory. The destructor waits for every task.
+ */
+class DFSBundleWorkers {
+private:
+    size_t max_threads;
+    size_t window;
+
+    std::mutex task_mutex;
+    std::condition_variable task_ready;
+    std::condition_variable task_done;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> threads;
+    size_t idle = 0;
+    size_t running = 0;
+    bool closed = false;
+
+    void Work();
+
+public:
+    explicit DFSBundleWorkers(size_t max_threads = DFS_BUNDLE_WORKERS, size_t window = DFS_BUNDLE_WINDOW);
+    ~DFSBundleWorkers();
+
+    void Submit(std::function<void()> task);
+
+    /**
+     * Wait until every submitted task has finished
+     */
+    void Wait();
+};
+
+#endif //PR4_DFS_BUNDLE_H
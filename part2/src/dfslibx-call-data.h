@@ -1,10 +1,77 @@
 #ifndef PR4_DFSCALLDATAMANAGER_H
 #define PR4_DFSCALLDATAMANAGER_H
 
+#include <atomic>
+#include <chrono>
 #include <grpcpp/grpcpp.h>
 #include "dfs-utils.h"
+#include "dfslibx-free-list.h"
 #include "../proto-src/dfs-service.grpc.pb.h"
 
+/**
+ * Per completion queue counters. Each queue owns one of these and every
+ * DFSCallData spawned on that queue reports into it, so the load on each
+ * queue (and therefore each async thread) can be compared.
+ */
+struct DFSQueueStats {
+    /** Index of the completion queue these stats belong to **/
+    int queue_index = 0;
+
+    /** CPU the draining thread is pinned to, or -1 when unpinned **/
+    int cpu = -1;
+
+    /** Completion queue events handled by the draining thread **/
+    std::atomic<uint64_t> events{0};
+
+    /** Calls that have been accepted but not yet finished (queue depth) **/
+    std::atomic<int64_t> depth{0};
+
+    /** The highest depth seen since the queue started **/
+    std::atomic<int64_t> max_depth{0};
+
+    /** Number of calls that completed on this queue **/
+    std::atomic<uint64_t> completed{0};
+
+    /** Sum and maximum of accept-to-finish latency in microseconds **/
+    std::atomic<uint64_t> total_latency_us{0};
+    std::atomic<uint64_t> max_latency_us{0};
+
+    void CallStarted() {
+        int64_t current = ++depth;
+        int64_t seen = max_depth.load(std::memory_order_relaxed);
+        while (current > seen && !max_depth.compare_exchange_weak(seen, current, std::memory_order_relaxed)) {}
+    }
+
+    void CallFinished(uint64_t latency_us) {
+        --depth;
+        ++completed;
+        total_latency_us.fetch_add(latency_us, std::memory_order_relaxed);
+        uint64_t seen = max_latency_us.load(std::memory_order_relaxed);
+        while (latency_us > seen && !max_latency_us.compare_exchange_weak(seen, latency_us, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t MeanLatencyUs() const {
+        uint64_t count = completed.load(std::memory_order_relaxed);
+        return count == 0 ? 0 : total_latency_us.load(std::memory_order_relaxed) / count;
+    }
+};
+
+/**
+ * A call whose reply is sent after ProcessCallback returns. Exactly one of
+ * Reply or Fail must be called, once, from any thread.
+ *
+ * @tparam ResponseT
+ */
+template <typename ResponseT>
+class DFSPendingCall {
+public:
+    virtual ~DFSPendingCall() {}
+    virtual void Reply(const ResponseT& reply) = 0;
+
+    /** Finish the call with an error status and no reply **/
+    virtual void Fail(const grpc::Status& status) = 0;
+};
+
 /**
  * Virtual class meant to be inherited by the DFSServiceImpl class. It is used
  * solely to abstract certain callback features and make them available in the
@@ -22,7 +89,13 @@ public:
                                  grpc::ServerAsyncResponseWriter<ResponseT>* responder,
                                  grpc::ServerCompletionQueue* cq,
                                  void* tag) {}
-    virtual void ProcessCallback(grpc::ServerContext* context, RequestT* request, ResponseT* response) {}
+
+    /**
+     * Fill response and return true to reply right away, or keep call and
+     * return false to reply or fail through it, now or later
+     */
+    virtual bool ProcessCallback(grpc::ServerContext* context, RequestT* request, ResponseT* response,
+                                 DFSPendingCall<ResponseT>* call) { return true; }
 
 };
 
@@ -36,7 +109,7 @@ public:
  * @tparam ResponseT
  */
 template <typename RequestT, typename ResponseT>
-class DFSCallData {
+class DFSCallData : public DFSPendingCall<ResponseT> {
 
 private:
 
@@ -49,6 +122,12 @@ private:
     // The producer-consumer queue where for asynchronous server notifications.
     grpc::ServerCompletionQueue* cq;
 
+    // The counters for the queue this call lives on (may be null).
+    DFSQueueStats* stats;
+
+    // When the call was accepted, used for the queue latency stats.
+    std::chrono::steady_clock::time_point accepted;
+
     // Context for the rpc, allowing to tweak aspects of it such as the use
     // of compression, authentication, as well as to send metadata back to the
     // client.
@@ -68,12 +147,18 @@ private:
     CallStatus status;  // The current serving state.
 
 public:
+    // One of these is created and freed for every call, so their memory is
+    // recycled on the queue threads instead of going back to the allocator.
+    static void* operator new(size_t size) { return DFSFreeList<DFSCallData>::Allocate(size); }
+    static void operator delete(void* memory, size_t size) { DFSFreeList<DFSCallData>::Release(memory, size); }
+
     // Take in the "service" instance (in this case representing an asynchronous
     // server) and the completion queue "cq" used for asynchronous communication
     // with the gRPC runtime.
     DFSCallData(dfs_service::DFSService::AsyncService* service,
-        DFSCallDataManager<RequestT, ResponseT>* manager, grpc::ServerCompletionQueue* cq) :
-        service(service), manager(manager), cq(cq), responder(&ctx_), status(CREATE) {
+        DFSCallDataManager<RequestT, ResponseT>* manager, grpc::ServerCompletionQueue* cq,
+        DFSQueueStats* stats = nullptr) :
+        service(service), manager(manager), cq(cq), stats(stats), responder(&ctx_), status(CREATE) {
 
         dfs_log(LL_DEBUG3) << "DFSCallDataManager[constructor]";
         // Invoke the serving logic right away.
@@ -103,25 +188,54 @@ public:
             // Spawn a new CallData instance to serve new clients while we process
             // the one for this CallData. The instance will deallocate itself as
             // part of its FINISH state.
-            new DFSCallData<RequestT, ResponseT>(service, manager, cq);
+            new DFSCallData<RequestT, ResponseT>(service, manager, cq, stats);
 
-            manager->ProcessCallback(&ctx_, &request_, &reply_);
+            accepted = std::chrono::steady_clock::now();
+            if (stats) { stats->CallStarted(); }
 
-            // And we are done! Let the gRPC runtime know we've finished, using the
-            // memory address of this instance as the uniquely identifying tag for
-            // the event.
-            status = FINISH;
-            responder.Finish(reply_, grpc::Status::OK, this);
+            // The manager may hold on to the call and reply later
+            if (manager->ProcessCallback(&ctx_, &request_, &reply_, this)) {
+                Reply(reply_);
+            }
         } else {
             dfs_log(LL_DEBUG3) << "Proceed[Finish]";
             // GPR_ASSERT(status == FINISH);
             if (status != FINISH) {
                 dfs_log(LL_ERROR) << "HandleAsyncRPC finish status was invalid.";
             }
+            if (stats) {
+                stats->CallFinished(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - accepted).count()));
+            }
             // Once in the FINISH state, deallocate ourselves (CallData).
             delete this;
         }
     }
+
+    /**
+     * Let the gRPC runtime know we've finished, using the memory address of
+     * this instance as the uniquely identifying tag for the event
+     */
+    void Reply(const ResponseT& reply) override {
+        status = FINISH;
+        responder.Finish(reply, grpc::Status::OK, this);
+    }
+
+    void Fail(const grpc::Status& error) override {
+        status = FINISH;
+        responder.FinishWithError(error, this);
+    }
+
+    /**
+     * Called when an event for this call completed without ok. A reply that
+     * could not be sent, because the client went away while the call was
+     * held, still has to free the call.
+     */
+    void Abandon() {
+        if (status == FINISH) {
+            Proceed();
+        }
+    }
 };
 
 #endif //PR4_DFSCALLDATAMANAGER_H
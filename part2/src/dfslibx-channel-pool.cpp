@@ -0,0 +1,126 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "dfs-utils.h"
+#include "dfslibx-channel-pool.h"
+
+static int64_t SteadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool DFSLane::Healthy() {
+    //Asking for a connection lets a lane that failed reconnect in the background
+    grpc_connectivity_state state = channel->GetState(true);
+    if (state == GRPC_CHANNEL_TRANSIENT_FAILURE || state == GRPC_CHANNEL_SHUTDOWN) {
+        return false;
+    }
+    if (failures < DFS_LANE_MAX_FAILURES) {
+        return true;
+    }
+    //A lane whose calls keep failing, connected or not, only gets one probe
+    //call per cooldown; the caller that moves probe_at on sends it
+    int64_t now = SteadyNowNs();
+    int64_t due = probe_at.load();
+    return now >= due && probe_at.compare_exchange_strong(due, now + DFS_LANE_COOLDOWN_MS * 1000000LL);
+}
+
+DFSLaneLease::DFSLaneLease(DFSLane* lane, dfs_service::DFSService::Stub* stub) : lane(lane), stub(stub) {
+    if (lane != nullptr) {
+        lane->active++;
+    }
+}
+
+DFSLaneLease::DFSLaneLease(DFSLaneLease&& other) noexcept : lane(other.lane), stub(other.stub) {
+    other.lane = nullptr;
+}
+
+DFSLaneLease::~DFSLaneLease() {
+    if (lane != nullptr) {
+        lane->active--;
+    }
+}
+
+const char* DFSLaneLease::Name() const {
+    return lane != nullptr ? lane->name.c_str() : "default";
+}
+
+void DFSLaneLease::Report(const grpc::Status& status) {
+    if (lane == nullptr) {
+        return;
+    }
+    //Only errors that say the connection is in trouble count against the lane
+    grpc::StatusCode code = status.error_code();
+    if (code == grpc::StatusCode::UNAVAILABLE || code == grpc::StatusCode::DEADLINE_EXCEEDED) {
+        int failures = ++lane->failures;
+        if (failures >= DFS_LANE_MAX_FAILURES) {
+            lane->probe_at = SteadyNowNs() + DFS_LANE_COOLDOWN_MS * 1000000LL;
+        }
+        if (failures == DFS_LANE_MAX_FAILURES) {
+            dfs_log(LL_ERROR) << "Channel pool | Lane " << lane->name << " marked unhealthy: " << status.error_message();
+        }
+    } else if (lane->failures.exchange(0) >= DFS_LANE_MAX_FAILURES) {
+        dfs_log(LL_SYSINFO) << "Channel pool | Lane " << lane->name << " is healthy again";
+    }
+}
+
+DFSChannelPool::DFSChannelPool(const std::string& address, int bulk_lanes, int bulk_window, size_t small_transfer) :
+    small_transfer(small_transfer) {
+    //Default flow control windows keep replies on the control lane small and prompt
+    grpc::ChannelArguments control_args;
+    control_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    control_args.SetInt(GRPC_ARG_HTTP2_BDP_PROBE, 0);
+    control = CreateLane(address, "control", control_args);
+
+    for (int index = 0; index < bulk_lanes; index++) {
+        grpc::ChannelArguments bulk_args;
+        bulk_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        bulk_args.SetInt(GRPC_ARG_HTTP2_BDP_PROBE, 1);
+        bulk_args.SetInt(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, bulk_window);
+        bulk_args.SetInt(GRPC_ARG_MAX_RECEIVE_MESSAGE_LENGTH, -1);
+        //Distinct arguments also keep the lanes apart in a shared subchannel pool
+        bulk_args.SetInt("dfs.lane", index);
+        bulk.push_back(CreateLane(address, "bulk-" + std::to_string(index), bulk_args));
+    }
+    dfs_log(LL_DEBUG) << "Channel pool | Connected to " << address << " with a control lane and "
+                      << bulk.size() << " bulk lanes";
+}
+
+std::unique_ptr<DFSLane> DFSChannelPool::CreateLane(const std::string& address, const std::string& name,
+                                                    const grpc::ChannelArguments& args) {
+    std::unique_ptr<DFSLane> lane(new DFSLane());
+    lane->name = name;
+    lane->channel = grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(), args);
+    lane->stub = dfs_service::DFSService::NewStub(lane->channel);
+    return lane;
+}
+
+DFSLaneLease DFSChannelPool::Transfer(uint64_t size) {
+    if (size >= small_transfer) {
+        //Least busy healthy lane, starting the scan at a rotating lane to break ties
+        DFSLane* chosen = nullptr;
+        unsigned start = next_bulk++;
+        for (size_t step = 0; step < bulk.size(); step++) {
+            DFSLane* lane = bulk[(start + step) % bulk.size()].get();
+            bool failing = lane->failures >= DFS_LANE_MAX_FAILURES;
+            if (!lane->Healthy()) {
+                continue;
+            }
+            if (failing) {
+                //This call is the lane's probe, so it has to go there
+                return DFSLaneLease(lane, lane->stub.get());
+            }
+            if (chosen == nullptr || lane->active < chosen->active) {
+                chosen = lane;
+            }
+        }
+        if (chosen != nullptr) {
+            return DFSLaneLease(chosen, chosen->stub.get());
+        }
+    }
+    return DFSLaneLease(control.get(), control->stub.get());
+}
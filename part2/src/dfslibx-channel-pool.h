@@ -0,0 +1,117 @@
+#ifndef PR4_DFS_CHANNEL_POOL_H
+#define PR4_DFS_CHANNEL_POOL_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <grpcpp/grpcpp.h>
+
+#include "../proto-src/dfs-service.grpc.pb.h"
+
+/** Transfers smaller than this stay on the control lane **/
+#define DFS_SMALL_TRANSFER 0x10000
+
+/** HTTP/2 stream window of a bulk lane, in bytes **/
+#define DFS_BULK_WINDOW 0x800000
+
+/** Consecutive failed calls after which a lane is skipped until one succeeds **/
+#define DFS_LANE_MAX_FAILURES 3
+
+/** How long a failing lane is skipped before one call is let through to probe it **/
+#define DFS_LANE_COOLDOWN_MS 5000
+
+/**
+ * One connection to the server with its own stub and health state
+ */
+struct DFSLane {
+    std::string name;
+    std::shared_ptr<grpc::Channel> channel;
+    std::unique_ptr<dfs_service::DFSService::Stub> stub;
+
+    /** Calls holding a lease on this lane **/
+    std::atomic<int> active{0};
+
+    /** Failed calls since the last one that succeeded **/
+    std::atomic<int> failures{0};
+
+    /** Steady clock time, in nanoseconds, at which a failing lane may be probed **/
+    std::atomic<int64_t> probe_at{0};
+
+    /**
+     * False while the connection is in transient failure or shut down, or
+     * after DFS_LANE_MAX_FAILURES calls in a row failed. A failing lane lets
+     * one caller through every DFS_LANE_COOLDOWN_MS; the lane is healthy
+     * again once a call reports success.
+     */
+    bool Healthy();
+};
+
+/**
+ * A stub borrowed from a lane for the length of one call. Report the call's
+ * status so the lane's health follows the server. A lease without a lane
+ * wraps a plain stub and reports nowhere.
+ */
+class DFSLaneLease {
+private:
+    DFSLane* lane;
+    dfs_service::DFSService::Stub* stub;
+
+public:
+    DFSLaneLease(DFSLane* lane, dfs_service::DFSService::Stub* stub);
+    DFSLaneLease(DFSLaneLease&& other) noexcept;
+    DFSLaneLease(const DFSLaneLease&) = delete;
+    DFSLaneLease& operator=(const DFSLaneLease&) = delete;
+    ~DFSLaneLease();
+
+    dfs_service::DFSService::Stub* Stub() const { return stub; }
+    dfs_service::DFSService::Stub* operator->() const { return stub; }
+
+    /** Name of the lane, "default" for a plain stub **/
+    const char* Name() const;
+
+    void Report(const grpc::Status& status);
+};
+
+/**
+ * Connections a client spreads its calls over. The control lane carries
+ * locks, Stat, List, Delete, the CallbackList long-poll and small transfers.
+ * It keeps gRPC's default flow control windows, so a reply on it is never
+ * queued behind megabytes of file data. Transfers of DFS_SMALL_TRANSFER bytes
+ * or more go to the bulk lanes, which have large stream windows and BDP
+ * probing so a single stream can fill the link.
+ *
+ * Every lane is a separate TCP connection: each channel uses a local
+ * subchannel pool, so HTTP/2 streams on one lane never share a connection
+ * with another lane. With no bulk lanes everything uses the control lane.
+ */
+class DFSChannelPool {
+private:
+    std::unique_ptr<DFSLane> control;
+    std::vector<std::unique_ptr<DFSLane>> bulk;
+    size_t small_transfer;
+    std::atomic<unsigned> next_bulk{0};
+
+    static std::unique_ptr<DFSLane> CreateLane(const std::string& address, const std::string& name,
+                                               const grpc::ChannelArguments& args);
+
+public:
+    DFSChannelPool(const std::string& address, int bulk_lanes,
+                   int bulk_window = DFS_BULK_WINDOW, size_t small_transfer = DFS_SMALL_TRANSFER);
+
+    std::shared_ptr<grpc::Channel> ControlChannel() const { return control->channel; }
+
+    size_t BulkLanes() const { return bulk.size(); }
+
+    /**
+     * The lane for a transfer of size bytes (UINT64_MAX when the size is not
+     * known yet): the control lane for small transfers, otherwise the
+     * healthy bulk lane with the fewest calls in flight. Falls back to the
+     * control lane when no bulk lane is healthy.
+     */
+    DFSLaneLease Transfer(uint64_t size);
+};
+
+#endif //PR4_DFS_CHANNEL_POOL_H
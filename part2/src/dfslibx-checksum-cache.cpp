@@ -0,0 +1,41 @@
+#include <mutex>
+#include <string>
+#include <functional>
+#include <sys/stat.h>
+
+#include "dfslibx-checksum-cache.h"
+
+DFSChecksumCache::DFSChecksumCache() {
+    DFSMetricsRegistry& registry = DFSMetricsRegistry::Instance();
+    hits = registry.Counter("dfs_checksum_cache_hits_total", "File checksums reused from the checksum cache");
+    misses = registry.Counter("dfs_checksum_cache_misses_total", "File checksums computed because the file changed or was new");
+}
+
+uint32_t DFSChecksumCache::Checksum(const std::string& name, const std::string& path, const struct stat& st,
+                                    const std::function<uint32_t()>& compute) {
+    DFSFileVersion version = DFSFileVersion::FromStat(st);
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto found = entries.find(name);
+        if (found != entries.end() && found->second.version == version) {
+            hits->Add();
+            return found->second.checksum;
+        }
+    }
+
+    misses->Add();
+    uint32_t checksum = compute();
+    struct stat current;
+    if (stat(path.c_str(), &current) != 0 || !(DFSFileVersion::FromStat(current) == version)) {
+        return checksum;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    entries[name] = Entry{version, checksum};
+    return checksum;
+}
+
+void DFSChecksumCache::Invalidate(const std::string& name) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    entries.erase(name);
+}
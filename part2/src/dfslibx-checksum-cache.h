@@ -0,0 +1,52 @@
+#ifndef PR4_DFS_CHECKSUM_CACHE_H
+#define PR4_DFS_CHECKSUM_CACHE_H
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include "dfslibx-metrics.h"
+#include "dfslibx-content-cache.h"
+
+/**
+ * File checksums by name, reused while the file keeps the same version.
+ *
+ * Listings and tree builds checksum every file of the mount; with this
+ * cache a scan only reads the files that changed since the last one. As
+ * with DFSContentCache a lookup only hits for the version the caller just
+ * stat'ed, and a checksum is only kept if the file did not change while
+ * it was computed.
+ */
+class DFSChecksumCache {
+private:
+    struct Entry {
+        DFSFileVersion version;
+        uint32_t checksum;
+    };
+
+    std::mutex cache_mutex;
+    std::unordered_map<std::string, Entry> entries;
+
+    DFSCounter* hits;
+    DFSCounter* misses;
+
+public:
+    DFSChecksumCache();
+
+    /**
+     * The checksum of the file name at path, whose stat is st, calling
+     * compute on a miss
+     */
+    uint32_t Checksum(const std::string& name, const std::string& path, const struct stat& st,
+                      const std::function<uint32_t()>& compute);
+
+    /**
+     * Drop the checksum of a deleted file
+     */
+    void Invalidate(const std::string& name);
+};
+
+#endif //PR4_DFS_CHECKSUM_CACHE_H
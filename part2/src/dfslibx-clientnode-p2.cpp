@@ -15,6 +15,7 @@
 #include <sys/inotify.h>
 #include <grpcpp/grpcpp.h>
 #include <utime.h>
+#include <dirent.h>
 
 #include "dfs-utils.h"
 #include "dfslibx-clientnode-p2.h"
@@ -55,10 +56,54 @@ void DFSClientNode::CreateStub(std::shared_ptr <Channel> channel) {
     this->service_stub = dfs_service::DFSService::NewStub(channel);
 }
 
+void DFSClientNode::SetChannelPool(std::shared_ptr<DFSChannelPool> pool) {
+    this->channel_pool = pool;
+    CreateStub(pool->ControlChannel());
+}
+
+DFSLaneLease DFSClientNode::TransferLane(uint64_t size) {
+    if (this->channel_pool) {
+        return this->channel_pool->Transfer(size);
+    }
+    return DFSLaneLease(nullptr, this->service_stub.get());
+}
+
+void DFSClientNode::SetInlining(uint64_t inline_threshold, uint64_t inline_budget) {
+    this->inline_threshold = inline_threshold;
+    this->inline_budget = inline_budget;
+}
+
+void DFSClientNode::SetCompactListings(bool compact_listings) {
+    this->compact_listings = compact_listings;
+}
+
 void DFSClientNode::SetMountPath(const std::string &path) {
     this->mount_path = path;
 }
 
+long DFSClientNode::RemoveStaleParts() {
+    DIR* dr = opendir(this->mount_path.c_str());
+    if (dr == nullptr) {
+        return 0;
+    }
+    long removed = 0;
+    size_t suffix = sizeof(DFS_PART_SUFFIX) - 1;
+    struct dirent* en;
+    while ((en = readdir(dr)) != nullptr) {
+        std::string name = en->d_name;
+        if (!dfs_reserved_name(name) || name.length() < suffix ||
+            name.compare(name.length() - suffix, suffix, DFS_PART_SUFFIX) != 0) {
+            continue;
+        }
+        if (unlink(WrapPath(name).c_str()) == 0) {
+            dfs_log(LL_SYSINFO) << "Removed the partial file of an interrupted fetch: " << name;
+            removed++;
+        }
+    }
+    closedir(dr);
+    return removed;
+}
+
 const std::string DFSClientNode::MountPath() {
     return this->mount_path;
 };
@@ -10,6 +10,13 @@
 
 #include <grpcpp/grpcpp.h>
 #include "../proto-src/dfs-service.grpc.pb.h"
+#include "dfslibx-channel-pool.h"
+#include "dfslibx-bundle.h"
+#include "dfslibx-arena.h"
+#include "dfslibx-free-list.h"
+
+/** Ends the name a striped fetch writes to under the reserved prefix before it is renamed into place **/
+#define DFS_PART_SUFFIX ".part"
 
 /**
  * The containing structure used to pass async data
@@ -17,8 +24,11 @@
 template<typename ResponseT>
 struct AsyncClientData {
 
-    // Protobuf reply container
-    ResponseT reply;
+    // Arena the reply is parsed into, so a listing's entries are freed at once
+    google::protobuf::Arena arena{dfs_arena_options()};
+
+    // Protobuf reply container, on the arena
+    ResponseT* reply = google::protobuf::Arena::CreateMessage<ResponseT>(&arena);
 
     // Context for the client. It could be used to convey extra information to
     // the server and/or tweak certain RPC behaviors.
@@ -30,6 +40,11 @@ struct AsyncClientData {
     // Client Responder based off of the response message type
     std::unique_ptr<grpc::ClientAsyncResponseReader<ResponseT>> response_reader;
 
+    // One of these is created and freed for every long-poll, so their memory
+    // is recycled on the completion queue thread.
+    static void* operator new(size_t size) { return DFSFreeList<AsyncClientData>::Allocate(size); }
+    static void operator delete(void* memory, size_t size) { DFSFreeList<AsyncClientData>::Release(memory, size); }
+
 };
 
 class DFSClientNode {
@@ -54,9 +69,27 @@ protected:
     /** The service stub **/
     std::unique_ptr<dfs_service::DFSService::Stub> service_stub;
 
+    /** Connections calls are spread over, null when everything uses service_stub **/
+    std::shared_ptr<DFSChannelPool> channel_pool;
+
     /** The completion queue for async calls **/
     grpc::CompletionQueue completion_queue;
 
+    /** Files up to this size come inlined in change listings (0 disables) **/
+    uint64_t inline_threshold = DFS_INLINE_THRESHOLD;
+
+    /** Inlined bytes asked for in one change listing **/
+    uint64_t inline_budget = DFS_INLINE_BUDGET;
+
+    /** Newest mtime of the last change listing, only files changed after it are inlined **/
+    int64_t inline_since_ns = 0;
+
+    /** Generation of the last change listing applied, the server holds the next call until it moves on **/
+    uint64_t cbl_generation = 0;
+
+    /** Ask for listings in the compact encoding **/
+    bool compact_listings = true;
+
     /**
      * Utility function to wrap a filename with the mount path.
      *
@@ -82,6 +115,13 @@ public:
      */
     void SetMountPath(const std::string& path);
 
+    /**
+     * Remove the partial files that fetches killed part way left in the mount
+     *
+     * @return the number of files removed
+     */
+    long RemoveStaleParts();
+
     /**
      * Sets the deadline timeout in milliseconds
      * @param deadline
@@ -124,6 +164,42 @@ public:
      */
     void CreateStub(std::shared_ptr<grpc::Channel> channel);
 
+    /**
+     * Use a channel pool: the service stub moves to the pool's control lane
+     * and file transfers go to its bulk lanes.
+     *
+     * @param pool
+     */
+    void SetChannelPool(std::shared_ptr<DFSChannelPool> pool);
+
+    /**
+     * The stub for a transfer of size bytes (UINT64_MAX if not known yet),
+     * chosen by the channel pool, or the service stub without one
+     *
+     * @param size
+     * @return DFSLaneLease
+     */
+    DFSLaneLease TransferLane(uint64_t size);
+
+    /**
+     * Sets the size up to which files changed since the last change listing
+     * are inlined in the next one, and the inlined bytes asked for per
+     * listing. The server may grant less. A threshold of 0 disables it.
+     *
+     * @param inline_threshold
+     * @param inline_budget
+     */
+    void SetInlining(uint64_t inline_threshold, uint64_t inline_budget = DFS_INLINE_BUDGET);
+
+    /**
+     * Ask for file listings in the compact, columnar encoding, or in one
+     * message per file. A server without the compact encoding answers in
+     * messages either way.
+     *
+     * @param compact_listings
+     */
+    void SetCompactListings(bool compact_listings);
+
     /**
      * Store a file from the mount path on to the RPC server
      * @param filename
@@ -198,6 +274,11 @@ public:
         // Data we are sending to the server.
         RequestT request;
         request.set_name("");
+        request.set_inlinethreshold(inline_threshold);
+        request.set_inlinebudget(inline_budget);
+        request.set_inlinesincens(inline_since_ns);
+        request.set_generation(cbl_generation);
+        request.set_compact(compact_listings);
 
         // Call object to store rpc data
         AsyncClientData<ResponseT>* call_data = new AsyncClientData<ResponseT>;
@@ -215,7 +296,7 @@ public:
         // Request that, upon completion of the RPC, "reply" be updated with the
         // server's response; "status" with the indication of whether the operation
         // was successful. Tag the request with the memory address of the call_data object.
-        call_data->response_reader->Finish(&call_data->reply, &call_data->status, (void*)call_data);
+        call_data->response_reader->Finish(call_data->reply, &call_data->status, (void*)call_data);
 
     }
 
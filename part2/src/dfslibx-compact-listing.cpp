@@ -0,0 +1,57 @@
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include "dfslibx-compact-listing.h"
+
+void DFSCompactListingBuilder::Finish(dfs_service::CompactListing* listing, std::vector<uint32_t>* order) {
+    std::vector<uint32_t> sorted(rows.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [this](uint32_t a, uint32_t b) { return *rows[a].name < *rows[b].name; });
+
+    int count = static_cast<int>(rows.size());
+    size_t blob = 0;
+    for (const Row& row : rows) {
+        blob += row.name->length();
+    }
+    std::string* suffixes = listing->mutable_suffixes();
+    suffixes->reserve(blob);
+    listing->mutable_shared()->Reserve(count);
+    listing->mutable_suffixlength()->Reserve(count);
+    listing->mutable_mtimens()->Reserve(count);
+    if (with_size) {
+        listing->mutable_filesize()->Reserve(count);
+    }
+    if (with_checksum) {
+        listing->mutable_filechecksum()->Reserve(count);
+    }
+
+    const std::string* previous = nullptr;
+    for (uint32_t index : sorted) {
+        const Row& row = rows[index];
+        const std::string& name = *row.name;
+        size_t shared = 0;
+        if (previous != nullptr) {
+            size_t limit = std::min(previous->length(), name.length());
+            while (shared < limit && (*previous)[shared] == name[shared]) {
+                shared++;
+            }
+        }
+        listing->add_shared(static_cast<uint32_t>(shared));
+        listing->add_suffixlength(static_cast<uint32_t>(name.length() - shared));
+        suffixes->append(name, shared, std::string::npos);
+        listing->add_mtimens(static_cast<uint64_t>(row.mtime_ns));
+        if (with_size) {
+            listing->add_filesize(static_cast<uint64_t>(row.size));
+        }
+        if (with_checksum) {
+            listing->add_filechecksum(row.checksum);
+        }
+        previous = &name;
+    }
+
+    if (order != nullptr) {
+        order->swap(sorted);
+    }
+}
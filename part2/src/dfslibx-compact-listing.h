@@ -0,0 +1,85 @@
+#ifndef PR4_DFS_COMPACT_LISTING_H
+#define PR4_DFS_COMPACT_LISTING_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "../proto-src/dfs-service.pb.h"
+
+/**
+ * Builds a CompactListing: the names sorted and prefix compressed into one
+ * blob, and one packed array per column. A column nothing was added to
+ * stays empty, so a listing only pays for what its reader uses.
+ *
+ * Names are not copied, each must outlive Finish.
+ */
+class DFSCompactListingBuilder {
+private:
+    struct Row {
+        const std::string* name;
+        int64_t size;
+        int64_t mtime_ns;
+        uint32_t checksum;
+    };
+
+    std::vector<Row> rows;
+    bool with_size;
+    bool with_checksum;
+
+public:
+    DFSCompactListingBuilder(bool with_size, bool with_checksum) : with_size(with_size), with_checksum(with_checksum) {}
+
+    void Reserve(size_t count) { rows.reserve(count); }
+
+    void Add(const std::string& name, int64_t size, int64_t mtime_ns, uint32_t checksum) {
+        rows.push_back({&name, size, mtime_ns, checksum});
+    }
+
+    /**
+     * Sort by name and encode into listing
+     *
+     * @param listing
+     * @param order - if not null, set to the Add index of each encoded row
+     */
+    void Finish(dfs_service::CompactListing* listing, std::vector<uint32_t>* order = nullptr);
+};
+
+/**
+ * Call callback(row, name, size, mtime_ns, checksum) for each row of a
+ * CompactListing in name order. The name is rebuilt in one buffer and is
+ * only valid for the call; columns the listing left empty read as 0.
+ *
+ * @param listing
+ * @param callback
+ * @return false if the columns do not add up, after the rows that did
+ */
+template <typename Callback>
+inline bool dfs_compact_listing_each(const dfs_service::CompactListing& listing, Callback callback) {
+    int rows = listing.shared_size();
+    if (listing.suffixlength_size() != rows || listing.mtimens_size() != rows ||
+        (listing.filesize_size() != 0 && listing.filesize_size() != rows) ||
+        (listing.filechecksum_size() != 0 && listing.filechecksum_size() != rows)) {
+        return false;
+    }
+    const std::string& suffixes = listing.suffixes();
+    bool with_size = listing.filesize_size() != 0;
+    bool with_checksum = listing.filechecksum_size() != 0;
+    std::string name;
+    size_t offset = 0;
+    for (int row = 0; row < rows; row++) {
+        size_t shared = listing.shared(row);
+        size_t length = listing.suffixlength(row);
+        if (shared > name.length() || length > suffixes.length() - offset) {
+            return false;
+        }
+        name.resize(shared);
+        name.append(suffixes, offset, length);
+        offset += length;
+        callback(row, name, with_size ? static_cast<int64_t>(listing.filesize(row)) : 0,
+                 static_cast<int64_t>(listing.mtimens(row)), with_checksum ? listing.filechecksum(row) : 0);
+    }
+    return offset == suffixes.length();
+}
+
+#endif //PR4_DFS_COMPACT_LISTING_H
@@ -0,0 +1,103 @@
+#include <mutex>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+#include "dfs-utils.h"
+#include "dfslibx-content-cache.h"
+
+DFSContentCache::DFSContentCache(size_t budget, size_t small_file, size_t prefix) :
+    budget(budget), small_file(small_file), prefix(prefix) {
+    DFSMetricsRegistry& registry = DFSMetricsRegistry::Instance();
+    hits = registry.Counter("dfs_cache_hits_total", "Fetches served from the content cache");
+    misses = registry.Counter("dfs_cache_misses_total", "Fetches of cacheable files that missed the content cache");
+    hitBytes = registry.Counter("dfs_cache_hit_bytes_total", "File bytes sent from the content cache");
+    evictions = registry.Counter("dfs_cache_evictions_total", "Entries evicted from the content cache to stay in budget");
+    usedBytes = registry.Gauge("dfs_cache_bytes", "Bytes held by the content cache");
+    entryCount = registry.Gauge("dfs_cache_entries", "Files held by the content cache");
+}
+
+void DFSContentCache::EraseLocked(std::unordered_map<std::string, Entry>::iterator found) {
+    used -= found->second.file->Length();
+    lru.erase(found->second.position);
+    entries.erase(found);
+    usedBytes->Set(static_cast<int64_t>(used));
+    entryCount->Set(static_cast<int64_t>(entries.size()));
+}
+
+void DFSContentCache::SetBudget(size_t budget) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    this->budget = budget;
+    while (used > budget && !lru.empty()) {
+        EraseLocked(entries.find(lru.back()));
+        evictions->Add();
+    }
+}
+
+size_t DFSContentCache::FillLength(int64_t file_size) const {
+    if (budget == 0 || file_size <= 0) {
+        return 0;
+    }
+    size_t size = static_cast<size_t>(file_size);
+    size_t length = size <= small_file ? size : prefix;
+    return length <= budget ? length : 0;
+}
+
+std::shared_ptr<const DFSCachedFile> DFSContentCache::Lookup(const std::string& name, const struct stat& st) {
+    if (FillLength(st.st_size) == 0) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto found = entries.find(name);
+    if (found == entries.end()) {
+        misses->Add();
+        return nullptr;
+    }
+    if (!(found->second.file->version == DFSFileVersion::FromStat(st))) {
+        EraseLocked(found);
+        misses->Add();
+        return nullptr;
+    }
+
+    lru.splice(lru.begin(), lru, found->second.position);
+    hits->Add();
+    hitBytes->Add(found->second.file->Length());
+    return found->second.file;
+}
+
+void DFSContentCache::Insert(const std::string& name, const std::string& path, const struct stat& st, std::string&& data) {
+    DFSFileVersion version = DFSFileVersion::FromStat(st);
+    struct stat current;
+    if (data.empty() || data.length() != FillLength(st.st_size) ||
+        stat(path.c_str(), &current) != 0 || !(DFSFileVersion::FromStat(current) == version)) {
+        return;
+    }
+
+    std::shared_ptr<DFSCachedFile> file = std::make_shared<DFSCachedFile>();
+    file->version = version;
+    file->data = std::move(data);
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto found = entries.find(name);
+    if (found != entries.end()) {
+        EraseLocked(found);
+    }
+    while (used + file->Length() > budget && !lru.empty()) {
+        EraseLocked(entries.find(lru.back()));
+        evictions->Add();
+    }
+    lru.push_front(name);
+    used += file->Length();
+    entries[name] = Entry{file, lru.begin()};
+    usedBytes->Set(static_cast<int64_t>(used));
+    entryCount->Set(static_cast<int64_t>(entries.size()));
+}
+
+void DFSContentCache::Invalidate(const std::string& name) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto found = entries.find(name);
+    if (found != entries.end()) {
+        EraseLocked(found);
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef PR4_DFS_CONTENT_CACHE_H
+#define PR4_DFS_CONTENT_CACHE_H
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include "dfslibx-metrics.h"
+
+/** Files up to this size are cached whole by default **/
+#define DFS_CACHE_SMALL_FILE 0x100000
+
+/** Only the first bytes of larger files are cached by default **/
+#define DFS_CACHE_PREFIX 0x40000
+
+/**
+ * Identifies one version of a file: a write changes the mtime or size,
+ * a replace changes the inode
+ */
+struct DFSFileVersion {
+    int64_t mtime_ns;
+    int64_t size;
+    uint64_t inode;
+
+    static DFSFileVersion FromStat(const struct stat& st) {
+        return {static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec,
+                static_cast<int64_t>(st.st_size), static_cast<uint64_t>(st.st_ino)};
+    }
+
+    bool operator==(const DFSFileVersion& other) const {
+        return mtime_ns == other.mtime_ns && size == other.size && inode == other.inode;
+    }
+};
+
+/**
+ * The cached bytes of one file version, either the whole file or its
+ * first bytes. Entries are immutable and shared, so a fetch that is
+ * streaming one keeps it alive after it is evicted or invalidated.
+ */
+struct DFSCachedFile {
+    DFSFileVersion version;
+    std::string data;
+
+    const char* Data() const { return data.data(); }
+    size_t Length() const { return data.length(); }
+};
+
+/**
+ * Memory bounded LRU cache of file contents for fileFetcher.
+ *
+ * A lookup only hits when the cached entry has the same version as the
+ * stat the caller just took, so a stale entry can never be served. Upload
+ * and delete also invalidate the name explicitly to release the memory.
+ * A budget of 0 disables the cache.
+ */
+class DFSContentCache {
+private:
+    typedef std::list<std::string> LruList;
+
+    struct Entry {
+        std::shared_ptr<const DFSCachedFile> file;
+        LruList::iterator position;
+    };
+
+    std::mutex cache_mutex;
+    std::unordered_map<std::string, Entry> entries;
+    LruList lru;
+    size_t budget;
+    size_t used = 0;
+    size_t small_file;
+    size_t prefix;
+
+    DFSCounter* hits;
+    DFSCounter* misses;
+    DFSCounter* hitBytes;
+    DFSCounter* evictions;
+    DFSGauge* usedBytes;
+    DFSGauge* entryCount;
+
+    void EraseLocked(std::unordered_map<std::string, Entry>::iterator found);
+
+public:
+    explicit DFSContentCache(size_t budget = 0, size_t small_file = DFS_CACHE_SMALL_FILE, size_t prefix = DFS_CACHE_PREFIX);
+
+    /**
+     * Change the memory budget in bytes, evicting as needed
+     */
+    void SetBudget(size_t budget);
+
+    bool Enabled() const { return budget > 0; }
+
+    /**
+     * How many leading bytes of a file of this size would be cached (0 if none)
+     */
+    size_t FillLength(int64_t file_size) const;
+
+    /**
+     * The cached bytes for this version of the file, or null on a miss
+     */
+    std::shared_ptr<const DFSCachedFile> Lookup(const std::string& name, const struct stat& st);
+
+    /**
+     * Cache the leading bytes read for the version in st. The file is
+     * stat'ed again and nothing is cached if it changed while it was read.
+     */
+    void Insert(const std::string& name, const std::string& path, const struct stat& st, std::string&& data);
+
+    /**
+     * Drop any cached version of the file
+     */
+    void Invalidate(const std::string& name);
+};
+
+#endif //PR4_DFS_CONTENT_CACHE_H
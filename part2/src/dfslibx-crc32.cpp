@@ -0,0 +1,108 @@
+#include <cstring>
+
+#include "dfslibx-crc32.h"
+
+namespace {
+
+/** The reflected CRC-32 polynomial **/
+const std::uint32_t crc32_polynomial = 0xEDB88320u;
+
+struct DFSCrc32Tables {
+    std::uint32_t table[8][256];
+
+    DFSCrc32Tables() {
+        for (std::uint32_t i = 0; i < 256; i++) {
+            std::uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? crc32_polynomial ^ (crc >> 1) : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (std::uint32_t i = 0; i < 256; i++) {
+            for (int slice = 1; slice < 8; slice++) {
+                table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+const DFSCrc32Tables crc32_tables;
+
+/** Multiply a vector by a 32x32 matrix over GF(2), one column per word **/
+std::uint32_t gf2_matrix_times(const std::uint32_t* matrix, std::uint32_t vector) {
+    std::uint32_t sum = 0;
+    for (int column = 0; vector != 0; column++, vector >>= 1) {
+        if (vector & 1) {
+            sum ^= matrix[column];
+        }
+    }
+    return sum;
+}
+
+void gf2_matrix_square(std::uint32_t* square, const std::uint32_t* matrix) {
+    for (int column = 0; column < 32; column++) {
+        square[column] = gf2_matrix_times(matrix, matrix[column]);
+    }
+}
+
+}
+
+std::uint32_t dfs_crc32_slice8(const void* data, size_t size, std::uint32_t crc) {
+    const std::uint32_t (*t)[256] = crc32_tables.table;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+
+    while (size >= 8) {
+        std::uint32_t low;
+        std::uint32_t high;
+        memcpy(&low, bytes, sizeof(low));
+        memcpy(&high, bytes + 4, sizeof(high));
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        bytes += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = t[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+std::uint32_t dfs_crc32_zeros(std::uint32_t crc, std::uint64_t length) {
+    if (length == 0) {
+        return crc;
+    }
+
+    //The operator for one zero bit, squared up to one zero byte
+    std::uint32_t odd[32];
+    std::uint32_t even[32];
+    odd[0] = crc32_polynomial;
+    for (int column = 1; column < 32; column++) {
+        odd[column] = 1u << (column - 1);
+    }
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+
+    //Apply the operator for each set bit of length, squaring it each step
+    std::uint32_t reg = ~crc;
+    while (true) {
+        gf2_matrix_square(even, odd);
+        if (length & 1) {
+            reg = gf2_matrix_times(even, reg);
+        }
+        length >>= 1;
+        if (length == 0) {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        if (length & 1) {
+            reg = gf2_matrix_times(odd, reg);
+        }
+        length >>= 1;
+        if (length == 0) {
+            break;
+        }
+    }
+    return ~reg;
+}
@@ -0,0 +1,33 @@
+#ifndef PR4_DFS_CRC32_H
+#define PR4_DFS_CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC-32 (the CRC::CRC_32() parameters, same as zlib) using slicing-by-8
+ * tables, which processes eight bytes per step instead of one.
+ *
+ * Chains like CRC::Calculate: pass the previous result as crc, or 0 to
+ * start, and the results match CRC::Calculate with a CRC_32 table.
+ * Assumes a little endian host.
+ *
+ * @param data
+ * @param size
+ * @param crc
+ * @return
+ */
+std::uint32_t dfs_crc32_slice8(const void* data, size_t size, std::uint32_t crc = 0);
+
+/**
+ * Extend crc over length zero bytes, the same as dfs_crc32_slice8 on a
+ * buffer of zeros but in O(log length) time, so holes in sparse files can
+ * be checksummed without reading them.
+ *
+ * @param crc
+ * @param length
+ * @return
+ */
+std::uint32_t dfs_crc32_zeros(std::uint32_t crc, std::uint64_t length);
+
+#endif //PR4_DFS_CRC32_H
@@ -0,0 +1,69 @@
+#include <string>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "dfslibx-dir-reader.h"
+
+/** The record getdents64 fills the buffer with **/
+struct DFSDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+DFSDirectoryReader::DFSDirectoryReader() : buffer(DFS_DIRENT_BUFFER) {}
+
+DFSDirectoryReader::~DFSDirectoryReader() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool DFSDirectoryReader::Open(const std::string& path, uint64_t position) {
+    fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (position != 0 && lseek(fd, static_cast<off_t>(position), SEEK_SET) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        fd = -1;
+        errno = saved_errno;
+        return false;
+    }
+    this->position = position;
+    return true;
+}
+
+bool DFSDirectoryReader::Next(const char** name, unsigned char* type) {
+    while (true) {
+        if (next >= filled) {
+            long result = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                failed = result < 0;
+                return false;
+            }
+            filled = static_cast<size_t>(result);
+            next = 0;
+        }
+
+        const DFSDirent64* entry = reinterpret_cast<const DFSDirent64*>(buffer.data() + next);
+        next += entry->d_reclen;
+        position = static_cast<uint64_t>(entry->d_off);
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        *name = entry->d_name;
+        *type = entry->d_type;
+        return true;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef PR4_DFS_DIR_READER_H
+#define PR4_DFS_DIR_READER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/** Bytes of directory entries asked for in one getdents64 call **/
+#define DFS_DIRENT_BUFFER 0x8000
+
+/**
+ * Reads a directory with getdents64, a buffer of entries at a time.
+ *
+ * Position() after an entry is the directory offset the filesystem gave
+ * that entry, and a reader opened at it carries on with the entry after
+ * it. The filesystem keeps these offsets valid while entries are added or
+ * removed, so a listing can be read in pages across calls; entries added
+ * or removed in the meantime may or may not show up.
+ */
+class DFSDirectoryReader {
+private:
+    int fd = -1;
+    std::vector<char> buffer;
+    size_t filled = 0;
+    size_t next = 0;
+    uint64_t position = 0;
+    bool failed = false;
+
+public:
+    DFSDirectoryReader();
+    ~DFSDirectoryReader();
+
+    /**
+     * Open the directory at path and seek to position (0 is the start)
+     *
+     * @return false if the directory could not be opened or sought, with errno set
+     */
+    bool Open(const std::string& path, uint64_t position = 0);
+
+    /**
+     * The next entry other than . and .., with its DT_ type (DT_UNKNOWN
+     * when the filesystem does not say). The name is valid until the next
+     * call.
+     *
+     * @return false at the end of the directory, or on an error
+     */
+    bool Next(const char** name, unsigned char* type);
+
+    /** Where a reader resumes to continue after the last entry returned **/
+    uint64_t Position() const { return position; }
+
+    /** The directory, for fstatat on the entries **/
+    int Fd() const { return fd; }
+
+    /** True if Next stopped on an error rather than at the end **/
+    bool Failed() const { return failed; }
+};
+
+#endif //PR4_DFS_DIR_READER_H
@@ -0,0 +1,187 @@
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <string>
+
+#include "dfs-utils.h"
+#include "dfslibx-file-mutex-table.h"
+
+static uint64_t ElapsedUs(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - since).count());
+}
+
+void DFSFileMutexTable::AcquireMaster(const std::string& clientID) {
+    auto WaitStart = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> MasterLock (MasterMutex);
+    dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] attempting to get master lock";
+    while(!MasterLock_Avail){MasterLock_CV.wait(MasterLock);}
+    MasterLock_Avail = false;
+    MasterLock.unlock();
+    if (lockWait) { lockWait->Record(ElapsedUs(WaitStart)); }
+    dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] has master lock";
+}
+
+void DFSFileMutexTable::ReleaseMaster(const std::string& clientID) {
+    dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] attempting to release master lock";
+    std::unique_lock<std::mutex> MasterLock (MasterMutex);
+    MasterLock_Avail = true;
+    MasterLock.unlock();
+    dfs_log(LL_SYSINFO) << "ServerSide | Client ID [" << clientID << "] no longer has master lock";
+    MasterLock_CV.notify_all();
+}
+
+//Requests to get file mutex
+bool DFSFileMutexTable::Request(const std::string& FileName, const std::string& clientID) {
+    dfs_log(LL_SYSINFO) << "ServerSide | Client [" << clientID << "] is requesting mutex for File " << FileName;
+
+    //Acquire the lock & critical section
+    AcquireMaster(clientID);
+
+    bool SuccessfulRequest;
+    //If then to check if mutex has been created and is in the fileMutexes
+    dfs_log(LL_SYSINFO) << "ServerSide | Checking for file mutex for " << FileName;
+    if(fileMutexes.find(FileName) != fileMutexes.end()){
+        dfs_log(LL_SYSINFO) << "ServerSide | File Mutex exists in system";
+
+        //Client already has the mutex
+        if (fileMutexes[FileName].ClientID == clientID){
+            dfs_log(LL_SYSINFO) << "ServerSide | File Mutex is already assigned to the Client performing this request ClientID: " << fileMutexes[FileName].ClientID;
+            SuccessfulRequest = true;
+        }
+        //Check if a client has it or if it's available
+        else if(fileMutexes[FileName].ClientID != "NOT_IN_USE"){
+            dfs_log(LL_SYSINFO) << "ServerSide | File Mutex is currently being used by a different Client: " << fileMutexes[FileName].ClientID;
+            if (lockConflicts) { lockConflicts->Add(); }
+            SuccessfulRequest = false;
+        }
+        //it's available and already created
+        else{
+            fileMutexes[FileName].FileMutex.lock();
+            fileMutexes[FileName].ClientID =  clientID;
+            fileMutexes[FileName].AcquiredAt = std::chrono::steady_clock::now();
+            dfs_log(LL_SYSINFO) << "Serverside | File Mutex available and is assigned now to Client: " << fileMutexes[FileName].ClientID;
+            fileMutexes[FileName].FileMutex.unlock();
+            SuccessfulRequest = true;
+        }
+    }
+    //Mutex has not been created yet
+    else{
+        fileMutexes[FileName].FileMutex.lock();
+        fileMutexes[FileName].ClientID = clientID;
+        fileMutexes[FileName].AcquiredAt = std::chrono::steady_clock::now();
+        dfs_log(LL_SYSINFO) << "ServerSide | File Mutex has been created for file: " << FileName << " and is assigned now to Client: " << fileMutexes[FileName].ClientID;
+        fileMutexes[FileName].FileMutex.unlock();
+        SuccessfulRequest = true;
+    }
+
+    ReleaseMaster(clientID);
+
+    return SuccessfulRequest;
+}
+
+//Releaes lock but is still available if file exists
+bool DFSFileMutexTable::Release(const std::string& FileName, const std::string& clientID) {
+
+    //Acquire the lock & critical section
+    AcquireMaster(clientID);
+
+    dfs_log(LL_SYSINFO) << "ServerSide | Attempting to release File Mutex for file: " << FileName;
+    bool SuccessfulRelease;
+
+    //If then to check if mutex exist in the map of filenames and mutexes
+    if(fileMutexes.find(FileName) != fileMutexes.end()){
+        //Check the correct client is trying to perform the action
+        if(fileMutexes[FileName].ClientID == clientID){
+            fileMutexes[FileName].FileMutex.lock();
+            fileMutexes[FileName].ClientID = "NOT_IN_USE";
+            if (lockHold) { lockHold->Record(ElapsedUs(fileMutexes[FileName].AcquiredAt)); }
+            fileMutexes[FileName].FileMutex.unlock();
+            dfs_log(LL_SYSINFO) << "ServerSide | File Mutex for file, " << FileName << ", has been released";
+            SuccessfulRelease = true;
+        }
+        //Incorrect client is releasing the lock
+        else{
+            dfs_log(LL_ERROR) << "ServerSide | Mutex for file, " << FileName << ", has not been released. ClientID does not have ownership";
+            SuccessfulRelease = false;
+        }
+    }
+    //Mutex at this time does not exist
+    else{
+        dfs_log(LL_ERROR) << "ServerSide | Mutex for file, " << FileName << ", has not been released. It does not currently exist";
+        SuccessfulRelease = false;
+    }
+
+    ReleaseMaster(clientID);
+
+    return SuccessfulRelease;
+}
+
+//Deletes the mutex if the file is deleted
+bool DFSFileMutexTable::Delete(const std::string& FileName, const std::string& clientID) {
+    //Acquire the lock & critical section
+    AcquireMaster(clientID);
+
+    dfs_log(LL_SYSINFO) << "ServerSide | Attempting to delete Mutex for file: " << FileName;
+    bool SuccessfulDelete;
+    //Check if mutex exist in current fileMutexes
+    if(fileMutexes.find(FileName) != fileMutexes.end()){
+        //Check the correct client is requesting this action
+        if(fileMutexes[FileName].ClientID == clientID){
+            dfs_log(LL_SYSINFO) << "ServerSide | File Mutex for file, " << FileName << ", has been deleted";
+            if (lockHold) { lockHold->Record(ElapsedUs(fileMutexes[FileName].AcquiredAt)); }
+            fileMutexes.erase(FileName);
+            SuccessfulDelete = true;
+        }
+        //Output incorrect client is requesting to delete the lock
+        else{
+            dfs_log(LL_ERROR) << "ServerSide | File Mutex for file, " << FileName << ", has not been deleted. ClientID does not have ownership";
+            SuccessfulDelete = false;
+        }
+    }
+    //File Mutex delete when file mutex does not exist
+    else{
+        dfs_log(LL_ERROR) << "ServerSide | File Mutex for file, " << FileName << ", does not currently exist";
+        SuccessfulDelete = false;
+    }
+
+    //Release the lock & critical section
+    ReleaseMaster(clientID);
+
+    return SuccessfulDelete;
+}
+
+//Calls the correct function depending if the file exists in the system or not
+bool DFSFileMutexTable::ReleaseOrDelete(const std::string& FileName, const std::string& clientID, bool FileInSystem) {
+    if(IsClientOwner(FileName, clientID)){
+        if(FileInSystem){
+            dfs_log(LL_SYSINFO) << "ServerSide | Calling fileMutex_Release for file: " << FileName;
+            return Release(FileName, clientID);
+        }
+        else{
+            dfs_log(LL_SYSINFO) << "ServerSide | Calling fileMutex_Delete for file: " << FileName;
+            return Delete(FileName, clientID);
+        }
+    }
+    return false;
+}
+
+//Checks if current client is the owner
+bool DFSFileMutexTable::IsClientOwner(const std::string& FileName, const std::string& clientID) {
+    //Check if filename mutex exists
+    if(fileMutexes.find(FileName) != fileMutexes.end()){
+        if(fileMutexes[FileName].ClientID == clientID){
+            return true;
+        }
+    }
+    dfs_log(LL_SYSINFO) << "Client [" << clientID << "] is not the owner of file mutex: " << FileName;
+    return false;
+}
+
+//Returns the owner of the mutex
+std::string DFSFileMutexTable::Owner(const std::string& FileName) {
+    if(fileMutexes.find(FileName) != fileMutexes.end()){
+        return fileMutexes[FileName].ClientID;
+    }
+    return "Not Created";
+}
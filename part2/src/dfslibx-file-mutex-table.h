@@ -0,0 +1,82 @@
+#ifndef PR4_DFS_FILE_MUTEX_TABLE_H
+#define PR4_DFS_FILE_MUTEX_TABLE_H
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <condition_variable>
+
+#include "dfslibx-metrics.h"
+
+//Writer lock for each file and which client has it
+typedef struct fileMutexInfo{
+    std::mutex FileMutex;
+    std::string ClientID;
+    std::chrono::steady_clock::time_point AcquiredAt;
+}fileMutexInfo;
+
+/**
+ * The server's table of per file writer locks.
+ *
+ * A client holds the write lock for a file from RequestWriteAccess until
+ * its Store or Delete completes. Updates to the table are serialized by
+ * a master lock. This lives outside DFSServiceImpl so the microbenchmarks
+ * can drive it without a server.
+ *
+ * The metric pointers may be null.
+ */
+class DFSFileMutexTable {
+private:
+    //MasterLock and conditional allows for the update of writer locks
+    std::condition_variable MasterLock_CV;
+    bool MasterLock_Avail = true;
+    std::mutex MasterMutex;
+    std::map<std::string, fileMutexInfo> fileMutexes;
+
+    DFSHistogram* lockWait;
+    DFSHistogram* lockHold;
+    DFSCounter* lockConflicts;
+
+    void AcquireMaster(const std::string& clientID);
+    void ReleaseMaster(const std::string& clientID);
+
+public:
+    DFSFileMutexTable(DFSHistogram* lockWait = nullptr, DFSHistogram* lockHold = nullptr,
+                      DFSCounter* lockConflicts = nullptr) :
+        lockWait(lockWait), lockHold(lockHold), lockConflicts(lockConflicts) {}
+
+    /**
+     * Give the write lock for FileName to clientID unless another client has it
+     *
+     * @return true if clientID now holds the lock
+     */
+    bool Request(const std::string& FileName, const std::string& clientID);
+
+    /**
+     * Release the lock but keep the entry because the file still exists
+     */
+    bool Release(const std::string& FileName, const std::string& clientID);
+
+    /**
+     * Remove the entry because the file was deleted
+     */
+    bool Delete(const std::string& FileName, const std::string& clientID);
+
+    /**
+     * Release or delete depending on whether the file still exists
+     */
+    bool ReleaseOrDelete(const std::string& FileName, const std::string& clientID, bool FileInSystem);
+
+    /**
+     * Whether clientID currently holds the lock for FileName
+     */
+    bool IsClientOwner(const std::string& FileName, const std::string& clientID);
+
+    /**
+     * The client holding the lock, "NOT_IN_USE" or "Not Created"
+     */
+    std::string Owner(const std::string& FileName);
+};
+
+#endif //PR4_DFS_FILE_MUTEX_TABLE_H
@@ -0,0 +1,71 @@
+#ifndef PR4_DFS_FREE_LIST_H
+#define PR4_DFS_FREE_LIST_H
+
+#include <new>
+#include <cstddef>
+
+/** Most freed blocks a thread keeps for reuse per pooled type **/
+#define DFS_FREE_LIST_MAX 256
+
+/**
+ * Recycles the memory of objects of type T that are created and destroyed
+ * once per call, so a busy queue does not go to the allocator for each one.
+ *
+ * Every thread keeps its own list of freed blocks, up to DFS_FREE_LIST_MAX,
+ * and takes no lock. A block freed on another thread than the one that
+ * allocated it simply joins the freeing thread's list. Blocks of any other
+ * size, as from a derived type, go straight to the allocator.
+ *
+ * A type opts in with class operator new and delete that forward here.
+ */
+template <typename T>
+class DFSFreeList {
+private:
+    struct Block {
+        Block* next;
+    };
+
+    struct List {
+        Block* head = nullptr;
+        size_t count = 0;
+
+        ~List() {
+            while (head != nullptr) {
+                Block* block = head;
+                head = block->next;
+                ::operator delete(block);
+            }
+        }
+    };
+
+    static List& Local() {
+        static thread_local List list;
+        return list;
+    }
+
+public:
+    static void* Allocate(size_t size) {
+        List& list = Local();
+        if (size != sizeof(T) || list.head == nullptr) {
+            return ::operator new(size);
+        }
+        Block* block = list.head;
+        list.head = block->next;
+        list.count--;
+        return block;
+    }
+
+    static void Release(void* memory, size_t size) {
+        List& list = Local();
+        if (memory == nullptr || size != sizeof(T) || list.count >= DFS_FREE_LIST_MAX) {
+            ::operator delete(memory);
+            return;
+        }
+        Block* block = static_cast<Block*>(memory);
+        block->next = list.head;
+        list.head = block;
+        list.count++;
+    }
+};
+
+#endif //PR4_DFS_FREE_LIST_H
@@ -0,0 +1,227 @@
+#include <mutex>
+#include <string>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dfs-utils.h"
+#include "dfslibx-index-log.h"
+
+/** Record kinds **/
+#define DFS_INDEX_RECORD_PUT 1
+#define DFS_INDEX_RECORD_REMOVE 2
+
+/** Length and CRC-32 ahead of each record's payload **/
+#define DFS_INDEX_RECORD_HEADER 8
+
+template <typename T>
+static void Put(std::string* out, T value) {
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool Get(const char** next, const char* end, T* value) {
+    if (static_cast<size_t>(end - *next) < sizeof(T)) {
+        return false;
+    }
+    memcpy(value, *next, sizeof(T));
+    *next += sizeof(T);
+    return true;
+}
+
+//Read the whole of a file into bytes
+static bool ReadWhole(const std::string& path, std::string* bytes) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    bool read = fstat(fd, &st) == 0;
+    if (read) {
+        bytes->resize(static_cast<size_t>(st.st_size));
+        read = bytes->empty() || dfs_pread_fully(fd, &(*bytes)[0], bytes->length(), 0);
+    }
+    close(fd);
+    return read;
+}
+
+DFSIndexLog::DFSIndexLog(const std::string& path) : path(path) {}
+
+DFSIndexLog::~DFSIndexLog() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void DFSIndexLog::Encode(std::string* out, const std::string& name, const DFSIndexEntry* entry) {
+    std::string payload;
+    Put<uint8_t>(&payload, entry != nullptr ? DFS_INDEX_RECORD_PUT : DFS_INDEX_RECORD_REMOVE);
+    Put<uint16_t>(&payload, static_cast<uint16_t>(name.length()));
+    payload.append(name);
+    if (entry != nullptr) {
+        const struct stat& st = entry->st;
+        Put<int64_t>(&payload, st.st_size);
+        Put<int64_t>(&payload, st.st_mtim.tv_sec);
+        Put<int64_t>(&payload, st.st_mtim.tv_nsec);
+        Put<int64_t>(&payload, st.st_ctim.tv_sec);
+        Put<int64_t>(&payload, st.st_ctim.tv_nsec);
+        Put<uint64_t>(&payload, st.st_ino);
+        Put<uint32_t>(&payload, st.st_mode);
+        Put<uint32_t>(&payload, entry->checksum);
+    }
+    Put<uint32_t>(out, static_cast<uint32_t>(payload.length()));
+    Put<uint32_t>(out, dfs_crc32_slice8(payload.data(), payload.length()));
+    out->append(payload);
+}
+
+bool DFSIndexLog::Decode(const char* payload, size_t length, const ReplayFunction& replay) {
+    const char* next = payload;
+    const char* end = payload + length;
+    uint8_t kind;
+    uint16_t name_length;
+    if (!Get(&next, end, &kind) || !Get(&next, end, &name_length) || static_cast<size_t>(end - next) < name_length) {
+        return false;
+    }
+    std::string name(next, name_length);
+    next += name_length;
+    if (kind == DFS_INDEX_RECORD_REMOVE) {
+        replay(name, nullptr);
+        return true;
+    }
+
+    DFSIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    int64_t size, mtime_sec, mtime_nsec, ctime_sec, ctime_nsec;
+    uint64_t inode;
+    uint32_t mode;
+    if (kind != DFS_INDEX_RECORD_PUT || !Get(&next, end, &size) || !Get(&next, end, &mtime_sec) ||
+        !Get(&next, end, &mtime_nsec) || !Get(&next, end, &ctime_sec) || !Get(&next, end, &ctime_nsec) ||
+        !Get(&next, end, &inode) || !Get(&next, end, &mode) || !Get(&next, end, &entry.checksum)) {
+        return false;
+    }
+    entry.st.st_size = size;
+    entry.st.st_mtim.tv_sec = mtime_sec;
+    entry.st.st_mtim.tv_nsec = mtime_nsec;
+    entry.st.st_ctim.tv_sec = ctime_sec;
+    entry.st.st_ctim.tv_nsec = ctime_nsec;
+    entry.st.st_ino = inode;
+    entry.st.st_mode = mode;
+    replay(name, &entry);
+    return true;
+}
+
+long DFSIndexLog::Replay(const ReplayFunction& replay) {
+    std::string bytes;
+    if (!ReadWhole(path, &bytes)) {
+        return -1;
+    }
+    size_t magic = sizeof(DFS_INDEX_LOG_MAGIC) - 1;
+    if (bytes.compare(0, magic, DFS_INDEX_LOG_MAGIC) != 0) {
+        dfs_log(LL_ERROR) << "Index log | Not an index log or an older format, ignoring: " << path;
+        return -1;
+    }
+
+    long count = 0;
+    size_t offset = magic;
+    while (bytes.length() - offset >= DFS_INDEX_RECORD_HEADER) {
+        uint32_t length, crc;
+        memcpy(&length, bytes.data() + offset, sizeof(length));
+        memcpy(&crc, bytes.data() + offset + sizeof(length), sizeof(crc));
+        const char* payload = bytes.data() + offset + DFS_INDEX_RECORD_HEADER;
+        if (length > bytes.length() - offset - DFS_INDEX_RECORD_HEADER || dfs_crc32_slice8(payload, length) != crc ||
+            !Decode(payload, length, replay)) {
+            break;
+        }
+        offset += DFS_INDEX_RECORD_HEADER + length;
+        count++;
+    }
+    if (offset < bytes.length()) {
+        dfs_log(LL_ERROR) << "Index log | Ignoring " << bytes.length() - offset << " bytes of a torn or damaged tail in " << path;
+    }
+    return count;
+}
+
+void DFSIndexLog::Append(const std::string& name, const DFSIndexEntry* entry) {
+    std::string bytes;
+    Encode(&bytes, name, entry);
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (fd < 0) {
+        return;
+    }
+    if (!dfs_write_fully(fd, bytes.data(), bytes.length())) {
+        //A partial record would end every later replay there, so stop until the next compaction
+        dfs_log(LL_ERROR) << "Index log | Appending failed, the log is rewritten at the next compaction: " << strerror(errno);
+        close(fd);
+        fd = -1;
+        return;
+    }
+    records++;
+    if (compacting) {
+        pending.append(bytes);
+        pending_records++;
+    }
+}
+
+bool DFSIndexLog::Compact(const DFSNamespaceIndex& index) {
+    //Taken under the log lock, every record appended after it lands in pending
+    DFSNamespaceIndex::Snapshot snapshot;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        if (compacting) {
+            return false;
+        }
+        compacting = true;
+        pending.clear();
+        pending_records = 0;
+        snapshot = index.Take();
+    }
+
+    std::string temporary = path + ".tmp";
+    int out = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = out >= 0;
+    uint64_t count = 0;
+    std::string bytes = DFS_INDEX_LOG_MAGIC;
+    snapshot.ForEach([&](const std::string& name, const DFSIndexEntry& entry) {
+        Encode(&bytes, name, &entry);
+        count++;
+        if (bytes.length() >= DFS_INDEX_LOG_BUFFER) {
+            written = written && dfs_write_fully(out, bytes.data(), bytes.length());
+            bytes.clear();
+        }
+    });
+    written = written && dfs_write_fully(out, bytes.data(), bytes.length());
+
+    std::lock_guard<std::mutex> lock(log_mutex);
+    compacting = false;
+    written = written && dfs_write_fully(out, pending.data(), pending.length()) && fsync(out) == 0 &&
+              rename(temporary.c_str(), path.c_str()) == 0;
+    if (!written) {
+        dfs_log(LL_ERROR) << "Index log | Compaction failed, keeping the old log: " << strerror(errno);
+        if (out >= 0) {
+            close(out);
+            unlink(temporary.c_str());
+        }
+        pending.clear();
+        return false;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = out;
+    records = count + pending_records;
+    pending.clear();
+    dfs_log(LL_DEBUG) << "Index log | Compacted to " << records << " records";
+    return true;
+}
+
+uint64_t DFSIndexLog::Records() {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return records;
+}
+
+bool DFSIndexLog::Appending() {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return fd >= 0;
+}
@@ -0,0 +1,88 @@
+#ifndef PR4_DFS_INDEX_LOG_H
+#define PR4_DFS_INDEX_LOG_H
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <functional>
+
+#include "dfslibx-namespace-index.h"
+
+/** Name of the log in the mount when it is kept there, under the reserved prefix **/
+#define DFS_INDEX_LOG_NAME ".dfs-index"
+
+/** Starts every index log, and changes with its record format **/
+#define DFS_INDEX_LOG_MAGIC "DFSIDX01"
+
+/** A log is compacted once it holds this many records more than twice the files it describes **/
+#define DFS_INDEX_COMPACT_MIN 4096
+
+/** Bytes of records a compaction buffers between writes **/
+#define DFS_INDEX_LOG_BUFFER 0x100000
+
+/**
+ * The namespace index on disk, so a restarted server only checksums the
+ * files that changed while it was down.
+ *
+ * The log is a run of records, each the put or removal of one file, with
+ * a length and a CRC-32 so a record torn by a crash ends the replay there.
+ * Records are in host byte order. Appends are not synced: a lost record
+ * leaves an older entry whose stat no longer matches the file, and the
+ * startup check checksums that file again.
+ *
+ * Compact rewrites the log as one put per file to a temporary file and
+ * renames it over the log. Appends carry on into the old log meanwhile,
+ * and are copied to the new one before the rename.
+ */
+class DFSIndexLog {
+public:
+    /** Called with each replayed record, entry is null for a removal **/
+    typedef std::function<void(const std::string& name, const DFSIndexEntry* entry)> ReplayFunction;
+
+private:
+    std::string path;
+    std::mutex log_mutex;
+    int fd = -1;
+    uint64_t records = 0;
+    bool compacting = false;
+    /** Records appended while a compaction writes, copied into the new log **/
+    std::string pending;
+    uint64_t pending_records = 0;
+
+    static void Encode(std::string* out, const std::string& name, const DFSIndexEntry* entry);
+    static bool Decode(const char* payload, size_t length, const ReplayFunction& replay);
+
+public:
+    explicit DFSIndexLog(const std::string& path);
+    ~DFSIndexLog();
+
+    /**
+     * Read every intact record in order. Nothing is appended until the
+     * first Compact.
+     *
+     * @return the records read, or -1 if there is no log at path
+     */
+    long Replay(const ReplayFunction& replay);
+
+    /**
+     * Record that name was written with entry, or removed when entry is null
+     */
+    void Append(const std::string& name, const DFSIndexEntry* entry);
+
+    /**
+     * Rewrite the log from a snapshot of index and append to it from then on
+     *
+     * @return false if the new log could not be written, the old one is kept
+     */
+    bool Compact(const DFSNamespaceIndex& index);
+
+    /** Records in the log, live or not **/
+    uint64_t Records();
+
+    /** False before the first compaction and after an append failed **/
+    bool Appending();
+
+    const std::string& Path() const { return path; }
+};
+
+#endif //PR4_DFS_INDEX_LOG_H
@@ -0,0 +1,334 @@
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+#include "dfs-utils.h"
+#include "dfslibx-io-engine.h"
+
+DFSIoKind dfs_io_kind_from_string(const std::string& name) {
+    if (name == "uring") { return DFS_IO_URING; }
+    if (name == "posix") { return DFS_IO_POSIX; }
+    return DFS_IO_AUTO;
+}
+
+DFSIoEngine::DFSIoEngine(unsigned depth, size_t block_size) : block_size(block_size) {
+    for (unsigned slot = 0; slot < depth; slot++) {
+        void* buffer = nullptr;
+        if (posix_memalign(&buffer, 4096, block_size) != 0) {
+            break;
+        }
+        buffers.push_back(static_cast<char*>(buffer));
+        free_slots.push_back(depth - 1 - slot);
+    }
+}
+
+DFSIoEngine::~DFSIoEngine() {
+    for (char* buffer : buffers) {
+        free(buffer);
+    }
+}
+
+int DFSIoEngine::AcquireSlot() {
+    if (free_slots.empty()) {
+        return -1;
+    }
+    unsigned slot = free_slots.back();
+    free_slots.pop_back();
+    return static_cast<int>(slot);
+}
+
+void DFSIoEngine::ReleaseSlot(unsigned slot) {
+    free_slots.push_back(slot);
+}
+
+bool DFSIoEngine::Drain() {
+    bool success = true;
+    unsigned slot;
+    ssize_t result;
+    while (in_flight > 0 && Wait(&slot, &result)) {
+        if (result < 0) { success = false; }
+    }
+    free_slots.clear();
+    for (unsigned index = Depth(); index > 0; index--) {
+        free_slots.push_back(index - 1);
+    }
+    return success;
+}
+
+/**
+ * Fallback engine: queued requests run as pread/pwrite calls on Submit
+ */
+class DFSPosixIoEngine : public DFSIoEngine {
+private:
+    struct Request {
+        unsigned slot;
+        int fd;
+        size_t length;
+        off_t offset;
+        bool write;
+    };
+
+    std::vector<Request> queued;
+    std::deque<std::pair<unsigned, ssize_t>> completed;
+
+public:
+    DFSPosixIoEngine(unsigned depth, size_t block_size) : DFSIoEngine(depth, block_size) {}
+
+    const char* Name() const override { return "posix"; }
+
+    void QueueRead(unsigned slot, int fd, size_t length, off_t offset) override {
+        queued.push_back({slot, fd, length, offset, false});
+        in_flight++;
+    }
+
+    void QueueWrite(unsigned slot, int fd, size_t length, off_t offset) override {
+        queued.push_back({slot, fd, length, offset, true});
+        in_flight++;
+    }
+
+    void Submit() override {
+        for (const Request& request : queued) {
+            size_t done = 0;
+            ssize_t result = 0;
+            //Loop over short transfers so the result matches a single io_uring request
+            while (done < request.length) {
+                char* buffer = buffers[request.slot] + done;
+                result = request.write ?
+                    pwrite(request.fd, buffer, request.length - done, request.offset + static_cast<off_t>(done)) :
+                    pread(request.fd, buffer, request.length - done, request.offset + static_cast<off_t>(done));
+                if (result < 0 && errno == EINTR) { continue; }
+                if (result <= 0) { break; }
+                done += static_cast<size_t>(result);
+            }
+            completed.emplace_back(request.slot, result < 0 ? -errno : static_cast<ssize_t>(done));
+        }
+        queued.clear();
+    }
+
+    bool Wait(unsigned* slot, ssize_t* result) override {
+        Submit();
+        if (completed.empty()) {
+            return false;
+        }
+        *slot = completed.front().first;
+        *result = completed.front().second;
+        completed.pop_front();
+        in_flight--;
+        return true;
+    }
+};
+
+#ifdef __NR_io_uring_setup
+
+/**
+ * io_uring engine over the raw system calls. The engine buffers are
+ * registered with the ring when the memlock limit allows it, so reads and
+ * writes use the fixed buffer opcodes and skip the per request page pinning.
+ */
+class DFSUringIoEngine : public DFSIoEngine {
+private:
+    int ring_fd = -1;
+    bool fixed_buffers = false;
+    unsigned to_submit = 0;
+
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    struct io_uring_sqe* sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    static int Enter(int fd, unsigned submit, unsigned min_complete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, nullptr, 0));
+    }
+
+    void Queue(unsigned slot, int fd, size_t length, off_t offset, bool write) {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        if (fixed_buffers) {
+            sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->buf_index = static_cast<__u16>(slot);
+        }
+        else {
+            sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        }
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<__u64>(buffers[slot]);
+        sqe->len = static_cast<__u32>(length);
+        sqe->off = static_cast<__u64>(offset);
+        sqe->user_data = slot;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        to_submit++;
+        in_flight++;
+    }
+
+    bool Reap(unsigned* slot, ssize_t* result) {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        *slot = static_cast<unsigned>(cqe->user_data);
+        *result = cqe->res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        in_flight--;
+        return true;
+    }
+
+public:
+    DFSUringIoEngine(unsigned depth, size_t block_size) : DFSIoEngine(depth, block_size) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (ring_fd < 0) {
+            return;
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) {
+            return;
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ring = sq_ring;
+        }
+        else {
+            cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED) {
+                return;
+            }
+        }
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            return;
+        }
+
+        char* sq = static_cast<char*>(sq_ring);
+        char* cq = static_cast<char*>(cq_ring);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        std::vector<struct iovec> iovecs(buffers.size());
+        for (size_t slot = 0; slot < buffers.size(); slot++) {
+            iovecs[slot].iov_base = buffers[slot];
+            iovecs[slot].iov_len = block_size;
+        }
+        fixed_buffers = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+                                iovecs.data(), static_cast<unsigned>(iovecs.size())) == 0;
+        if (!fixed_buffers) {
+            dfs_log(LL_DEBUG) << "io_uring buffer registration failed, using unregistered buffers: " << strerror(errno);
+        }
+    }
+
+    ~DFSUringIoEngine() override {
+        if (sqes != MAP_FAILED) { munmap(sqes, sqes_size); }
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) { munmap(cq_ring, cq_ring_size); }
+        if (sq_ring != MAP_FAILED) { munmap(sq_ring, sq_ring_size); }
+        if (ring_fd >= 0) { close(ring_fd); }
+    }
+
+    bool Ready() const {
+        return ring_fd >= 0 && sq_ring != MAP_FAILED && cq_ring != MAP_FAILED && sqes != MAP_FAILED &&
+               buffers.size() > 0;
+    }
+
+    const char* Name() const override { return fixed_buffers ? "io_uring (registered buffers)" : "io_uring"; }
+
+    void QueueRead(unsigned slot, int fd, size_t length, off_t offset) override {
+        Queue(slot, fd, length, offset, false);
+    }
+
+    void QueueWrite(unsigned slot, int fd, size_t length, off_t offset) override {
+        Queue(slot, fd, length, offset, true);
+    }
+
+    void Submit() override {
+        while (to_submit > 0) {
+            int submitted = Enter(ring_fd, to_submit, 0, 0);
+            if (submitted < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) { continue; }
+                dfs_log(LL_ERROR) << "io_uring_enter failed: " << strerror(errno);
+                return;
+            }
+            to_submit -= static_cast<unsigned>(submitted);
+        }
+    }
+
+    bool Wait(unsigned* slot, ssize_t* result) override {
+        if (in_flight == 0) {
+            return false;
+        }
+        while (!Reap(slot, result)) {
+            int entered = Enter(ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+            if (entered < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) { continue; }
+                dfs_log(LL_ERROR) << "io_uring_enter failed: " << strerror(errno);
+                return false;
+            }
+            to_submit -= static_cast<unsigned>(entered);
+        }
+        return true;
+    }
+};
+
+#endif
+
+std::unique_ptr<DFSIoEngine> DFSIoEngine::Create(DFSIoKind kind, unsigned depth, size_t block_size) {
+#ifdef __NR_io_uring_setup
+    if (kind != DFS_IO_POSIX) {
+        std::unique_ptr<DFSUringIoEngine> engine(new DFSUringIoEngine(depth, block_size));
+        if (engine->Ready()) {
+            return std::unique_ptr<DFSIoEngine>(engine.release());
+        }
+        dfs_log(kind == DFS_IO_URING ? LL_ERROR : LL_DEBUG) << "io_uring is not available, using pread/pwrite";
+    }
+#endif
+    return std::unique_ptr<DFSIoEngine>(new DFSPosixIoEngine(depth, block_size));
+}
+
+DFSIoEngine& DFSIoEngine::ForThread(DFSIoKind kind) {
+    static thread_local std::unique_ptr<DFSIoEngine> engine;
+    static thread_local DFSIoKind engine_kind = DFS_IO_AUTO;
+    if (!engine || engine_kind != kind) {
+        engine = Create(kind);
+        engine_kind = kind;
+    }
+    return *engine;
+}
@@ -0,0 +1,107 @@
+#ifndef PR4_DFS_IO_ENGINE_H
+#define PR4_DFS_IO_ENGINE_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+/** Bytes per disk request, and so per engine buffer **/
+#define DFS_IO_BLOCK_SIZE 0x10000
+
+/** Requests an engine keeps in flight **/
+#define DFS_IO_QUEUE_DEPTH 8
+
+/** Which engine DFSIoEngine::Create builds **/
+enum DFSIoKind {
+    DFS_IO_AUTO,    // io_uring when the kernel allows it, otherwise pread/pwrite
+    DFS_IO_URING,
+    DFS_IO_POSIX
+};
+
+/**
+ * Parse "auto", "uring" or "posix"; anything else is DFS_IO_AUTO
+ */
+DFSIoKind dfs_io_kind_from_string(const std::string& name);
+
+/**
+ * Disk I/O engine used by the server's fetch and upload paths.
+ *
+ * An engine owns Depth() buffers of BlockSize() bytes. A caller acquires a
+ * buffer slot, queues a read into it or a write from it, and collects the
+ * result with Wait. Queued requests are not sent to the kernel until Submit
+ * or Wait, so several can go in one batch. A slot belongs to the caller
+ * from AcquireSlot until ReleaseSlot, including while its request is in
+ * flight.
+ *
+ * Engines are not thread safe. Use ForThread to get the calling thread's
+ * engine, and Drain before handing it back so no request outlives the call.
+ */
+class DFSIoEngine {
+protected:
+    size_t block_size;
+    std::vector<char*> buffers;
+    std::vector<unsigned> free_slots;
+    unsigned in_flight = 0;
+
+    DFSIoEngine(unsigned depth, size_t block_size);
+
+public:
+    virtual ~DFSIoEngine();
+
+    /**
+     * Build an engine of the given kind. DFS_IO_URING falls back to the posix
+     * engine if io_uring can not be set up.
+     */
+    static std::unique_ptr<DFSIoEngine> Create(DFSIoKind kind, unsigned depth = DFS_IO_QUEUE_DEPTH,
+                                               size_t block_size = DFS_IO_BLOCK_SIZE);
+
+    /**
+     * The calling thread's engine, created on first use or when kind changes
+     */
+    static DFSIoEngine& ForThread(DFSIoKind kind);
+
+    virtual const char* Name() const = 0;
+
+    unsigned Depth() const { return static_cast<unsigned>(buffers.size()); }
+    size_t BlockSize() const { return block_size; }
+    char* Buffer(unsigned slot) { return buffers[slot]; }
+    unsigned InFlight() const { return in_flight; }
+
+    /**
+     * A free buffer slot, or -1 if every slot is taken
+     */
+    int AcquireSlot();
+    void ReleaseSlot(unsigned slot);
+
+    /**
+     * Queue a read of length bytes at offset into the slot's buffer
+     */
+    virtual void QueueRead(unsigned slot, int fd, size_t length, off_t offset) = 0;
+
+    /**
+     * Queue a write of the first length bytes of the slot's buffer at offset
+     */
+    virtual void QueueWrite(unsigned slot, int fd, size_t length, off_t offset) = 0;
+
+    /**
+     * Send every queued request to the kernel without waiting for them
+     */
+    virtual void Submit() = 0;
+
+    /**
+     * Submit, then block until a request completes. Sets the slot and the
+     * byte count or -errno. Returns false if nothing is in flight.
+     */
+    virtual bool Wait(unsigned* slot, ssize_t* result) = 0;
+
+    /**
+     * Wait for every request in flight and return every slot to the free
+     * list. Returns false if any request that was still in flight failed.
+     */
+    bool Drain();
+};
+
+#endif //PR4_DFS_IO_ENGINE_H
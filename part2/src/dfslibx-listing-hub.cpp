@@ -0,0 +1,182 @@
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "dfs-utils.h"
+#include "dfslibx-listing-hub.h"
+
+DFSListingHub::DFSListingHub(ScanFunction scan, RenderFunction render, int park_ms, int settle_ms) :
+    scan(scan), render(render), park_ms(park_ms), settle_ms(settle_ms) {
+    //Generations continue from the wall clock, so a restarted server never
+    //repeats one a client saw before the restart
+    generation = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+
+    DFSMetricsRegistry& registry = DFSMetricsRegistry::Instance();
+    parkedCalls = registry.Gauge("dfs_cbl_parked", "CallbackList calls held until the namespace changes");
+    scans = registry.Counter("dfs_cbl_scans_total", "Scans of the mount for CallbackList listings");
+    renders = registry.Counter("dfs_cbl_renders_total", "CallbackList replies rendered and serialized");
+    replies = registry.Counter("dfs_cbl_replies_total", "CallbackList replies sent");
+}
+
+DFSListingHub::~DFSListingHub() {
+    {
+        std::lock_guard<std::mutex> lock(hub_mutex);
+        stopping = true;
+    }
+    hub_changed.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void DFSListingHub::Start() {
+    worker = std::thread(&DFSListingHub::Run, this);
+}
+
+void DFSListingHub::Changed() {
+    {
+        std::lock_guard<std::mutex> lock(hub_mutex);
+        dirty = true;
+        changes++;
+    }
+    hub_changed.notify_all();
+}
+
+void DFSListingHub::Submit(const dfs_service::CBLRequest& request, DFSPendingCall<grpc::ByteBuffer>* call) {
+    std::shared_ptr<const DFSListingSnapshot> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(hub_mutex);
+        snapshot = current;
+        if (snapshot && request.generation() == snapshot->generation) {
+            parked.push_back({request, call, std::chrono::steady_clock::now() + std::chrono::milliseconds(park_ms)});
+            parkedCalls->Add();
+            return;
+        }
+    }
+
+    //Only the first request after a start has no listing to answer from
+    if (!snapshot) {
+        snapshot = Rescan(false);
+    }
+    std::vector<ParkedCall> calls{{request, call, std::chrono::steady_clock::now()}};
+    Reply(*snapshot, calls);
+}
+
+std::shared_ptr<const DFSListingSnapshot> DFSListingHub::Current() {
+    {
+        std::unique_lock<std::mutex> lock(hub_mutex);
+        hub_changed.wait_for(lock, std::chrono::milliseconds(DFS_CBL_CURRENT_WAIT_MS),
+                             [this] { return stopping || !current || scanned_changes == changes; });
+        if (current) {
+            return current;
+        }
+    }
+    return Rescan(false);
+}
+
+std::shared_ptr<const DFSListingSnapshot> DFSListingHub::Rescan(bool force) {
+    std::lock_guard<std::mutex> scanLock(scan_mutex);
+    if (!force) {
+        std::lock_guard<std::mutex> lock(hub_mutex);
+        if (current) {
+            return current;
+        }
+    }
+
+    std::shared_ptr<DFSListingSnapshot> snapshot = std::make_shared<DFSListingSnapshot>();
+    scan(snapshot.get());
+    scans->Add();
+
+    std::lock_guard<std::mutex> lock(hub_mutex);
+    snapshot->generation = ++generation;
+    snapshot->listing->set_generation(snapshot->generation);
+    current = snapshot;
+    return snapshot;
+}
+
+void DFSListingHub::Reply(const DFSListingSnapshot& snapshot, std::vector<ParkedCall>& calls) {
+    //Calls that asked for the same encoding and inlining share one rendered and serialized reply.
+    //Copies of a ByteBuffer share its slices, so the bytes are not copied per call.
+    std::map<std::tuple<uint64_t, uint64_t, int64_t, bool>, grpc::ByteBuffer> rendered;
+    for (ParkedCall& parkedCall : calls) {
+        const dfs_service::CBLRequest& request = parkedCall.request;
+        std::tuple<uint64_t, uint64_t, int64_t, bool> shape(request.inlinethreshold(), request.inlinebudget(),
+                                                             request.inlinesincens(), request.compact());
+        auto found = rendered.find(shape);
+        if (found == rendered.end()) {
+            google::protobuf::Arena arena(dfs_arena_options());
+            dfs_service::CBLResponse* response = google::protobuf::Arena::CreateMessage<dfs_service::CBLResponse>(&arena);
+            render(snapshot, request, response);
+            grpc::ByteBuffer buffer;
+            bool own_buffer;
+            grpc::SerializationTraits<dfs_service::CBLResponse>::Serialize(*response, &buffer, &own_buffer);
+            found = rendered.emplace(shape, std::move(buffer)).first;
+            renders->Add();
+        }
+        parkedCall.call->Reply(found->second);
+        replies->Add();
+    }
+}
+
+void DFSListingHub::Run() {
+    std::unique_lock<std::mutex> lock(hub_mutex);
+    while (!stopping) {
+        //Sleep until something changed or the oldest parked call times out. A
+        //call parked later times out later, so parking needs no wake up.
+        std::chrono::steady_clock::time_point wake = std::chrono::steady_clock::now() + std::chrono::milliseconds(park_ms);
+        for (const ParkedCall& parkedCall : parked) {
+            wake = std::min(wake, parkedCall.deadline);
+        }
+        hub_changed.wait_until(lock, wake, [this] { return stopping || (dirty && current); });
+        if (stopping) {
+            break;
+        }
+
+        std::vector<ParkedCall> answer;
+        if (dirty && current) {
+            //Let a burst of changes settle so it costs one scan
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(settle_ms));
+            lock.lock();
+            dirty = false;
+            uint64_t seen = changes;
+            lock.unlock();
+            std::shared_ptr<const DFSListingSnapshot> snapshot = Rescan(true);
+            lock.lock();
+            scanned_changes = seen;
+            hub_changed.notify_all();
+            //Calls that already name the new generation stay parked
+            auto behind = std::partition(parked.begin(), parked.end(),
+                                         [&](const ParkedCall& parkedCall) { return parkedCall.request.generation() == snapshot->generation; });
+            answer.assign(std::make_move_iterator(behind), std::make_move_iterator(parked.end()));
+            parked.erase(behind, parked.end());
+        }
+        else {
+            //Calls that timed out get the listing they already have
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            auto expired = std::partition(parked.begin(), parked.end(),
+                                          [&](const ParkedCall& parkedCall) { return parkedCall.deadline > now; });
+            answer.assign(std::make_move_iterator(expired), std::make_move_iterator(parked.end()));
+            parked.erase(expired, parked.end());
+        }
+        if (answer.empty()) {
+            continue;
+        }
+        parkedCalls->Sub(static_cast<int64_t>(answer.size()));
+        std::shared_ptr<const DFSListingSnapshot> snapshot = current;
+        lock.unlock();
+        Reply(*snapshot, answer);
+        dfs_log(LL_DEBUG) << "Listing hub | Answered " << answer.size() << " CallbackList calls from generation "
+                          << snapshot->generation;
+        lock.lock();
+    }
+}
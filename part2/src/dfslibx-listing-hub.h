@@ -0,0 +1,139 @@
+#ifndef PR4_DFS_LISTING_HUB_H
+#define PR4_DFS_LISTING_HUB_H
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+#include <sys/stat.h>
+
+#include <grpcpp/grpcpp.h>
+
+#include "../proto-src/dfs-service.grpc.pb.h"
+#include "dfslibx-call-data.h"
+#include "dfslibx-metrics.h"
+#include "dfslibx-merkle.h"
+#include "dfslibx-arena.h"
+
+/** How long a CallbackList long-poll is held without a change before it gets the current listing **/
+#define DFS_CBL_PARK_MS 30000
+
+/** Changes this close together are folded into one listing **/
+#define DFS_CBL_SETTLE_MS 20
+
+/** Longest a reader of the current listing waits for a rescan after a change **/
+#define DFS_CBL_CURRENT_WAIT_MS 1000
+
+/**
+ * One scan of the mount: the listing without inlined content, the stat
+ * of each entry in the same order, and the Merkle tree over the entries.
+ * The listing lives on the snapshot's arena and goes with it in one free.
+ */
+struct DFSListingSnapshot {
+    uint64_t generation = 0;
+    google::protobuf::Arena arena{dfs_arena_options()};
+    dfs_service::CBLResponse* listing = google::protobuf::Arena::CreateMessage<dfs_service::CBLResponse>(&arena);
+    std::vector<struct stat> stats;
+    DFSMerkleTree tree;
+};
+
+/**
+ * Holds CallbackList long-polls until the namespace changes and answers
+ * all of them from one scan.
+ *
+ * Every scan gets a new generation. A request that names the generation
+ * of the current listing is parked; any other request is answered at once
+ * from the current listing. Changed() marks the listing stale, and the hub
+ * thread then scans once and answers every parked call. Calls that waited
+ * DFS_CBL_PARK_MS without a change get the current listing again.
+ *
+ * Each reply is rendered and serialized once per distinct encoding and
+ * inlining request, and the same bytes go to every call that asked for it.
+ * A reply is rendered on an arena that is dropped once it is serialized.
+ * The server's handlers report their own changes, and the namespace
+ * index reports the ones its inotify watcher sees.
+ */
+class DFSListingHub {
+public:
+    typedef std::function<void(DFSListingSnapshot* snapshot)> ScanFunction;
+    typedef std::function<void(const DFSListingSnapshot& snapshot, const dfs_service::CBLRequest& request,
+                               dfs_service::CBLResponse* response)> RenderFunction;
+
+private:
+    struct ParkedCall {
+        dfs_service::CBLRequest request;
+        DFSPendingCall<grpc::ByteBuffer>* call;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    ScanFunction scan;
+    RenderFunction render;
+    int park_ms;
+    int settle_ms;
+
+    std::mutex hub_mutex;
+    std::condition_variable hub_changed;
+    std::vector<ParkedCall> parked;
+    std::shared_ptr<const DFSListingSnapshot> current;
+    uint64_t generation;
+    bool dirty = false;
+    /** Changes reported, and how many of them the current listing includes **/
+    uint64_t changes = 0;
+    uint64_t scanned_changes = 0;
+    bool stopping = false;
+    std::thread worker;
+
+    /** Held for the length of a scan so two never run at once **/
+    std::mutex scan_mutex;
+
+    DFSGauge* parkedCalls;
+    DFSCounter* scans;
+    DFSCounter* renders;
+    DFSCounter* replies;
+
+    /**
+     * Scan the mount into a new current listing. Without force an existing
+     * listing is returned instead.
+     */
+    std::shared_ptr<const DFSListingSnapshot> Rescan(bool force);
+
+    /**
+     * Answer calls from snapshot, rendering once per distinct request
+     */
+    void Reply(const DFSListingSnapshot& snapshot, std::vector<ParkedCall>& calls);
+
+    void Run();
+
+public:
+    DFSListingHub(ScanFunction scan, RenderFunction render,
+                  int park_ms = DFS_CBL_PARK_MS, int settle_ms = DFS_CBL_SETTLE_MS);
+    ~DFSListingHub();
+
+    /**
+     * Start the thread that rescans after changes and answers parked calls
+     */
+    void Start();
+
+    /**
+     * Mark the listing stale after a file was written or deleted
+     */
+    void Changed();
+
+    /**
+     * Answer call now if the request is behind the current listing,
+     * otherwise park it until the next change or its timeout
+     */
+    void Submit(const dfs_service::CBLRequest& request, DFSPendingCall<grpc::ByteBuffer>* call);
+
+    /**
+     * The current listing. A change not scanned yet is waited for, up to
+     * DFS_CBL_CURRENT_WAIT_MS.
+     */
+    std::shared_ptr<const DFSListingSnapshot> Current();
+};
+
+#endif //PR4_DFS_LISTING_HUB_H
@@ -0,0 +1,213 @@
+#ifndef PR4_DFS_LOG_H
+#define PR4_DFS_LOG_H
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <type_traits>
+
+/**
+ * Logging levels
+ */
+enum dfs_log_level_e {LL_SYSINFO, LL_ERROR, LL_DEBUG, LL_DEBUG2, LL_DEBUG3};
+
+/** Largest encoded record; longer messages are truncated **/
+#define DFS_LOG_RECORD_SIZE 1024
+
+/** Size of each thread's ring buffer in bytes (power of two) **/
+#define DFS_LOG_RING_SIZE (1 << 18)
+
+/**
+ * Argument tags used in the binary log records
+ */
+enum dfs_log_tag_e : uint8_t {DFS_LOG_TAG_STR, DFS_LOG_TAG_INT, DFS_LOG_TAG_UINT, DFS_LOG_TAG_DOUBLE,
+                              DFS_LOG_TAG_CHAR, DFS_LOG_TAG_BOOL, DFS_LOG_TAG_PTR};
+
+/**
+ * Fixed header at the start of every binary log record
+ */
+struct DFSLogRecordHeader {
+    uint16_t length;
+    uint8_t level;
+    uint8_t truncated;
+    uint32_t thread_id;
+    int64_t timestamp_ns;
+};
+
+/**
+ * Hand a finished record to the calling thread's ring. Records are dropped
+ * (and counted) rather than blocking when the ring is full.
+ */
+void dfs_log_commit(const char* record, size_t length);
+
+/**
+ * Write every record logged so far to the output before returning
+ */
+void dfs_log_flush();
+
+/**
+ * Send formatted log lines to output instead of stderr
+ */
+void dfs_log_set_output(FILE* output);
+
+/**
+ * Number of records dropped because a ring was full
+ */
+uint64_t dfs_log_dropped();
+
+/**
+ * The calling thread's cached id for log records
+ */
+uint32_t dfs_log_thread_id();
+
+/**
+ * Current time for log records in nanoseconds
+ */
+int64_t dfs_log_now_ns();
+
+/**
+ * Simple logging class
+ *
+ * This is a simple multi-tiered logging class
+ * that can be used throughout the project.
+ *
+ * The `dfs_log` utility defined below provides the interface
+ * and acts as a streaming input that you can send information to.
+ *
+ * You can set the log-level when you use the `dfs-client` or `dfs-server`
+ * commands.
+ *
+ * Arguments are not formatted on the calling thread. Each `<<` appends a
+ * tagged binary value to a record on the stack, the destructor copies the
+ * record into a lock-free ring owned by the calling thread, and a
+ * background thread drains the rings, formats the lines and writes them
+ * to stderr in timestamp order.
+ *
+ * NOTE: during testing, the log will only output DEBUG1 and up levels (i.e., LL_DEBUG, LL_ERROR, LL_SYSINFO)
+ *
+ * Usage:
+ *
+ *      dfs_log(LL_DEBUG) << "Type your message here: " << add_a_variable << ", and more info, etc."
+ *
+ */
+class DFSLog
+{
+    private:
+        /** Starts with a DFSLogRecordHeader, so it is aligned for one **/
+        alignas(DFSLogRecordHeader) char record[DFS_LOG_RECORD_SIZE];
+        size_t length;
+
+        DFSLogRecordHeader* Header() {
+            return reinterpret_cast<DFSLogRecordHeader*>(record);
+        }
+
+        bool Reserve(size_t size) {
+            if (length + size > DFS_LOG_RECORD_SIZE) {
+                Header()->truncated = 1;
+                return false;
+            }
+            return true;
+        }
+
+        DFSLog & AppendValue(dfs_log_tag_e tag, const void* value, size_t size) {
+            if (Reserve(1 + size)) {
+                record[length++] = static_cast<char>(tag);
+                memcpy(record + length, value, size);
+                length += size;
+            }
+            return *this;
+        }
+
+        DFSLog & AppendString(const char* value, size_t size) {
+            if (length + 3 >= DFS_LOG_RECORD_SIZE) {
+                Header()->truncated = 1;
+                return *this;
+            }
+            if (length + 3 + size > DFS_LOG_RECORD_SIZE) {
+                size = DFS_LOG_RECORD_SIZE - length - 3;
+                Header()->truncated = 1;
+            }
+            uint16_t size16 = static_cast<uint16_t>(size);
+            record[length++] = static_cast<char>(DFS_LOG_TAG_STR);
+            memcpy(record + length, &size16, sizeof(size16));
+            length += sizeof(size16);
+            memcpy(record + length, value, size);
+            length += size;
+            return *this;
+        }
+
+    public:
+        DFSLog(dfs_log_level_e level = LL_ERROR) : length(sizeof(DFSLogRecordHeader)) {
+            DFSLogRecordHeader* header = Header();
+            header->level = static_cast<uint8_t>(level);
+            header->truncated = 0;
+            header->thread_id = dfs_log_thread_id();
+            header->timestamp_ns = dfs_log_now_ns();
+        }
+
+        DFSLog & operator<<(const std::string & value) { return AppendString(value.data(), value.length()); }
+        DFSLog & operator<<(const char * value) {
+            return value == nullptr ? AppendString("(null)", 6) : AppendString(value, strlen(value));
+        }
+        DFSLog & operator<<(char value) { return AppendValue(DFS_LOG_TAG_CHAR, &value, sizeof(value)); }
+        DFSLog & operator<<(signed char value) { return *this << static_cast<char>(value); }
+        DFSLog & operator<<(unsigned char value) { return *this << static_cast<char>(value); }
+        DFSLog & operator<<(bool value) { return AppendValue(DFS_LOG_TAG_BOOL, &value, sizeof(value)); }
+
+        template <typename T>
+            typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value) || std::is_enum<T>::value, DFSLog &>::type
+            operator<<(T value) {
+                int64_t encoded = static_cast<int64_t>(value);
+                return AppendValue(DFS_LOG_TAG_INT, &encoded, sizeof(encoded));
+            }
+
+        template <typename T>
+            typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, DFSLog &>::type
+            operator<<(T value) {
+                uint64_t encoded = static_cast<uint64_t>(value);
+                return AppendValue(DFS_LOG_TAG_UINT, &encoded, sizeof(encoded));
+            }
+
+        template <typename T>
+            typename std::enable_if<std::is_floating_point<T>::value, DFSLog &>::type
+            operator<<(T value) {
+                double encoded = static_cast<double>(value);
+                return AppendValue(DFS_LOG_TAG_DOUBLE, &encoded, sizeof(encoded));
+            }
+
+        template <typename T>
+            typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value, DFSLog &>::type
+            operator<<(T * value) {
+                const void* encoded = static_cast<const void*>(value);
+                return AppendValue(DFS_LOG_TAG_PTR, &encoded, sizeof(encoded));
+            }
+
+        // Anything else is formatted with its stream operator on the calling thread
+        template <typename T>
+            typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_enum<T>::value &&
+                                    !std::is_pointer<T>::value && !std::is_array<T>::value, DFSLog &>::type
+            operator<<(T const & value) {
+                std::ostringstream buffer;
+                buffer << value;
+                return *this << buffer.str();
+            }
+
+        ~DFSLog() {
+            Header()->length = static_cast<uint16_t>(length);
+            dfs_log_commit(record, length);
+        }
+};
+
+/**
+ * Log level defined in dfslib-shared-*.cpp
+ */
+extern dfs_log_level_e DFS_LOG_LEVEL;
+
+/**
+ * Utility function for logging details to std::cerr
+ */
+#define dfs_log(_level) if (_level > DFS_LOG_LEVEL) ; else DFSLog(_level)
+
+#endif //PR4_DFS_LOG_H
@@ -0,0 +1,162 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include "dfslibx-merkle.h"
+
+/** Finalizer of splitmix64, spreads every input bit over the whole result **/
+static uint64_t MerkleMix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/** 64-bit FNV-1a of a name, mixed so its leading digits are uniform **/
+static uint64_t MerkleNameHash(const std::string& name) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return MerkleMix(hash);
+}
+
+static uint64_t MerkleCombine(uint64_t hash, uint64_t value) {
+    return MerkleMix(hash ^ MerkleMix(value + 0x9e3779b97f4a7c15ULL));
+}
+
+static size_t LevelWidth(size_t level) {
+    return static_cast<size_t>(1) << (4 * level);
+}
+
+DFSMerkleTree::DFSMerkleTree() {
+    Seal();
+}
+
+size_t DFSMerkleTree::Bucket(const std::string& name) {
+    return static_cast<size_t>(MerkleNameHash(name) >> (64 - 4 * DFS_MERKLE_DEPTH));
+}
+
+std::string DFSMerkleTree::ChildPath(const std::string& path, int digit) {
+    return path + "0123456789abcdef"[digit & 0xf];
+}
+
+bool DFSMerkleTree::Locate(const std::string& path, size_t* level, size_t* index) {
+    if (path.length() > DFS_MERKLE_DEPTH) {
+        return false;
+    }
+    size_t value = 0;
+    for (char c : path) {
+        int digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else {
+            return false;
+        }
+        value = (value << 4) | static_cast<size_t>(digit);
+    }
+    *level = path.length();
+    *index = value;
+    return true;
+}
+
+void DFSMerkleTree::Add(DFSMerkleEntry entry) {
+    entries.push_back(std::move(entry));
+}
+
+void DFSMerkleTree::Seal() {
+    size_t buckets = LevelWidth(DFS_MERKLE_DEPTH);
+    std::vector<std::pair<size_t, size_t>> order(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        order[i] = {Bucket(entries[i].name), i};
+    }
+    std::sort(order.begin(), order.end(), [this](const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b) {
+        return a.first != b.first ? a.first < b.first : entries[a.second].name < entries[b.second].name;
+    });
+    std::vector<DFSMerkleEntry> sorted;
+    sorted.reserve(entries.size());
+    for (const std::pair<size_t, size_t>& position : order) {
+        sorted.push_back(std::move(entries[position.second]));
+    }
+    entries.swap(sorted);
+
+    bucket_start.assign(buckets + 1, 0);
+    for (const std::pair<size_t, size_t>& position : order) {
+        bucket_start[position.first + 1]++;
+    }
+    for (size_t bucket = 0; bucket < buckets; bucket++) {
+        bucket_start[bucket + 1] += bucket_start[bucket];
+    }
+
+    level_hashes.assign(DFS_MERKLE_DEPTH + 1, std::vector<uint64_t>());
+    std::vector<uint64_t>& leaves = level_hashes[DFS_MERKLE_DEPTH];
+    leaves.assign(buckets, 0);
+    for (size_t bucket = 0; bucket < buckets; bucket++) {
+        if (bucket_start[bucket] == bucket_start[bucket + 1]) {
+            continue;
+        }
+        uint64_t hash = 0;
+        for (uint32_t i = bucket_start[bucket]; i < bucket_start[bucket + 1]; i++) {
+            const DFSMerkleEntry& entry = entries[i];
+            hash = MerkleCombine(hash, MerkleNameHash(entry.name));
+            hash = MerkleCombine(hash, static_cast<uint64_t>(entry.size));
+            hash = MerkleCombine(hash, entry.checksum);
+        }
+        leaves[bucket] = hash | 1;
+    }
+
+    for (size_t level = DFS_MERKLE_DEPTH; level > 0; level--) {
+        const std::vector<uint64_t>& children = level_hashes[level];
+        std::vector<uint64_t>& parents = level_hashes[level - 1];
+        parents.assign(LevelWidth(level - 1), 0);
+        for (size_t parent = 0; parent < parents.size(); parent++) {
+            uint64_t hash = 0;
+            bool empty = true;
+            for (size_t child = 0; child < DFS_MERKLE_FANOUT; child++) {
+                uint64_t childHash = children[parent * DFS_MERKLE_FANOUT + child];
+                empty = empty && childHash == 0;
+                hash = MerkleCombine(hash, childHash);
+            }
+            parents[parent] = empty ? 0 : hash | 1;
+        }
+    }
+}
+
+bool DFSMerkleTree::Node(const std::string& path, uint64_t* hash, uint64_t* files) const {
+    size_t level, index;
+    if (!Locate(path, &level, &index)) {
+        return false;
+    }
+    size_t shift = 4 * (DFS_MERKLE_DEPTH - level);
+    *hash = level_hashes[level][index];
+    *files = bucket_start[(index + 1) << shift] - bucket_start[index << shift];
+    return true;
+}
+
+bool DFSMerkleTree::Children(const std::string& path, uint64_t* hashes) const {
+    size_t level, index;
+    if (!Locate(path, &level, &index) || level == DFS_MERKLE_DEPTH) {
+        return false;
+    }
+    const std::vector<uint64_t>& children = level_hashes[level + 1];
+    std::copy(children.begin() + index * DFS_MERKLE_FANOUT, children.begin() + (index + 1) * DFS_MERKLE_FANOUT, hashes);
+    return true;
+}
+
+bool DFSMerkleTree::Files(const std::string& path, const DFSMerkleEntry** begin, const DFSMerkleEntry** end) const {
+    size_t level, index;
+    if (!Locate(path, &level, &index)) {
+        return false;
+    }
+    size_t shift = 4 * (DFS_MERKLE_DEPTH - level);
+    *begin = entries.data() + bucket_start[index << shift];
+    *end = entries.data() + bucket_start[(index + 1) << shift];
+    return true;
+}
@@ -0,0 +1,110 @@
+#ifndef PR4_DFS_MERKLE_H
+#define PR4_DFS_MERKLE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/** Children of each inner node of the namespace tree, one per hex digit **/
+#define DFS_MERKLE_FANOUT 16
+
+/** Levels below the root. Files are bucketed by the first this many hex digits of their name hash **/
+#define DFS_MERKLE_DEPTH 4
+
+/** A node holding this many files or fewer is sent as its files instead of its children **/
+#define DFS_MERKLE_LEAF_FILES 64
+
+/** Nodes asked for in one GetTreeNodes call, longer lists are split over several **/
+#define DFS_MERKLE_MAX_NODES 4096
+
+/** Times a reconcile starts over when the server's listing changes under it **/
+#define DFS_MERKLE_RETRIES 3
+
+/**
+ * One file in the tree. The mtime is carried so a sync can tell which side
+ * is newer, but it is not hashed: a fetched or stored copy gets a new mtime
+ * while its name, size and checksum match.
+ */
+struct DFSMerkleEntry {
+    std::string name;
+    int64_t size;
+    uint32_t checksum;
+    int64_t mtime;
+};
+
+/**
+ * Merkle tree over the files of a mount.
+ *
+ * The tree has a fixed shape: every file goes to the leaf bucket named by
+ * the first DFS_MERKLE_DEPTH hex digits of a hash of its name, and a node
+ * is addressed by the digits on the way to it ("" is the root). A leaf
+ * hashes the (name, size, checksum) of its files in name order, an inner
+ * node hashes its children, and an empty subtree hashes to 0. Two trees
+ * with the same root hold the same files, and a difference is found by
+ * comparing only the children of nodes whose hashes differ.
+ *
+ * Add the files, then Seal. A sealed tree is read only.
+ */
+class DFSMerkleTree {
+private:
+    /** Files ordered by bucket, then name **/
+    std::vector<DFSMerkleEntry> entries;
+
+    /** Index of the first file of each bucket, with one past the last at the end **/
+    std::vector<uint32_t> bucket_start;
+
+    /** Node hashes for each level, the root at level 0 **/
+    std::vector<std::vector<uint64_t>> level_hashes;
+
+    /**
+     * Parse a node path into its level and its index on that level
+     */
+    static bool Locate(const std::string& path, size_t* level, size_t* index);
+
+public:
+    DFSMerkleTree();
+
+    /**
+     * The leaf bucket a file name belongs to
+     */
+    static size_t Bucket(const std::string& name);
+
+    /**
+     * The path of child digit of the node at path
+     */
+    static std::string ChildPath(const std::string& path, int digit);
+
+    void Add(DFSMerkleEntry entry);
+
+    /**
+     * Sort the files and compute every node hash
+     */
+    void Seal();
+
+    size_t Size() const { return entries.size(); }
+
+    uint64_t RootHash() const { return level_hashes[0][0]; }
+
+    /**
+     * The hash of the node at path and the files under it
+     *
+     * @return false if path is not a node of the tree
+     */
+    bool Node(const std::string& path, uint64_t* hash, uint64_t* files) const;
+
+    /**
+     * The DFS_MERKLE_FANOUT child hashes of an inner node
+     *
+     * @return false if path is not an inner node
+     */
+    bool Children(const std::string& path, uint64_t* hashes) const;
+
+    /**
+     * The files under the node at path, a range ordered by bucket and name
+     *
+     * @return false if path is not a node of the tree
+     */
+    bool Files(const std::string& path, const DFSMerkleEntry** begin, const DFSMerkleEntry** end) const;
+};
+
+#endif //PR4_DFS_MERKLE_H
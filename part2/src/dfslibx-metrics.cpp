@@ -0,0 +1,129 @@
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+
+#include "dfslibx-metrics.h"
+
+DFSMetricsRegistry& DFSMetricsRegistry::Instance() {
+    static DFSMetricsRegistry registry;
+    return registry;
+}
+
+DFSMetricsRegistry::Entry* DFSMetricsRegistry::FindOrCreate(const std::string& name,
+                                                            const std::string& labels,
+                                                            const std::string& help,
+                                                            dfs_metric_type_e type) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::string key = name + "{" + labels + "}";
+    auto found = entries.find(key);
+    if (found != entries.end()) {
+        return found->second.get();
+    }
+
+    std::unique_ptr<Entry> entry(new Entry());
+    entry->name = name;
+    entry->labels = labels;
+    entry->help = help;
+    entry->type = type;
+    if (type == DFS_METRIC_COUNTER) { entry->counter.reset(new DFSCounter()); }
+    if (type == DFS_METRIC_GAUGE) { entry->gauge.reset(new DFSGauge()); }
+    if (type == DFS_METRIC_HISTOGRAM) { entry->histogram.reset(new DFSHistogram()); }
+
+    Entry* raw = entry.get();
+    entries[key] = std::move(entry);
+    return raw;
+}
+
+DFSCounter* DFSMetricsRegistry::Counter(const std::string& name, const std::string& help, const std::string& labels) {
+    return FindOrCreate(name, labels, help, DFS_METRIC_COUNTER)->counter.get();
+}
+
+DFSGauge* DFSMetricsRegistry::Gauge(const std::string& name, const std::string& help, const std::string& labels) {
+    return FindOrCreate(name, labels, help, DFS_METRIC_GAUGE)->gauge.get();
+}
+
+DFSHistogram* DFSMetricsRegistry::Histogram(const std::string& name, const std::string& help, const std::string& labels) {
+    return FindOrCreate(name, labels, help, DFS_METRIC_HISTOGRAM)->histogram.get();
+}
+
+std::vector<DFSMetricSnapshot> DFSMetricsRegistry::Snapshot(const std::string& prefix) {
+    std::vector<DFSMetricSnapshot> snapshots;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    for (auto& item : entries) {
+        const Entry& entry = *item.second;
+        if (entry.name.compare(0, prefix.length(), prefix) != 0) { continue; }
+
+        DFSMetricSnapshot snapshot = {entry.name, entry.labels, entry.help, entry.type, 0, 0, 0, 0, 0, 0, 0, 0};
+        if (entry.counter) {
+            snapshot.value = static_cast<int64_t>(entry.counter->Value());
+        } else if (entry.gauge) {
+            snapshot.value = entry.gauge->Value();
+        } else if (entry.histogram) {
+            snapshot.count = entry.histogram->Count();
+            snapshot.sum = entry.histogram->Sum();
+            snapshot.max = entry.histogram->Max();
+            snapshot.p50 = entry.histogram->Percentile(0.50);
+            snapshot.p90 = entry.histogram->Percentile(0.90);
+            snapshot.p99 = entry.histogram->Percentile(0.99);
+            snapshot.p999 = entry.histogram->Percentile(0.999);
+        }
+        snapshots.push_back(snapshot);
+    }
+
+    return snapshots;
+}
+
+std::string DFSMetricsRegistry::PrometheusText() {
+    std::ostringstream text;
+    std::string last_name;
+
+    // Entries are keyed by name first, so all label sets of a metric are adjacent
+    for (const DFSMetricSnapshot& metric : Snapshot()) {
+        std::string labels = metric.labels.empty() ? "" : "{" + metric.labels + "}";
+        std::string separator = metric.labels.empty() ? "" : ",";
+
+        if (metric.name != last_name) {
+            text << "# HELP " << metric.name << " " << metric.help << "\n";
+            text << "# TYPE " << metric.name << " "
+                 << (metric.type == DFS_METRIC_COUNTER ? "counter" :
+                     (metric.type == DFS_METRIC_GAUGE ? "gauge" : "summary")) << "\n";
+            last_name = metric.name;
+        }
+
+        if (metric.type != DFS_METRIC_HISTOGRAM) {
+            text << metric.name << labels << " " << metric.value << "\n";
+            continue;
+        }
+
+        const std::pair<const char*, uint64_t> quantiles[] = {
+            {"0.5", metric.p50}, {"0.9", metric.p90}, {"0.99", metric.p99}, {"0.999", metric.p999}, {"1", metric.max}
+        };
+        for (const auto& quantile : quantiles) {
+            text << metric.name << "{" << metric.labels << separator
+                 << "quantile=\"" << quantile.first << "\"} " << quantile.second << "\n";
+        }
+        text << metric.name << "_sum" << labels << " " << metric.sum << "\n";
+        text << metric.name << "_count" << labels << " " << metric.count << "\n";
+    }
+
+    return text.str();
+}
+
+bool DFSMetricsRegistry::WritePrometheusFile(const std::string& path) {
+    std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << PrometheusText();
+    file.close();
+    if (file.fail()) {
+        return false;
+    }
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,226 @@
+#ifndef PR4_DFS_METRICS_H
+#define PR4_DFS_METRICS_H
+
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Metric types known to the registry
+ */
+enum dfs_metric_type_e {DFS_METRIC_COUNTER, DFS_METRIC_GAUGE, DFS_METRIC_HISTOGRAM};
+
+/**
+ * A monotonically increasing lock-free counter
+ */
+class DFSCounter {
+private:
+    std::atomic<uint64_t> value{0};
+
+public:
+    void Add(uint64_t amount = 1) { value.fetch_add(amount, std::memory_order_relaxed); }
+    uint64_t Value() const { return value.load(std::memory_order_relaxed); }
+};
+
+/**
+ * A lock-free gauge that can go up and down
+ */
+class DFSGauge {
+private:
+    std::atomic<int64_t> value{0};
+
+public:
+    void Add(int64_t amount = 1) { value.fetch_add(amount, std::memory_order_relaxed); }
+    void Sub(int64_t amount = 1) { value.fetch_sub(amount, std::memory_order_relaxed); }
+    void Set(int64_t amount) { value.store(amount, std::memory_order_relaxed); }
+    int64_t Value() const { return value.load(std::memory_order_relaxed); }
+};
+
+/**
+ * HDR-style log-linear latency histogram.
+ *
+ * Values below 2^DFS_HIST_SUB_BITS get one bucket each, every power of two
+ * above that is split into 2^DFS_HIST_SUB_BITS linear sub-buckets. This keeps
+ * the relative error of any reported quantile under ~6% while recording
+ * is a handful of instructions and a relaxed atomic increment.
+ *
+ * Values are unitless; the server records microseconds.
+ */
+#define DFS_HIST_SUB_BITS 4
+#define DFS_HIST_SUB_COUNT (1 << DFS_HIST_SUB_BITS)
+#define DFS_HIST_MAX_BITS 48
+#define DFS_HIST_BUCKETS ((DFS_HIST_MAX_BITS - DFS_HIST_SUB_BITS + 1) * DFS_HIST_SUB_COUNT)
+
+class DFSHistogram {
+private:
+    std::atomic<uint64_t> buckets[DFS_HIST_BUCKETS];
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+
+public:
+    DFSHistogram() {
+        for (std::atomic<uint64_t>& bucket : buckets) { bucket.store(0, std::memory_order_relaxed); }
+    }
+
+    static int BucketIndex(uint64_t value) {
+        if (value < DFS_HIST_SUB_COUNT) { return static_cast<int>(value); }
+        int msb = 63 - __builtin_clzll(value);
+        if (msb >= DFS_HIST_MAX_BITS) { return DFS_HIST_BUCKETS - 1; }
+        int shift = msb - DFS_HIST_SUB_BITS;
+        int sub = static_cast<int>((value >> shift) & (DFS_HIST_SUB_COUNT - 1));
+        return (shift + 1) * DFS_HIST_SUB_COUNT + sub;
+    }
+
+    static uint64_t BucketUpperBound(int index) {
+        if (index < DFS_HIST_SUB_COUNT) { return static_cast<uint64_t>(index); }
+        int shift = index / DFS_HIST_SUB_COUNT - 1;
+        uint64_t sub = static_cast<uint64_t>(index % DFS_HIST_SUB_COUNT) | DFS_HIST_SUB_COUNT;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void Record(uint64_t value) {
+        buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = max.load(std::memory_order_relaxed);
+        while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+    uint64_t Sum() const { return sum.load(std::memory_order_relaxed); }
+    uint64_t Max() const { return max.load(std::memory_order_relaxed); }
+
+    /**
+     * The upper bound of the bucket holding the given quantile (0.0 - 1.0)
+     */
+    uint64_t Percentile(double quantile) const {
+        uint64_t total = Count();
+        if (total == 0) { return 0; }
+        uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(total));
+        if (rank >= total) { rank = total - 1; }
+        uint64_t seen = 0;
+        for (int i = 0; i < DFS_HIST_BUCKETS; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen > rank) { return std::min(BucketUpperBound(i), Max()); }
+        }
+        return Max();
+    }
+};
+
+/**
+ * A point in time copy of one metric, used for the GetMetrics RPC and
+ * the Prometheus exporter
+ */
+struct DFSMetricSnapshot {
+    std::string name;
+    std::string labels;
+    std::string help;
+    dfs_metric_type_e type;
+    int64_t value;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+};
+
+/**
+ * Process wide metrics registry.
+ *
+ * Registration takes a mutex and should happen once per metric (keep the
+ * returned pointer around); updating a metric never takes a lock. Labels
+ * are passed pre-formatted in Prometheus syntax, e.g. `method="fileFetcher"`.
+ *
+ * Usage:
+ *
+ *      static DFSCounter* bytes = DFSMetricsRegistry::Instance().Counter("dfs_bytes_in_total", "Bytes received");
+ *      bytes->Add(chunk.length());
+ */
+class DFSMetricsRegistry {
+private:
+    struct Entry {
+        std::string name;
+        std::string labels;
+        std::string help;
+        dfs_metric_type_e type;
+        std::unique_ptr<DFSCounter> counter;
+        std::unique_ptr<DFSGauge> gauge;
+        std::unique_ptr<DFSHistogram> histogram;
+    };
+
+    std::mutex registry_mutex;
+    std::map<std::string, std::unique_ptr<Entry>> entries;
+
+    Entry* FindOrCreate(const std::string& name, const std::string& labels,
+                        const std::string& help, dfs_metric_type_e type);
+
+public:
+    static DFSMetricsRegistry& Instance();
+
+    DFSCounter* Counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    DFSGauge* Gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    DFSHistogram* Histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    /**
+     * Copy every registered metric whose name starts with prefix
+     */
+    std::vector<DFSMetricSnapshot> Snapshot(const std::string& prefix = "");
+
+    /**
+     * Render every metric in the Prometheus text exposition format
+     */
+    std::string PrometheusText();
+
+    /**
+     * Atomically replace the file at path with the Prometheus text
+     *
+     * @return true if the file was written
+     */
+    bool WritePrometheusFile(const std::string& path);
+};
+
+/**
+ * Records the time between construction and destruction into a histogram
+ * in microseconds. A null histogram makes the timer a no-op.
+ */
+class DFSScopedTimer {
+private:
+    DFSHistogram* histogram;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit DFSScopedTimer(DFSHistogram* histogram) :
+        histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+    uint64_t ElapsedUs() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    ~DFSScopedTimer() {
+        if (histogram) { histogram->Record(ElapsedUs()); }
+    }
+};
+
+/**
+ * Increments a gauge for the lifetime of the object, e.g. active streams
+ */
+class DFSScopedGauge {
+private:
+    DFSGauge* gauge;
+
+public:
+    explicit DFSScopedGauge(DFSGauge* gauge) : gauge(gauge) { gauge->Add(); }
+    ~DFSScopedGauge() { gauge->Sub(); }
+};
+
+#endif //PR4_DFS_METRICS_H
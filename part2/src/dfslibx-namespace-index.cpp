@@ -0,0 +1,391 @@
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "dfs-utils.h"
+#include "dfslibx-content-cache.h"
+#include "dfslibx-dir-reader.h"
+#include "dfslibx-index-log.h"
+#include "dfslibx-namespace-index.h"
+
+/** Events that leave a file in the mount complete, renamed or gone **/
+#define DFS_INDEX_EVENTS (IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+//Stat a path and keep it only if it is a regular file
+static bool StatFile(const std::string& path, struct stat* st) {
+    return stat(path.c_str(), st) == 0 && S_ISREG(st->st_mode);
+}
+
+//statx only the fields the index keeps, into a stat, and keep it only if it is a regular file
+static bool StatxFile(int directory, const char* name, struct stat* st) {
+    struct statx sx;
+    if (statx(directory, name, AT_STATX_SYNC_AS_STAT,
+              STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME, &sx) != 0) {
+        return false;
+    }
+    memset(st, 0, sizeof(*st));
+    st->st_mode = sx.stx_mode;
+    st->st_ino = sx.stx_ino;
+    st->st_size = static_cast<off_t>(sx.stx_size);
+    st->st_mtim.tv_sec = sx.stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = sx.stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = sx.stx_ctime.tv_nsec;
+    return S_ISREG(st->st_mode);
+}
+
+//Same file version, and the same ctime so status replies stay exact
+static bool SameStat(const struct stat& a, const struct stat& b) {
+    return DFSFileVersion::FromStat(a) == DFSFileVersion::FromStat(b) &&
+           a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
+size_t DFSNamespaceIndex::Snapshot::Size() const {
+    size_t count = 0;
+    for (const std::shared_ptr<const Shard>& shard : shards) {
+        count += shard->size();
+    }
+    return count;
+}
+
+DFSNamespaceIndex::DFSNamespaceIndex(const std::string& mount_path, ChecksumFunction checksum) :
+    mount_path(mount_path), checksum(checksum) {
+    for (size_t index = 0; index < DFS_INDEX_SHARDS; index++) {
+        shards[index] = std::make_shared<const Shard>();
+    }
+
+    DFSMetricsRegistry& registry = DFSMetricsRegistry::Instance();
+    files = registry.Gauge("dfs_index_files", "Files in the namespace index");
+    updates = registry.Counter("dfs_index_updates_total", "Files added, changed or removed in the namespace index");
+    reloads = registry.Counter("dfs_index_reloads_total", "Scans of the whole mount into the namespace index");
+}
+
+DFSNamespaceIndex::~DFSNamespaceIndex() {
+    stopping = true;
+    if (watcher.joinable()) {
+        watcher.join();
+    }
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+}
+
+void DFSNamespaceIndex::SetLogPath(const std::string& path) {
+    log.reset(new DFSIndexLog(path));
+}
+
+void DFSNamespaceIndex::LogChange(const std::string& name, const DFSIndexEntry* entry) {
+    if (logging) {
+        log->Append(name, entry);
+    }
+}
+
+size_t DFSNamespaceIndex::ShardOf(const std::string& name) {
+    return std::hash<std::string>()(name) % DFS_INDEX_SHARDS;
+}
+
+std::shared_ptr<const DFSNamespaceIndex::Shard> DFSNamespaceIndex::LoadShard(size_t index) const {
+    return std::atomic_load(&shards[index]);
+}
+
+void DFSNamespaceIndex::PublishShard(size_t index, std::shared_ptr<const Shard> shard) {
+    std::atomic_store(&shards[index], std::move(shard));
+}
+
+long DFSNamespaceIndex::Start(ChangeFunction changed) {
+    //Watch before loading so a change made during the load is not missed
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, mount_path.c_str(), DFS_INDEX_EVENTS) < 0) {
+        dfs_log(LL_ERROR) << "Namespace index | Unable to watch " << mount_path << ": " << strerror(errno)
+                          << ", changes made outside the server will not be seen";
+        if (inotify_fd >= 0) {
+            close(inotify_fd);
+            inotify_fd = -1;
+        }
+    }
+
+    //Entries from the log stand until the reload finds their file changed
+    if (log) {
+        std::vector<std::shared_ptr<Shard>> replayed(DFS_INDEX_SHARDS);
+        for (std::shared_ptr<Shard>& shard : replayed) {
+            shard = std::make_shared<Shard>();
+        }
+        long records = log->Replay([&](const std::string& name, const DFSIndexEntry* entry) {
+            Shard& shard = *replayed[ShardOf(name)];
+            if (entry == nullptr) {
+                shard.erase(name);
+                return;
+            }
+            DFSIndexEntry& stored = shard[name];
+            stored = *entry;
+            stored.version = ++version;
+        });
+        for (size_t index = 0; index < DFS_INDEX_SHARDS; index++) {
+            PublishShard(index, std::move(replayed[index]));
+        }
+        dfs_log(LL_SYSINFO) << "Namespace index | Replayed " << std::max(records, 0L) << " records from " << log->Path();
+    }
+
+    long count = Reload();
+    if (log && count >= 0) {
+        logging = log->Compact(*this);
+    }
+    this->changed = changed;
+    if (inotify_fd >= 0) {
+        watcher = std::thread(&DFSNamespaceIndex::Watch, this);
+    }
+    return count;
+}
+
+bool DFSNamespaceIndex::Refresh(const std::string& name) {
+    if (dfs_reserved_name(name)) {
+        return false;
+    }
+    std::string path = mount_path + name;
+    size_t index = ShardOf(name);
+    struct stat st;
+    bool exists = StatFile(path, &st);
+    for (int tries = 1;; tries++) {
+        //Checksum outside the shard lock, unless the index already has this version
+        uint32_t sum = 0;
+        if (exists) {
+            std::shared_ptr<const Shard> shard = LoadShard(index);
+            auto found = shard->find(name);
+            if (found != shard->end() && SameStat(found->second.st, st)) {
+                return false;
+            }
+            sum = checksum(name, path, st);
+        }
+
+        std::lock_guard<std::mutex> lock(writers[index]);
+        //A file that changed while it was checksummed is checksummed again, so
+        //a slower writer can not publish an older version over a newer one
+        struct stat now;
+        bool still = StatFile(path, &now);
+        if (tries < DFS_INDEX_REFRESH_TRIES && (still != exists || (still && !SameStat(now, st)))) {
+            exists = still;
+            st = now;
+            continue;
+        }
+
+        std::shared_ptr<const Shard> shard = LoadShard(index);
+        auto found = shard->find(name);
+        if (!exists) {
+            if (found == shard->end()) {
+                return false;
+            }
+            std::shared_ptr<Shard> copy = std::make_shared<Shard>(*shard);
+            copy->erase(name);
+            //Logged after publishing, so a compaction that misses the change in its snapshot gets the record
+            PublishShard(index, std::move(copy));
+            LogChange(name, nullptr);
+            files->Sub();
+            updates->Add();
+            return true;
+        }
+        if (found != shard->end() && SameStat(found->second.st, st)) {
+            return false;
+        }
+        std::shared_ptr<Shard> copy = std::make_shared<Shard>(*shard);
+        DFSIndexEntry entry{st, sum, ++version};
+        (*copy)[name] = entry;
+        PublishShard(index, std::move(copy));
+        LogChange(name, &entry);
+        if (found == shard->end()) {
+            files->Add();
+        }
+        updates->Add();
+        return true;
+    }
+}
+
+bool DFSNamespaceIndex::Lookup(const std::string& name, DFSIndexEntry* entry) const {
+    std::shared_ptr<const Shard> shard = LoadShard(ShardOf(name));
+    auto found = shard->find(name);
+    if (found == shard->end()) {
+        return false;
+    }
+    *entry = found->second;
+    return true;
+}
+
+DFSNamespaceIndex::Snapshot DFSNamespaceIndex::Take() const {
+    Snapshot snapshot;
+    snapshot.version = version.load();
+    snapshot.shards.reserve(DFS_INDEX_SHARDS);
+    for (size_t index = 0; index < DFS_INDEX_SHARDS; index++) {
+        snapshot.shards.push_back(LoadShard(index));
+    }
+    return snapshot;
+}
+
+long DFSNamespaceIndex::Reload() {
+    uint64_t started = version.load();
+
+    //Names come from getdents64 alone, the workers statx them and checksum the ones that changed
+    DFSDirectoryReader reader;
+    if (!reader.Open(mount_path)) {
+        dfs_log(LL_ERROR) << "Namespace index | Unable to read " << mount_path << ": " << strerror(errno);
+        return -1;
+    }
+    std::vector<std::string> names;
+    const char* name;
+    unsigned char type;
+    while (reader.Next(&name, &type)) {
+        if (type != DT_DIR && !dfs_reserved_name(name)) {
+            names.emplace_back(name);
+        }
+    }
+    if (reader.Failed()) {
+        dfs_log(LL_ERROR) << "Namespace index | Reading " << mount_path << " failed: " << strerror(errno);
+        return -1;
+    }
+
+    std::vector<DFSIndexEntry> entries(names.size());
+    std::vector<char> found(names.size(), 0);
+    std::vector<char> changedFile(names.size(), 0);
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t first = next.fetch_add(DFS_INDEX_LOAD_BATCH); first < names.size(); first = next.fetch_add(DFS_INDEX_LOAD_BATCH)) {
+            for (size_t i = first; i < std::min(first + DFS_INDEX_LOAD_BATCH, names.size()); i++) {
+                struct stat st;
+                if (!StatxFile(reader.Fd(), names[i].c_str(), &st)) {
+                    continue;
+                }
+                found[i] = 1;
+                std::shared_ptr<const Shard> shard = LoadShard(ShardOf(names[i]));
+                auto known = shard->find(names[i]);
+                if (known != shard->end() && SameStat(known->second.st, st)) {
+                    entries[i] = known->second;
+                    continue;
+                }
+                entries[i] = DFSIndexEntry{st, checksum(names[i], mount_path + names[i], st), 0};
+                changedFile[i] = 1;
+            }
+        }
+    };
+    size_t threads = std::min<size_t>({std::max(1u, std::thread::hardware_concurrency()), DFS_INDEX_LOAD_THREADS,
+                                       names.size() / DFS_INDEX_LOAD_BATCH + 1});
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    std::vector<std::shared_ptr<Shard>> loaded(DFS_INDEX_SHARDS);
+    for (std::shared_ptr<Shard>& shard : loaded) {
+        shard = std::make_shared<Shard>();
+    }
+    std::vector<std::string> changedNames;
+    long count = 0;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!found[i]) {
+            continue;
+        }
+        (*loaded[ShardOf(names[i])])[names[i]] = entries[i];
+        if (changedFile[i]) {
+            changedNames.push_back(names[i]);
+        }
+        count++;
+    }
+
+    size_t total = 0;
+    for (size_t index = 0; index < DFS_INDEX_SHARDS; index++) {
+        std::lock_guard<std::mutex> lock(writers[index]);
+        Shard& shard = *loaded[index];
+        std::shared_ptr<const Shard> previous = LoadShard(index);
+        std::vector<std::string> removed;
+        for (const Shard::value_type& file : *previous) {
+            //Entries refreshed while the scan ran are newer than what it found
+            if (file.second.version > started) {
+                shard[file.first] = file.second;
+            }
+            else if (shard.find(file.first) == shard.end()) {
+                removed.push_back(file.first);
+            }
+        }
+        std::vector<const Shard::value_type*> added;
+        for (Shard::value_type& file : shard) {
+            if (file.second.version == 0) {
+                file.second.version = ++version;
+                added.push_back(&file);
+            }
+        }
+        total += shard.size();
+        std::shared_ptr<const Shard> published = loaded[index];
+        PublishShard(index, published);
+        for (const Shard::value_type* file : added) {
+            LogChange(file->first, &file->second);
+        }
+        for (const std::string& removedName : removed) {
+            LogChange(removedName, nullptr);
+        }
+        changedNames.insert(changedNames.end(), removed.begin(), removed.end());
+    }
+    files->Set(static_cast<int64_t>(total));
+    reloads->Add();
+    updates->Add(changedNames.size());
+
+    if (changed) {
+        for (const std::string& changedName : changedNames) {
+            changed(changedName);
+        }
+    }
+    return count;
+}
+
+void DFSNamespaceIndex::Watch() {
+    alignas(struct inotify_event) char buffer[DFS_INDEX_EVENT_BUFFER];
+    struct pollfd watched = {inotify_fd, POLLIN, 0};
+    std::chrono::steady_clock::time_point retry_compaction;
+    while (!stopping) {
+        //Rewrite the log once most of its records are dead, or once it could be written again
+        if (log && std::chrono::steady_clock::now() >= retry_compaction &&
+            (!log->Appending() || log->Records() > 2 * static_cast<uint64_t>(files->Value()) + DFS_INDEX_COMPACT_MIN)) {
+            if (log->Compact(*this)) {
+                logging = true;
+            }
+            else {
+                retry_compaction = std::chrono::steady_clock::now() + std::chrono::milliseconds(DFS_INDEX_COMPACT_RETRY_MS);
+            }
+        }
+        if (poll(&watched, 1, DFS_INDEX_POLL_MS) <= 0) {
+            continue;
+        }
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            continue;
+        }
+        for (char* next = buffer; next < buffer + length;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(next);
+            next += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                dfs_log(LL_ERROR) << "Namespace index | Events were dropped, reloading " << mount_path;
+                Reload();
+                continue;
+            }
+            if (event->len == 0 || (event->mask & IN_ISDIR) || dfs_reserved_name(event->name)) {
+                continue;
+            }
+            std::string name(event->name);
+            if (Refresh(name) && changed) {
+                dfs_log(LL_DEBUG) << "Namespace index | Picked up a change to " << name;
+                changed(name);
+            }
+        }
+    }
+}
@@ -0,0 +1,184 @@
+#ifndef PR4_DFS_NAMESPACE_INDEX_H
+#define PR4_DFS_NAMESPACE_INDEX_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <sys/stat.h>
+
+#include "dfslibx-metrics.h"
+
+/** Shards of the namespace index; a write copies only the shard its name falls in **/
+#define DFS_INDEX_SHARDS 256
+
+/** Bytes of inotify events read at once by the watcher **/
+#define DFS_INDEX_EVENT_BUFFER 0x10000
+
+/** How often the watcher checks whether the index is being destroyed **/
+#define DFS_INDEX_POLL_MS 500
+
+/** Times a refresh checksums a file that keeps changing before it keeps the last result **/
+#define DFS_INDEX_REFRESH_TRIES 3
+
+/** Most threads a reload stats and checksums the mount with **/
+#define DFS_INDEX_LOAD_THREADS 16
+
+/** Files a reload thread takes at a time **/
+#define DFS_INDEX_LOAD_BATCH 256
+
+/** How long the watcher waits to retry a log it could not rewrite **/
+#define DFS_INDEX_COMPACT_RETRY_MS 60000
+
+class DFSIndexLog;
+
+/**
+ * What the index knows about one file: its stat, its checksum, and the
+ * index version at which the entry was written
+ */
+struct DFSIndexEntry {
+    struct stat st;
+    uint32_t checksum;
+    uint64_t version;
+};
+
+/**
+ * In-memory table of every regular file in the mount, so metadata calls
+ * are answered without touching the filesystem.
+ *
+ * The table is split into DFS_INDEX_SHARDS shards by name. Each shard is
+ * an immutable map published through a shared_ptr: a reader takes the
+ * pointer and keeps a consistent copy of the shard for as long as it
+ * holds it, while a writer copies the shard, changes the copy and swaps
+ * it in. Readers take no lock a writer holds, and writers to different
+ * shards never wait on each other.
+ *
+ * The server's handlers call Refresh after they write or delete a file,
+ * and an inotify watcher does the same for changes made behind the
+ * server's back. If the kernel drops events the whole mount is reloaded.
+ *
+ * With a log path every change is also appended to a DFSIndexLog. Start
+ * replays it and then reloads the mount, statx'ing every file on several
+ * threads and only checksumming those whose stat no longer matches, so a
+ * restart does not read the whole mount again. Names with the reserved
+ * prefix, such as the log itself, are never indexed.
+ */
+class DFSNamespaceIndex {
+public:
+    typedef std::map<std::string, DFSIndexEntry> Shard;
+    typedef std::function<uint32_t(const std::string& name, const std::string& path, const struct stat& st)> ChecksumFunction;
+    typedef std::function<void(const std::string& name)> ChangeFunction;
+
+    /**
+     * Every shard as it was when the snapshot was taken. Each shard is
+     * consistent on its own; a write that lands while the snapshot is taken
+     * may be in it or not.
+     */
+    class Snapshot {
+    private:
+        std::vector<std::shared_ptr<const Shard>> shards;
+        uint64_t version = 0;
+        friend class DFSNamespaceIndex;
+
+    public:
+        /**
+         * Call callback(name, entry) for every file, in name order within
+         * each shard. Both stay valid while the snapshot is alive.
+         */
+        template <typename Callback>
+        void ForEach(Callback callback) const {
+            for (const std::shared_ptr<const Shard>& shard : shards) {
+                for (const Shard::value_type& file : *shard) {
+                    callback(file.first, file.second);
+                }
+            }
+        }
+
+        size_t Size() const;
+
+        /** The index version when the snapshot was taken **/
+        uint64_t Version() const { return version; }
+    };
+
+private:
+    std::string mount_path;
+    ChecksumFunction checksum;
+    ChangeFunction changed;
+
+    std::shared_ptr<const Shard> shards[DFS_INDEX_SHARDS];
+    /** Serializes the writers of each shard **/
+    std::mutex writers[DFS_INDEX_SHARDS];
+    std::atomic<uint64_t> version{0};
+
+    int inotify_fd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread watcher;
+
+    std::unique_ptr<DFSIndexLog> log;
+    /** Set once the log has been rewritten from a reloaded index **/
+    std::atomic<bool> logging{false};
+
+    DFSGauge* files;
+    DFSCounter* updates;
+    DFSCounter* reloads;
+
+    static size_t ShardOf(const std::string& name);
+
+    std::shared_ptr<const Shard> LoadShard(size_t index) const;
+    void PublishShard(size_t index, std::shared_ptr<const Shard> shard);
+
+    /**
+     * Scan the whole mount into the index, reusing the checksum of every
+     * entry whose file did not change, and report each name that did
+     */
+    long Reload();
+
+    void Watch();
+
+    /**
+     * Append the current entry of name to the log, or its removal
+     */
+    void LogChange(const std::string& name, const DFSIndexEntry* entry);
+
+public:
+    /**
+     * @param mount_path - must end with a directory separator
+     * @param checksum - computes the checksum of a new or changed file
+     */
+    DFSNamespaceIndex(const std::string& mount_path, ChecksumFunction checksum);
+    ~DFSNamespaceIndex();
+
+    /**
+     * Keep the index in a log at path across restarts. Must be called before Start.
+     */
+    void SetLogPath(const std::string& path);
+
+    /**
+     * Load the mount and start watching it, calling changed with the name
+     * of every file the watcher finds added, changed or removed
+     *
+     * @return the number of files loaded, or -1 if the mount could not be read
+     */
+    long Start(ChangeFunction changed);
+
+    /**
+     * Bring the entry of one file up to date with the filesystem
+     *
+     * @return true if the entry was added, changed or removed
+     */
+    bool Refresh(const std::string& name);
+
+    /**
+     * The entry of name, if the file exists
+     */
+    bool Lookup(const std::string& name, DFSIndexEntry* entry) const;
+
+    Snapshot Take() const;
+};
+
+#endif //PR4_DFS_NAMESPACE_INDEX_H
@@ -2,6 +2,8 @@
 #define PR4_DFS_SERVICE_RUNNER_H
 
 #include <map>
+#include <memory>
+#include <algorithm>
 #include <mutex>
 #include <shared_mutex>
 #include <vector>
@@ -21,6 +23,8 @@
 #include <sys/inotify.h>
 #include <grpcpp/grpcpp.h>
 #include <utime.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "dfs-utils.h"
 #include "dfslibx-call-data.h"
@@ -50,17 +54,22 @@ struct QueueRequest {
  *
  * @tparam RequestT
  * @tparam ResponseT
+ * Each thread drains exactly one completion queue, so the threads never
+ * contend with each other on a shared queue.
+ *
  * @param service
  * @param manager
  * @param cq
+ * @param stats
  */
 template <typename RequestT, typename ResponseT>
 static void HandleAsyncRPC(dfs_service::DFSService::AsyncService* service,
                            DFSCallDataManager<RequestT, ResponseT>* manager,
-                           std::shared_ptr<grpc::ServerCompletionQueue> cq) {
+                           std::shared_ptr<grpc::ServerCompletionQueue> cq,
+                           DFSQueueStats* stats) {
 
     // Spawn a new CallData instance to serve new clients.
-    new DFSCallData<RequestT, ResponseT>(service, manager, cq.get());
+    new DFSCallData<RequestT, ResponseT>(service, manager, cq.get(), stats);
 
     void* tag;  // uniquely identifies a request.
 
@@ -76,10 +85,16 @@ static void HandleAsyncRPC(dfs_service::DFSService::AsyncService* service,
         // GPR_ASSERT(cq->Next(&tag, &ok));
         // GPR_ASSERT(ok);
         dfs_log(LL_DEBUG3) << "HandleAsyncRPC[Next]";
-        if (!cq->Next(&tag, &ok) || !ok) {
+        if (!cq->Next(&tag, &ok)) {
+            dfs_log(LL_ERROR) << "HandleAsyncRPC completion queue is shutting down";
+            continue;
+        }
+        if (!ok) {
             dfs_log(LL_ERROR) << "HandleAsyncRPC failed to get an ok from completion queue. Did the client crash?";
+            static_cast<DFSCallData<RequestT, ResponseT>*>(tag)->Abandon();
             continue;
         }
+        stats->events.fetch_add(1, std::memory_order_relaxed);
         static_cast<DFSCallData<RequestT, ResponseT>*>(tag)->Proceed();
     }
 }
@@ -96,6 +111,20 @@ static void HandleSyncRPC(std::shared_ptr<grpc::Server> server) {
     server->Wait();
 }
 
+/**
+ * Pin a thread to a single CPU.
+ *
+ * @param thread
+ * @param cpu
+ * @return true if the affinity was applied
+ */
+static inline bool PinThreadToCpu(std::thread& thread, int cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset) == 0;
+}
+
 /**
  * The DFSServiceRunner has been abstracted out of the DFSServiceImpl
  * in order to make it easier for students to focus on the specifics of the assignment.
@@ -124,8 +153,17 @@ protected:
     /** The server instance **/
     std::shared_ptr<grpc::Server> server;
 
-    /** The completion queue for async calls **/
-    std::shared_ptr<grpc::ServerCompletionQueue> completion_queue;
+    /** The completion queues for async calls, one per async thread **/
+    std::vector<std::shared_ptr<grpc::ServerCompletionQueue>> completion_queues;
+
+    /** Counters for each completion queue, indexed like completion_queues **/
+    std::vector<std::unique_ptr<DFSQueueStats>> queue_stats;
+
+    /** Pin each async thread to its own CPU **/
+    bool cpu_affinity = false;
+
+    /** How often the queue stats are logged in milliseconds (0 disables) **/
+    int stats_interval = 0;
 
     /** The async service object **/
     dfs_service::DFSService::AsyncService async_service;
@@ -148,6 +186,37 @@ public:
         this->num_async_threads = num_async_threads;
     }
 
+    void SetCpuAffinity(bool cpu_affinity) {
+        this->cpu_affinity = cpu_affinity;
+    }
+
+    void SetStatsInterval(int stats_interval) {
+        this->stats_interval = stats_interval;
+    }
+
+    /**
+     * The per completion queue counters. Only valid once Run has been called.
+     */
+    const std::vector<std::unique_ptr<DFSQueueStats>>& QueueStats() const {
+        return this->queue_stats;
+    }
+
+    /**
+     * Log one line per completion queue with its depth and latency
+     */
+    void LogQueueStats() const {
+        for (const std::unique_ptr<DFSQueueStats>& stats : this->queue_stats) {
+            dfs_log(LL_SYSINFO) << "Queue " << stats->queue_index
+                << " | cpu: " << stats->cpu
+                << " events: " << stats->events.load()
+                << " depth: " << stats->depth.load()
+                << " max_depth: " << stats->max_depth.load()
+                << " completed: " << stats->completed.load()
+                << " mean_latency_us: " << stats->MeanLatencyUs()
+                << " max_latency_us: " << stats->max_latency_us.load();
+        }
+    }
+
     void Shutdown() noexcept {
         this->server->Shutdown();
     }
@@ -163,22 +232,53 @@ public:
         grpc::ServerBuilder builder;
         builder.AddListeningPort(this->server_address, grpc::InsecureServerCredentials());
         builder.RegisterService(this->service);
-        this->completion_queue = builder.AddCompletionQueue();
+
+        // One completion queue per async thread
+        int num_queues = std::max(this->num_async_threads, 1);
+        for (int i = 0; i < num_queues; i++) {
+            this->completion_queues.push_back(builder.AddCompletionQueue());
+            this->queue_stats.emplace_back(new DFSQueueStats());
+            this->queue_stats.back()->queue_index = i;
+        }
+
         this->server = builder.BuildAndStart();
         dfs_log(LL_SYSINFO) << "DFSServerNode server running on " << this->server_address;
 
         std::vector <std::thread> threads;
+        int num_cpus = static_cast<int>(std::thread::hardware_concurrency());
 
-        // Send async methods to separate threads
-        for (int i = this->num_async_threads; i > 0; i--) {
+        // Send async methods to separate threads, each draining its own queue
+        for (int i = 0; i < num_queues; i++) {
+            DFSQueueStats* stats = this->queue_stats[i].get();
             std::thread thread_async(HandleAsyncRPC<RequestT, ResponseT>,
                                      &this->async_service,
                                      dynamic_cast<DFSCallDataManager<RequestT, ResponseT> *>(this->service),
-                                     this->completion_queue);
-            dfs_log(LL_SYSINFO) << "Async thread " << i << " started";
+                                     this->completion_queues[i],
+                                     stats);
+            if (this->cpu_affinity && num_cpus > 0) {
+                int cpu = i % num_cpus;
+                if (PinThreadToCpu(thread_async, cpu)) {
+                    stats->cpu = cpu;
+                } else {
+                    dfs_log(LL_ERROR) << "Could not pin async thread " << i << " to cpu " << cpu;
+                }
+            }
+            dfs_log(LL_SYSINFO) << "Async thread " << i << " started on queue " << i;
             threads.push_back(std::move(thread_async));
         }
 
+        // Periodically report the queue stats
+        if (this->stats_interval > 0) {
+            std::thread thread_stats([this]{
+                while (true) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(this->stats_interval));
+                    this->LogQueueStats();
+                }
+            });
+            dfs_log(LL_SYSINFO) << "Stats thread " << " started";
+            threads.push_back(std::move(thread_stats));
+        }
+
         // Start the synchronous server on a separate thread
         std::thread thread_server(HandleSyncRPC<RequestT, ResponseT>, this->server);
         dfs_log(LL_SYSINFO) << "Server thread " << " started";
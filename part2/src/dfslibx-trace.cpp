@@ -0,0 +1,173 @@
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "dfs-utils.h"
+#include "dfslibx-trace.h"
+
+std::atomic<bool> DFSTracer::enabled{false};
+
+static thread_local uint64_t current_trace_id = 0;
+
+static int64_t WallClockUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void DumpTraceAtExit() {
+    DFSTracer::Instance().Dump();
+}
+
+static std::string JsonEscape(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') { escaped += '\\'; escaped += c; }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else { escaped += c; }
+    }
+    return escaped;
+}
+
+static std::string TraceIdHex(uint64_t trace_id) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(trace_id));
+    return std::string(hex);
+}
+
+DFSTracer& DFSTracer::Instance() {
+    static DFSTracer tracer;
+    return tracer;
+}
+
+void DFSTracer::Enable(const std::string& output_path, const std::string& process_name) {
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        this->output_path = output_path;
+        this->process_name = process_name;
+    }
+    if (!enabled.exchange(true)) {
+        std::atexit(DumpTraceAtExit);
+    }
+    dfs_log(LL_SYSINFO) << "Tracing enabled, spans will be written to " << output_path;
+}
+
+DFSTracer::ThreadBuffer* DFSTracer::LocalBuffer() {
+    static thread_local ThreadBuffer* local = nullptr;
+    if (local == nullptr) {
+        std::shared_ptr<ThreadBuffer> buffer = std::make_shared<ThreadBuffer>();
+        buffer->thread_id = static_cast<uint32_t>(syscall(SYS_gettid));
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(buffer);
+        local = buffer.get();
+    }
+    return local;
+}
+
+void DFSTracer::Record(DFSTraceEvent&& event) {
+    ThreadBuffer* buffer = LocalBuffer();
+    event.thread_id = buffer->thread_id;
+    std::lock_guard<std::mutex> lock(buffer->buffer_mutex);
+    buffer->events.push_back(std::move(event));
+}
+
+bool DFSTracer::Dump() {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    if (output_path.empty()) {
+        return false;
+    }
+
+    std::ofstream file(output_path, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    int pid = static_cast<int>(getpid());
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+         << ",\"args\":{\"name\":\"" << JsonEscape(process_name) << "\"}}";
+
+    for (const std::shared_ptr<ThreadBuffer>& buffer : buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->buffer_mutex);
+        for (const DFSTraceEvent& event : buffer->events) {
+            file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+                 << "\",\"ph\":\"X\",\"ts\":" << event.start_us << ",\"dur\":" << event.duration_us
+                 << ",\"pid\":" << pid << ",\"tid\":" << event.thread_id
+                 << ",\"args\":{\"trace_id\":\"" << TraceIdHex(event.trace_id) << "\"";
+            if (!event.detail.empty()) {
+                file << ",\"file\":\"" << JsonEscape(event.detail) << "\"";
+            }
+            if (event.arg_name != nullptr) {
+                file << ",\"" << event.arg_name << "\":" << event.arg_value;
+            }
+            file << "}}";
+        }
+    }
+    file << "\n]}\n";
+    file.close();
+    return !file.fail();
+}
+
+uint64_t DFSTracer::NewTraceId() {
+    static thread_local std::mt19937_64 generator(std::random_device{}() ^
+        static_cast<uint64_t>(WallClockUs()) ^ static_cast<uint64_t>(syscall(SYS_gettid)));
+    uint64_t trace_id = 0;
+    while (trace_id == 0) { trace_id = generator(); }
+    return trace_id;
+}
+
+uint64_t DFSTracer::CurrentTraceId() {
+    return current_trace_id;
+}
+
+void DFSTracer::SetCurrentTraceId(uint64_t trace_id) {
+    current_trace_id = trace_id;
+}
+
+void DFSTracer::Inject(grpc::ClientContext* context) {
+    if (Enabled() && current_trace_id != 0) {
+        context->AddMetadata(DFS_TRACE_METADATA_KEY, TraceIdHex(current_trace_id));
+    }
+}
+
+uint64_t DFSTracer::Extract(const grpc::ServerContext* context) {
+    if (!Enabled()) {
+        return 0;
+    }
+    auto found = context->client_metadata().find(DFS_TRACE_METADATA_KEY);
+    if (found == context->client_metadata().end()) {
+        return 0;
+    }
+    std::string hex(found->second.data(), found->second.length());
+    return std::strtoull(hex.c_str(), nullptr, 16);
+}
+
+DFSTraceSpan::DFSTraceSpan(const char* name, const char* category, const std::string& detail) :
+    active(DFSTracer::Enabled()), name(name), category(category),
+    arg_name(nullptr), arg_value(0), start_us(0) {
+    if (active) {
+        this->detail = detail;
+        start_us = WallClockUs();
+    }
+}
+
+void DFSTraceSpan::End() {
+    if (!active) {
+        return;
+    }
+    active = false;
+    DFSTraceEvent event = {name, category, DFSTracer::CurrentTraceId(), start_us,
+                           WallClockUs() - start_us, 0, std::move(detail), arg_name, arg_value};
+    DFSTracer::Instance().Record(std::move(event));
+}
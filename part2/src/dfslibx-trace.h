@@ -0,0 +1,167 @@
+#ifndef PR4_DFS_TRACE_H
+#define PR4_DFS_TRACE_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <grpcpp/grpcpp.h>
+
+/** gRPC metadata key used to carry the trace id from the client to the server **/
+#define DFS_TRACE_METADATA_KEY "dfs-trace-id"
+
+/**
+ * One completed span, recorded as a Chrome trace "complete" (ph: X) event
+ */
+struct DFSTraceEvent {
+    const char* name;
+    const char* category;
+    uint64_t trace_id;
+    int64_t start_us;
+    int64_t duration_us;
+    uint32_t thread_id;
+    std::string detail;
+    const char* arg_name;
+    int64_t arg_value;
+};
+
+/**
+ * Lightweight request phase tracer.
+ *
+ * Spans are appended to a buffer owned by the recording thread and only
+ * gathered when the trace is dumped, so recording never contends across
+ * threads. When tracing is disabled a span costs one relaxed atomic load.
+ *
+ * The dump is Chrome trace-event JSON and can be opened in Perfetto
+ * (ui.perfetto.dev) or chrome://tracing. Timestamps are wall clock
+ * microseconds so client and server traces line up when their
+ * "traceEvents" arrays are concatenated; the shared trace id is in the
+ * args of every event.
+ */
+class DFSTracer {
+private:
+    struct ThreadBuffer {
+        std::mutex buffer_mutex;
+        std::vector<DFSTraceEvent> events;
+        uint32_t thread_id;
+    };
+
+    static std::atomic<bool> enabled;
+
+    std::mutex buffers_mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::string output_path;
+    std::string process_name;
+
+    ThreadBuffer* LocalBuffer();
+
+public:
+    static DFSTracer& Instance();
+
+    /**
+     * Whether spans are being recorded
+     */
+    static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * Start recording spans and dump them to output_path at process exit
+     *
+     * @param output_path
+     * @param process_name - shown as the process label in the trace viewer
+     */
+    void Enable(const std::string& output_path, const std::string& process_name);
+
+    /**
+     * Append a span to the calling thread's buffer
+     */
+    void Record(DFSTraceEvent&& event);
+
+    /**
+     * Write every recorded span to the output path as Chrome trace JSON
+     *
+     * @return true if the file was written
+     */
+    bool Dump();
+
+    /**
+     * A new random, non-zero trace id
+     */
+    static uint64_t NewTraceId();
+
+    /**
+     * The trace id of the request the calling thread is working on (0 if none)
+     */
+    static uint64_t CurrentTraceId();
+    static void SetCurrentTraceId(uint64_t trace_id);
+
+    /**
+     * Attach the current trace id to an outgoing call
+     */
+    static void Inject(grpc::ClientContext* context);
+
+    /**
+     * Read the trace id sent by the client (0 if none)
+     */
+    static uint64_t Extract(const grpc::ServerContext* context);
+};
+
+/**
+ * Sets the calling thread's current trace id for the lifetime of the object.
+ * A new id is generated when tracing is on and none is given.
+ */
+class DFSTraceScope {
+private:
+    uint64_t previous;
+
+public:
+    explicit DFSTraceScope(uint64_t trace_id = 0) : previous(DFSTracer::CurrentTraceId()) {
+        if (trace_id == 0 && DFSTracer::Enabled()) { trace_id = DFSTracer::NewTraceId(); }
+        DFSTracer::SetCurrentTraceId(trace_id);
+    }
+    ~DFSTraceScope() { DFSTracer::SetCurrentTraceId(previous); }
+};
+
+/**
+ * Records a span from construction until End() or destruction.
+ *
+ * Usage:
+ *
+ *      DFSTraceSpan span("Store.checksum", "client", filename);
+ *      ...
+ *      span.End();
+ */
+class DFSTraceSpan {
+private:
+    bool active;
+    const char* name;
+    const char* category;
+    std::string detail;
+    const char* arg_name;
+    int64_t arg_value;
+    int64_t start_us;
+
+public:
+    DFSTraceSpan(const char* name, const char* category, const std::string& detail);
+    ~DFSTraceSpan() { End(); }
+
+    /**
+     * Set the file name shown with the span
+     */
+    void SetDetail(const std::string& detail) {
+        if (active) { this->detail = detail; }
+    }
+
+    /**
+     * Attach a numeric argument to the span, e.g. bytes or disk time
+     */
+    void SetArg(const char* arg_name, int64_t arg_value) {
+        this->arg_name = arg_name;
+        this->arg_value = arg_value;
+    }
+
+    void End();
+};
+
+#endif //PR4_DFS_TRACE_H
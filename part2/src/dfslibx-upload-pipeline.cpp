@@ -0,0 +1,226 @@
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iterator>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "dfs-utils.h"
+#include "dfslibx-metrics.h"
+#include "dfslibx-upload-pipeline.h"
+
+/** Spare chunk buffers, never freed so uploads on any thread can reuse them **/
+static std::mutex spare_mutex;
+static std::vector<std::string>* spare_chunks = []() {
+    std::vector<std::string>* chunks = new std::vector<std::string>();
+    chunks->reserve(DFS_PIPELINE_MAX_SPARE);
+    return chunks;
+}();
+
+DFSUploadPipeline::DFSUploadPipeline(int fd, size_t capacity) : fd(fd), capacity(capacity) {
+    //Sized up front so the queue swaps do not allocate while chunks arrive
+    queued.reserve(DFS_PIPELINE_RESERVE);
+    queued_offsets.reserve(DFS_PIPELINE_RESERVE);
+    batch.reserve(DFS_PIPELINE_RESERVE);
+    batch_offsets.reserve(DFS_PIPELINE_RESERVE);
+    iovecs.reserve(DFS_PIPELINE_RESERVE);
+    writer = std::thread([this]() { WriterLoop(); });
+}
+
+DFSUploadPipeline::~DFSUploadPipeline() {
+    Finish();
+}
+
+bool DFSUploadPipeline::Push(std::string&& chunk) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    off_t offset = next_offset;
+    lock.unlock();
+    return Push(std::move(chunk), offset);
+}
+
+bool DFSUploadPipeline::Push(std::string&& chunk, off_t offset) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    //Always admit a chunk into an empty queue so one larger than capacity can not wait forever
+    not_full.wait(lock, [&]() { return error != 0 || queued_bytes == 0 || queued_bytes + chunk.length() <= capacity; });
+    if (error != 0 || closed) {
+        return false;
+    }
+    queued_bytes += chunk.length();
+    next_offset = offset + static_cast<off_t>(chunk.length());
+    queued_offsets.push_back(offset);
+    queued.push_back(std::move(chunk));
+    lock.unlock();
+    not_empty.notify_one();
+    return true;
+}
+
+bool DFSUploadPipeline::Finish() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        closed = true;
+    }
+    not_empty.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    return Error() == 0;
+}
+
+std::string DFSUploadPipeline::TakeSpare() {
+    std::lock_guard<std::mutex> lock(spare_mutex);
+    if (spare_chunks->empty()) {
+        return std::string();
+    }
+    std::string chunk = std::move(spare_chunks->back());
+    spare_chunks->pop_back();
+    return chunk;
+}
+
+int DFSUploadPipeline::Error() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return error;
+}
+
+off_t DFSUploadPipeline::Written() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return written;
+}
+
+uint64_t DFSUploadPipeline::DiskTimeUs() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return disk_us;
+}
+
+uint64_t DFSUploadPipeline::Writes() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return writes;
+}
+
+void DFSUploadPipeline::WriterLoop() {
+    static DFSHistogram* batchChunks = DFSMetricsRegistry::Instance().Histogram(
+        "dfs_upload_batch_chunks", "Chunks coalesced into each upload write");
+
+    while (true) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        not_empty.wait(lock, [&]() { return closed || !queued.empty(); });
+        if (queued.empty()) {
+            break;
+        }
+        //Double buffering: take the whole queue and leave the last batch's empty vector,
+        //or move out the oldest DFS_PIPELINE_RESERVE chunks when more are queued
+        if (queued.size() <= DFS_PIPELINE_RESERVE) {
+            batch.swap(queued);
+            batch_offsets.swap(queued_offsets);
+            queued_bytes = 0;
+        }
+        else {
+            batch.assign(std::make_move_iterator(queued.begin()), std::make_move_iterator(queued.begin() + DFS_PIPELINE_RESERVE));
+            batch_offsets.assign(queued_offsets.begin(), queued_offsets.begin() + DFS_PIPELINE_RESERVE);
+            queued.erase(queued.begin(), queued.begin() + DFS_PIPELINE_RESERVE);
+            queued_offsets.erase(queued_offsets.begin(), queued_offsets.begin() + DFS_PIPELINE_RESERVE);
+            for (const std::string& chunk : batch) {
+                queued_bytes -= chunk.length();
+            }
+        }
+        lock.unlock();
+        not_full.notify_one();
+
+        batchChunks->Record(batch.size());
+        bool written = WriteBatch();
+
+        {
+            std::lock_guard<std::mutex> spare_lock(spare_mutex);
+            for (std::string& chunk : batch) {
+                if (spare_chunks->size() >= DFS_PIPELINE_MAX_SPARE) { break; }
+                chunk.clear();
+                spare_chunks->push_back(std::move(chunk));
+            }
+        }
+        batch.clear();
+        batch_offsets.clear();
+        if (!written) {
+            //Drop what is left and wake a receiver waiting for room
+            lock.lock();
+            queued.clear();
+            queued_offsets.clear();
+            queued_bytes = 0;
+            lock.unlock();
+            not_full.notify_all();
+            break;
+        }
+    }
+}
+
+bool DFSUploadPipeline::WriteBatch() {
+    auto DiskStart = std::chrono::steady_clock::now();
+    size_t done = 0;
+    uint64_t calls = 0;
+    int failure = 0;
+    off_t runOffset = 0;
+
+    //One pwritev for each run of chunks that follow each other in the file
+    size_t first = 0;
+    while (first < batch.size() && failure == 0) {
+        runOffset = batch_offsets[first];
+        size_t runLength = 0;
+        iovecs.clear();
+        size_t end = first;
+        while (end < batch.size() && batch_offsets[end] == runOffset + static_cast<off_t>(runLength)) {
+            if (!batch[end].empty()) {
+                iovecs.push_back({&batch[end][0], batch[end].length()});
+                runLength += batch[end].length();
+            }
+            end++;
+        }
+        failure = WriteRun(runOffset, runLength, &calls);
+        if (failure == 0) {
+            done += runLength;
+        }
+        first = end;
+    }
+    uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - DiskStart).count());
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    written += static_cast<off_t>(done);
+    disk_us += elapsed;
+    writes += calls;
+    if (failure != 0) {
+        dfs_log(LL_ERROR) << "Upload pipeline write failed in the run at offset " << runOffset << ": " << strerror(failure);
+        error = failure;
+        return false;
+    }
+    return true;
+}
+
+int DFSUploadPipeline::WriteRun(off_t offset, size_t length, uint64_t* calls) {
+    size_t first = 0;
+    size_t done = 0;
+    while (done < length) {
+        ssize_t written = pwritev(fd, iovecs.data() + first,
+                                  static_cast<int>(std::min<size_t>(iovecs.size() - first, IOV_MAX)),
+                                  offset + static_cast<off_t>(done));
+        (*calls)++;
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) {
+            return written < 0 ? errno : EIO;
+        }
+        done += static_cast<size_t>(written);
+        //Skip the vectors that were written fully and trim a partly written one
+        size_t remaining = static_cast<size_t>(written);
+        while (first < iovecs.size() && remaining >= iovecs[first].iov_len) {
+            remaining -= iovecs[first].iov_len;
+            first++;
+        }
+        if (remaining > 0) {
+            iovecs[first].iov_base = static_cast<char*>(iovecs[first].iov_base) + remaining;
+            iovecs[first].iov_len -= remaining;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+#ifndef PR4_DFS_UPLOAD_PIPELINE_H
+#define PR4_DFS_UPLOAD_PIPELINE_H
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+#include <sys/uio.h>
+#include <sys/types.h>
+
+/** Received bytes an upload may queue ahead of its writer before the receiver waits **/
+#define DFS_PIPELINE_CAPACITY 0x400000
+
+/** Most chunks the writer takes in one batch, and the queue slots reserved when an upload starts **/
+#define DFS_PIPELINE_RESERVE 256
+
+/** Written chunk buffers kept for reuse, shared by all uploads **/
+#define DFS_PIPELINE_MAX_SPARE 1024
+
+/**
+ * Two stage pipeline for one upload. The receiving thread hands each chunk
+ * to Push, and a writer thread takes what was queued since its last write,
+ * up to DFS_PIPELINE_RESERVE chunks, and writes it with pwritev, so the network and the disk overlap and
+ * small chunks reach the disk in large writes. The queue is bounded by
+ * capacity bytes: a disk that falls behind makes Push wait, which in turn
+ * holds back the client through gRPC flow control.
+ *
+ * Written chunks are cleared and kept as spares in a pool shared by every
+ * upload, so a new upload starts with warm buffers. A receiver that swaps
+ * TakeSpare() into its message before each Read lets protobuf parse the
+ * next chunk into memory that is already allocated, so the steady state
+ * receive and write path allocates nothing per chunk.
+ *
+ * Chunks are written one after another from offset 0 of fd unless pushed
+ * with an offset of their own; a run of chunks that follow each other goes
+ * in one pwritev, and skipped ranges are left as holes. The caller keeps
+ * ownership of fd and closes it after Finish.
+ */
+class DFSUploadPipeline {
+private:
+    int fd;
+    size_t capacity;
+
+    std::mutex queue_mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::vector<std::string> queued;
+    std::vector<off_t> queued_offsets;
+    size_t queued_bytes = 0;
+    off_t next_offset = 0;
+    bool closed = false;
+    int error = 0;
+
+    off_t written = 0;
+    uint64_t disk_us = 0;
+    uint64_t writes = 0;
+    std::thread writer;
+
+    /** Only used by the writer thread **/
+    std::vector<std::string> batch;
+    std::vector<off_t> batch_offsets;
+    std::vector<struct iovec> iovecs;
+
+    void WriterLoop();
+    bool WriteBatch();
+
+    /** Write iovecs, length bytes in all, at offset. Returns 0 or an errno. **/
+    int WriteRun(off_t offset, size_t length, uint64_t* calls);
+
+public:
+    explicit DFSUploadPipeline(int fd, size_t capacity = DFS_PIPELINE_CAPACITY);
+    ~DFSUploadPipeline();
+
+    /**
+     * Queue a chunk for writing, waiting while the queue is full.
+     * Returns false once the writer has failed.
+     */
+    bool Push(std::string&& chunk);
+
+    /**
+     * Queue a chunk to be written at offset. The next Push without an
+     * offset continues after it.
+     */
+    bool Push(std::string&& chunk, off_t offset);
+
+    /**
+     * An empty string that keeps the capacity of a chunk already written,
+     * or a new empty string if there is none
+     */
+    std::string TakeSpare();
+
+    /**
+     * Write everything still queued and stop the writer.
+     * Returns true if every chunk was written.
+     */
+    bool Finish();
+
+    /** errno of the first failed write, 0 if none **/
+    int Error();
+
+    /** Bytes written so far **/
+    off_t Written();
+
+    /** Time the writer spent in pwritev, in microseconds **/
+    uint64_t DiskTimeUs();
+
+    /** Number of pwritev calls **/
+    uint64_t Writes();
+};
+
+#endif //PR4_DFS_UPLOAD_PIPELINE_H